@@ -0,0 +1,37 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Replaces the global operator new and delete to count live heap bytes,
+// their peak and allocation calls, for the footprint measurements of test
+// and bench. Include it in exactly one translation unit per program. The
+// counters are atomic because some measurements allocate from pool threads.
+
+static std::atomic<size_t> allocated_bytes = 0;
+static std::atomic<size_t> peak_bytes = 0;
+static std::atomic<size_t> allocation_count = 0;
+
+auto operator new(size_t size) -> void * {
+    // a 16-byte header keeps the size and the default alignment
+    auto *p = static_cast<size_t *>(std::malloc(size + 16));
+    if (p == nullptr) throw std::bad_alloc();
+    const size_t live =
+        allocated_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    size_t peak = peak_bytes.load(std::memory_order_relaxed);
+    while (peak < live
+           and !peak_bytes.compare_exchange_weak(
+               peak, live, std::memory_order_relaxed))
+        ;
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    *p = size;
+    return p + 2;
+}
+auto operator delete(void *p) noexcept -> void {
+    if (p == nullptr) return;
+    auto *base = static_cast<size_t *>(p) - 2;
+    allocated_bytes.fetch_sub(*base, std::memory_order_relaxed);
+    std::free(base);
+}
+auto operator delete(void *p, size_t) noexcept -> void { operator delete(p); }
@@ -0,0 +1,353 @@
+#include "include/json.hpp"
+#include "include/json_lazy.hpp"
+#include "alloc_count.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#if __has_include(<sys/resource.h>)
+#include <sys/resource.h>
+#define EEE_BENCH_RUSAGE 1
+#endif
+
+#ifdef EEE_BENCH_NLOHMANN
+#include <nlohmann/json.hpp>
+#endif
+#ifdef EEE_BENCH_RAPIDJSON
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#endif
+#ifdef EEE_BENCH_SIMDJSON
+#include <simdjson.h>
+#endif
+
+// Parse, generate and round-trip throughput over a corpus of typical
+// document shapes, with allocations and peak heap per parsed document.
+//
+//     bench [file...]
+//
+// Files given on the command line are measured after the built-in corpus.
+
+namespace {
+
+struct Document {
+    std::string name;
+    std::string text;
+};
+
+// shapes of the usual benchmark files, generated so that nothing needs to
+// be downloaded; the same seed gives the same text every run
+std::mt19937_64 rng(38);
+
+auto random_int(int64_t lo, int64_t hi) -> int64_t {
+    return std::uniform_int_distribution<int64_t>(lo, hi)(rng);
+}
+
+auto random_word(size_t min, size_t max) -> std::string {
+    std::string ret(random_int(min, max), ' ');
+    for (char &c : ret) c = static_cast<char>('a' + random_int(0, 25));
+    return ret;
+}
+
+// twitter.json: API responses with nested users, entities and CJK text
+auto make_twitter() -> std::string {
+    static constexpr const char *text[] = {
+        "@aym0566x \\n\\n名前:前田あゆみ\\n第一印象:なんか怖っ！",
+        "RT @KATANA77: えっそれは・・・（一同） http://t.co/PkCJAcSuYK",
+        "一緒に夢でも見ようか #RTした人全員フォローする", "plain ascii tweet",
+    };
+    std::string out = "{\"statuses\":[";
+    for (int i = 0; i < 1000; ++i) {
+        if (i != 0) out += ',';
+        const auto id = std::to_string(250075927172759552 + i);
+        out += "{\"created_at\":\"Sun Aug 31 00:29:15 +0000 2014\",\"id\":"
+               + id + ",\"id_str\":\"" + id + "\",\"text\":\""
+               + text[random_int(0, 3)]
+               + "\",\"truncated\":false,\"entities\":{\"hashtags\":[{"
+                 "\"text\":\""
+               + random_word(3, 12)
+               + "\",\"indices\":[" + std::to_string(random_int(0, 60)) + ","
+               + std::to_string(random_int(60, 140))
+               + "]}],\"urls\":[],\"user_mentions\":[]},\"user\":{\"id\":"
+               + std::to_string(random_int(1, 3000000000))
+               + ",\"name\":\"" + random_word(4, 16)
+               + "\",\"screen_name\":\"" + random_word(4, 12)
+               + "\",\"location\":\"東京\",\"followers_count\":"
+               + std::to_string(random_int(0, 100000))
+               + ",\"verified\":false,\"profile_image_url\":\"http://pbs."
+                 "twimg.com/profile_images/"
+               + std::to_string(random_int(1, 1 << 30))
+               + "/normal.jpeg\",\"default_profile\":true},\"geo\":null,"
+                 "\"retweet_count\":"
+               + std::to_string(random_int(0, 500))
+               + ",\"favorited\":false,\"lang\":\"ja\"}";
+    }
+    return out + "],\"search_metadata\":{\"completed_in\":0.087,\"count\":"
+                 "1000,\"query\":\"%E4%B8%80\"}}";
+}
+
+// canada.json: one polygon of full-precision coordinate pairs
+auto make_canada() -> std::string {
+    std::string out =
+        "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\","
+        "\"properties\":{\"name\":\"Canada\"},\"geometry\":{\"type\":"
+        "\"Polygon\",\"coordinates\":[";
+    std::uniform_real_distribution<double> lon(-141, -52), lat(41, 83);
+    char buf[32];
+    for (int ring = 0; ring < 40; ++ring) {
+        out += ring == 0 ? "[" : ",[";
+        for (int i = 0; i < 1400; ++i) {
+            out += i == 0 ? "[" : ",[";
+            out.append(buf, std::to_chars(buf, buf + 32, lon(rng)).ptr);
+            out += ',';
+            out.append(buf, std::to_chars(buf, buf + 32, lat(rng)).ptr);
+            out += ']';
+        }
+        out += ']';
+    }
+    return out + "]}}]}";
+}
+
+// citm_catalog.json: objects keyed by numeric ids, many small int arrays
+auto make_citm() -> std::string {
+    std::string out = "{\"areaNames\":{";
+    for (int i = 0; i < 200; ++i) {
+        if (i != 0) out += ',';
+        out += "\"" + std::to_string(205705993 + i) + "\":\"Arrière-scène "
+               + random_word(4, 10) + "\"";
+    }
+    out += "},\"events\":{";
+    for (int i = 0; i < 1500; ++i) {
+        if (i != 0) out += ',';
+        const auto id = std::to_string(138586341 + i);
+        out += "\"" + id + "\":{\"description\":null,\"id\":" + id
+               + ",\"logo\":null,\"name\":\"" + random_word(5, 30)
+               + "\",\"subTopicIds\":[337184269,337184283],\"subjectCode\":"
+                 "null,\"subtitle\":null,\"topicIds\":[324846099,107888604]}";
+    }
+    out += "},\"performances\":[";
+    for (int i = 0; i < 2000; ++i) {
+        if (i != 0) out += ',';
+        out += "{\"eventId\":" + std::to_string(138586341 + i % 1500)
+               + ",\"id\":" + std::to_string(339887544 + i)
+               + ",\"logo\":null,\"name\":null,\"prices\":[";
+        for (int j = 0, n = int(random_int(1, 4)); j < n; ++j) {
+            if (j != 0) out += ',';
+            out += "{\"amount\":" + std::to_string(random_int(10, 900) * 250)
+                   + ",\"audienceSubCategoryId\":337100890,"
+                     "\"seatCategoryId\":"
+                   + std::to_string(338937295 + j) + "}";
+        }
+        out += "],\"seatCategories\":[{\"areas\":[{\"areaId\":205705999,"
+               "\"blockIds\":[]},{\"areaId\":205705998,\"blockIds\":[]}],"
+               "\"seatCategoryId\":338937295}],\"seatMapImage\":null,"
+               "\"start\":"
+               + std::to_string(1372701600000 + i * 86400000LL)
+               + ",\"venueCode\":\"PLEYEL_PLEYEL\"}";
+    }
+    return out + "]}";
+}
+
+// chains of objects and arrays 500 levels deep, within the default limit
+auto make_deep() -> std::string {
+    std::string out = "[";
+    for (int i = 0; i < 200; ++i) {
+        if (i != 0) out += ',';
+        for (int d = 0; d < 500; ++d) out += d % 2 ? "[" : "{\"k\":";
+        out += std::to_string(i);
+        for (int d = 499; d >= 0; --d) out += d % 2 ? "]" : "}";
+    }
+    return out + "]";
+}
+
+// a few large strings with occasional escapes
+auto make_long_strings() -> std::string {
+    std::string out = "[";
+    for (int i = 0; i < 20; ++i) {
+        if (i != 0) out += ',';
+        out += '"';
+        for (int j = 0; j < 2000; ++j)
+            out += random_word(2, 12) + (j % 50 == 49 ? "\\n\\\"" : " ");
+        out += '"';
+    }
+    return out + "]";
+}
+
+auto read_file(const std::string &path) -> std::string {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "cannot read " << path << "\n";
+        std::exit(1);
+    }
+    return {std::istreambuf_iterator<char>(in), {}};
+}
+
+// MB/s of `f` over `bytes` of input: the best of several timed batches, each
+// at least 20 ms long
+auto mbps(size_t bytes, const std::function<void()> &f) -> double {
+    using clock = std::chrono::steady_clock;
+    double best = 0;
+    for (int batch = 0; batch < 5; ++batch) {
+        const auto start = clock::now();
+        size_t runs = 0;
+        std::chrono::duration<double> d{};
+        do {
+            f();
+            ++runs;
+            d = clock::now() - start;
+        } while (d.count() < 0.02);
+        best = std::max(best, bytes * runs / d.count() / 1e6);
+    }
+    return best;
+}
+
+auto print_row(
+    const std::string &name, const std::string &size,
+    const std::string &parser, double parse, double generate,
+    double round_trip) -> void {
+    std::cout << std::left << std::setw(14) << name << std::right
+              << std::setw(8) << size << "  " << std::left << std::setw(10)
+              << parser << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << parse << std::setw(10) << generate
+              << std::setw(11) << round_trip;
+}
+
+auto run(const Document &doc) -> void {
+    const auto &text = doc.text;
+    eee::ParseError error;
+    auto tree = eee::parse(text, error);
+    if (!tree) {
+        std::cout << doc.name << ":" << error.line << ":" << error.column
+                  << ": " << error.message << "\n";
+        return;
+    }
+    const size_t count_before = allocation_count;
+    const size_t live_before = allocated_bytes;
+    peak_bytes.store(allocated_bytes);
+    {
+        auto once = eee::parse(text);
+    }
+    const size_t allocs = allocation_count - count_before;
+    const size_t peak = peak_bytes - live_before;
+
+    const double parse = mbps(text.size(), [&] {
+        auto ret = eee::parse(text);
+        if (!ret) std::abort();
+    });
+    const double generate = mbps(text.size(), [&] {
+        auto ret = eee::generate(*tree);
+        if (ret.empty()) std::abort();
+    });
+    const double round_trip = mbps(text.size(), [&] {
+        auto ret = eee::generate(eee::parse(text).value());
+        if (ret.empty()) std::abort();
+    });
+    print_row(
+        doc.name, std::to_string(text.size() / 1024), "eee", parse, generate,
+        round_trip);
+    std::cout << std::setw(12) << allocs << std::setw(10)
+              << peak / 1024 << "\n";
+
+#ifdef EEE_BENCH_NLOHMANN
+    {
+        const auto other = nlohmann::json::parse(text);
+        print_row(
+            "", "", "nlohmann",
+            mbps(text.size(), [&] { auto r = nlohmann::json::parse(text); }),
+            mbps(text.size(), [&] { auto r = other.dump(); }),
+            mbps(text.size(),
+                 [&] { auto r = nlohmann::json::parse(text).dump(); }));
+        std::cout << "\n";
+    }
+#endif
+#ifdef EEE_BENCH_RAPIDJSON
+    {
+        auto parse_rapid = [&](rapidjson::Document &d) {
+            d.Parse(text.data(), text.size());
+        };
+        auto write_rapid = [](const rapidjson::Document &d) {
+            rapidjson::StringBuffer buf;
+            rapidjson::Writer<rapidjson::StringBuffer> writer(buf);
+            d.Accept(writer);
+            return buf.GetSize();
+        };
+        rapidjson::Document other;
+        parse_rapid(other);
+        print_row(
+            "", "", "rapidjson", mbps(text.size(), [&] {
+                rapidjson::Document d;
+                parse_rapid(d);
+            }),
+            mbps(text.size(), [&] { write_rapid(other); }),
+            mbps(text.size(), [&] {
+                rapidjson::Document d;
+                parse_rapid(d);
+                write_rapid(d);
+            }));
+        std::cout << "\n";
+    }
+#endif
+#ifdef EEE_BENCH_SIMDJSON
+    {
+        simdjson::dom::parser parser;
+        const simdjson::padded_string padded(text);
+        const double parse_simd = mbps(text.size(), [&] {
+            simdjson::dom::element e;
+            if (parser.parse(padded).get(e)) std::abort();
+        });
+        const simdjson::dom::element root = parser.parse(padded);
+        const double generate_simd = mbps(text.size(), [&] {
+            auto r = simdjson::minify(root);
+        });
+        print_row("", "", "simdjson", parse_simd, generate_simd, 0);
+        std::cout << "\n";
+    }
+#endif
+}
+
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+#ifndef NDEBUG
+    std::cout << "note: assertions are on; configure with "
+                 "-DCMAKE_BUILD_TYPE=Release for meaningful numbers\n";
+#endif
+    std::vector<Document> corpus;
+    corpus.push_back({"twitter", make_twitter()});
+    corpus.push_back({"canada", make_canada()});
+    corpus.push_back({"citm", make_citm()});
+    corpus.push_back({"deep", make_deep()});
+    corpus.push_back({"long strings", make_long_strings()});
+    // one document followed by log output; only the document is measured
+    const std::string log = read_file(EEE_SOURCE_DIR "/error.json");
+    corpus.push_back({"error.json", std::string(eee::lazy(log).raw())});
+    for (int i = 1; i < argc; ++i) {
+        std::string path = argv[i];
+        corpus.push_back({path.substr(path.find_last_of('/') + 1),
+                          read_file(path)});
+    }
+
+    std::cout << std::left << std::setw(14) << "document" << std::right
+              << std::setw(8) << "KiB" << "  " << std::left << std::setw(10)
+              << "parser" << std::right << std::setw(10) << "parse"
+              << std::setw(10) << "generate" << std::setw(11) << "roundtrip"
+              << std::setw(12) << "allocs/doc" << std::setw(10) << "peak KiB"
+              << "\n";
+    for (const auto &doc : corpus) run(doc);
+    std::cout << "MB/s of input text; peak KiB is the heap high-water mark "
+                 "of one parse\n";
+#ifdef EEE_BENCH_RUSAGE
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    std::cout << "peak RSS " << usage.ru_maxrss / 1024 << " MiB\n";
+#endif
+    return 0;
+}
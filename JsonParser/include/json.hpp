@@ -1,57 +1,102 @@
 #pragma once
+#include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <utility>
 #include <vector>
 #include <variant>
 #include <optional>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <iostream>
 #include <ranges>
 
+#if __has_include(<unistd.h>)
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+#include "json_scan.hpp"
+
 namespace eee {
 
-struct Json;
+template<typename Allocator>
+struct BasicJson;
 
-using Int = int;
+using Int = std::int64_t;
+using UInt = std::uint64_t; // integers above INT64_MAX
 using Bool = bool;
 using Float = double;
-using String = std::string;
 using Null = std::nullptr_t;
-using Array = std::vector<Json>;
-using Object = std::map<String, Json>;
 
-using Value = std::variant<Null, Bool, Int, Float, String, Array, Object>;
+namespace details {
 
-template<typename T>
-concept is_value = requires(T val) { Value(val); };
+template<typename Allocator, typename T>
+using rebind_alloc =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<T>;
+
+} // namespace details
+
+// A Json tree whose strings, arrays and objects allocate through
+// `Allocator`. eee::Json uses std::allocator; eee::pmr::Json allocates from
+// a std::pmr::memory_resource.
+template<typename Allocator>
+struct BasicJson {
+    using allocator_type = Allocator;
+    using String = std::basic_string<
+        char, std::char_traits<char>, details::rebind_alloc<Allocator, char>>;
+    using Array =
+        std::vector<BasicJson, details::rebind_alloc<Allocator, BasicJson>>;
+    using Object = std::map<
+        String, BasicJson, std::less<String>,
+        details::rebind_alloc<Allocator, std::pair<const String, BasicJson>>>;
+    using Value =
+        std::variant<Null, Bool, Int, UInt, Float, String, Array, Object>;
 
-struct Json {
     Value value_;
 
-    Json() = default;
-    Json(const Json &other) noexcept : value_(other.value_){};
-    auto operator=(const Json &other) noexcept -> Json & {
+    BasicJson() = default;
+    BasicJson(const BasicJson &other) noexcept : value_(other.value_){};
+    auto operator=(const BasicJson &other) noexcept -> BasicJson & {
         value_ = other.value_;
         return *this;
     };
 
-    Json(Json &&other) noexcept : value_(std::move(other.value_)){};
-    auto operator=(Json &&other) noexcept -> Json & {
+    BasicJson(BasicJson &&other) noexcept : value_(std::move(other.value_)){};
+    auto operator=(BasicJson &&other) noexcept -> BasicJson & {
         other.swap(*this);
         return *this;
     };
 
-    auto swap(Json &other) noexcept -> void { std::swap(other.value_, value_); }
+    // Allocator-extended constructors. Containers that propagate their
+    // allocator (std::pmr ones) use these, so elements copied or moved into
+    // a tree end up in the tree's memory.
+    BasicJson(std::allocator_arg_t, const Allocator &) noexcept {}
+    BasicJson(
+        std::allocator_arg_t, const Allocator &alloc, const BasicJson &other)
+        : value_(rebuild(other.value_, alloc)) {}
+    BasicJson(std::allocator_arg_t, const Allocator &alloc, BasicJson &&other)
+        : value_(rebuild(std::move(other.value_), alloc)) {}
+
+    auto swap(BasicJson &other) noexcept -> void {
+        std::swap(other.value_, value_);
+    }
 
     template<typename T>
-        requires is_value<T>
-    Json(T &&value) : value_(std::forward<T>(value)){};
+        requires std::is_constructible_v<Value, T>
+    BasicJson(T &&value) : value_(std::forward<T>(value)){};
     template<typename T>
-        requires is_value<T>
-    auto operator=(T &&value) -> Json & {
+        requires std::is_constructible_v<Value, T>
+    auto operator=(T &&value) -> BasicJson & {
         value_ = value;
         return *this;
     }
@@ -62,18 +107,18 @@ struct Json {
         throw std::runtime_error("Type is not Object or Array");
     }
 
-    auto operator[](const std::string &key) -> Json & {
+    auto operator[](const String &key) -> BasicJson & {
         if (auto *val = std::get_if<Object>(&value_)) { return (*val)[key]; }
         throw std::runtime_error("Type is not Object");
     }
-    auto operator[](size_t index) -> Json & {
+    auto operator[](size_t index) -> BasicJson & {
         if (auto *val = std::get_if<Array>(&value_)) { return val->at(index); }
         throw std::runtime_error("Type is not Array");
     }
     template<typename T>
     auto insert(T &&value) -> void
-        requires std::
-            is_same_v<std::pair<String, Json>, std::remove_reference_t<T>>
+        requires std::is_same_v<
+            std::pair<String, BasicJson>, std::remove_reference_t<T>>
     {
         if (auto *val = std::get_if<Object>(&value_)) {
             val->insert(std::forward<T>(value));
@@ -89,200 +134,989 @@ struct Json {
         }
         throw std::runtime_error("Type is not Array");
     }
+
+  private:
+    template<typename V>
+    static auto rebuild(V &&value, const Allocator &alloc) -> Value {
+        return std::visit(
+            [&alloc](auto &&arg) -> Value {
+                using T = std::decay_t<decltype(arg)>;
+                if constexpr (
+                    std::is_same_v<String, T> or std::is_same_v<Array, T>
+                    or std::is_same_v<Object, T>)
+                    return T(std::forward<decltype(arg)>(arg), alloc);
+                else
+                    return arg;
+            },
+            std::forward<V>(value));
+    }
 };
 
-class JsonParser {
+using Json = BasicJson<std::allocator<char>>;
+using String = Json::String;
+using Array = Json::Array;
+using Object = Json::Object;
+using Value = Json::Value;
+
+template<typename T>
+concept is_value = requires(T val) { Value(val); };
+
+namespace details {
+
+constexpr auto is_space(char c) -> bool {
+    return c == ' ' or c == '\t' or c == '\n' or c == '\r';
+}
+
+constexpr auto is_digit(char c) -> bool { return c >= '0' and c <= '9'; }
+
+// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+// Returns one past the last character of the number, or nullptr.
+inline auto scan_number(const char *first, const char *last, bool &is_float)
+    -> const char * {
+    is_float = false;
+    const char *p = first;
+    if (p != last and *p == '-') ++p;
+    if (p == last or !is_digit(*p)) return nullptr;
+    if (*p == '0') ++p;
+    else
+        for (; p != last and is_digit(*p); ++p)
+            ;
+    if (p != last and *p == '.') {
+        is_float = true;
+        if (++p == last or !is_digit(*p)) return nullptr;
+        for (; p != last and is_digit(*p); ++p)
+            ;
+    }
+    if (p != last and (*p == 'e' or *p == 'E')) {
+        is_float = true;
+        if (++p != last and (*p == '+' or *p == '-')) ++p;
+        if (p == last or !is_digit(*p)) return nullptr;
+        for (; p != last and is_digit(*p); ++p)
+            ;
+    }
+    return p;
+}
+
+// Whether number text accepted by scan_number that from_chars reports out
+// of range is below 1 in magnitude, so it underflows rather than overflows.
+inline auto is_underflow(const char *first, const char *last) -> bool {
+    const char *p = first + (*first == '-');
+    // decimal exponent of the leading nonzero digit, exponent part aside
+    int64_t lead = -1;
+    for (; p != last and is_digit(*p); ++p)
+        if (lead >= 0 or *p != '0') ++lead;
+    if (lead < 0 and p != last and *p == '.')
+        for (++p; p != last and *p == '0'; ++p) --lead;
+    while (p != last and *p != 'e' and *p != 'E') ++p;
+    int64_t exponent = 0;
+    if (p != last) {
+        const bool negative = *++p == '-';
+        if (*p == '+' or *p == '-') ++p;
+        // saturates far past the exponent range of a double
+        for (; p != last and exponent < 100000; ++p)
+            exponent = exponent * 10 + (*p - '0');
+        if (negative) exponent = -exponent;
+    }
+    return lead + exponent < 0;
+}
+
+// Converts number text accepted by scan_number without copying it. Integers
+// become Int, or UInt when only an unsigned 64-bit value holds them; larger
+// integers and everything with a fraction or exponent become Float, and
+// values too small for a double become a signed zero. Only overflow fails.
+template<typename V = Value>
+inline auto to_number(const char *first, const char *last, bool is_float)
+    -> std::optional<V> {
+    if (!is_float) {
+        const bool negative = *first == '-';
+        const char *p = first + negative;
+        // 19 digits never overflow uint64_t
+        if (last - p <= 19) {
+            uint64_t value = 0;
+            for (; p != last; ++p) value = value * 10 + (*p - '0');
+            if (!negative) {
+                if (value <= uint64_t(INT64_MAX)) return Int(value);
+                return UInt(value);
+            }
+            if (value <= uint64_t(INT64_MAX) + 1) return Int(0 - value);
+        } else if (!negative) {
+            UInt value = 0;
+            if (std::from_chars(p, last, value).ec == std::errc{})
+                return value;
+        }
+    }
+    // libstdc++ implements this with the Eisel-Lemire algorithm
+    Float value = 0;
+    const auto ec = std::from_chars(first, last, value).ec;
+    if (ec == std::errc::result_out_of_range and is_underflow(first, last))
+        return *first == '-' ? -0.0 : 0.0;
+    if (ec != std::errc{}) return std::nullopt;
+    return value;
+}
+
+// Shortest text that reads back as the same double. Integral values keep a
+// trailing ".0" so they read back as Float; non-finite values have no JSON
+// spelling and become null. `first` must have room for 32 characters.
+inline auto format_double(Float value, char *first) -> char * {
+    if (!std::isfinite(value)) {
+        std::memcpy(first, "null", 4);
+        return first + 4;
+    }
+    char *last = std::to_chars(first, first + 32, value).ptr;
+    if (std::find_if(first, last, [](char c) { return c == '.' or c == 'e'; })
+        == last) {
+        *last++ = '.';
+        *last++ = '0';
+    }
+    return last;
+}
+
+template<typename Str>
+inline auto append_utf8(Str &out, uint32_t cp) -> void {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+inline auto parse_hex4(const char *p) -> std::optional<uint32_t> {
+    uint32_t cp = 0;
+    for (int i = 0; i < 4; ++i) {
+        const char c = p[i];
+        cp <<= 4;
+        if (is_digit(c)) cp |= c - '0';
+        else if (c >= 'a' and c <= 'f')
+            cp |= c - 'a' + 10;
+        else if (c >= 'A' and c <= 'F')
+            cp |= c - 'A' + 10;
+        else
+            return std::nullopt;
+    }
+    return cp;
+}
+
+// Decodes the body of a string literal (without quotes) and appends it to
+// `*out`; with a null `out` it only checks. Runs without escapes are found
+// 16 bytes at a time and copied whole. Returns nullptr if the body is
+// valid, otherwise the first offending byte: a control character or the
+// backslash of a bad escape sequence, lone surrogates included.
+template<typename Str>
+auto decode_string(const char *p, const char *last, Str *out)
+    -> const char * {
+    for (;;) {
+        const char *q = find_escape(p, last);
+        if (out != nullptr) out->append(p, q - p);
+        if (q == last) return nullptr;
+        if (*q != '\\' or last - q < 2) return q;
+        char c;
+        switch (q[1]) {
+            case '"': c = '"'; break;
+            case '\\': c = '\\'; break;
+            case '/': c = '/'; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u': c = 'u'; break;
+            default: return q;
+        }
+        if (c != 'u') {
+            if (out != nullptr) out->push_back(c);
+            p = q + 2;
+            continue;
+        }
+        auto cp = last - q >= 6 ? parse_hex4(q + 2) : std::nullopt;
+        if (!cp or (*cp >= 0xDC00 and *cp <= 0xDFFF)) return q;
+        p = q + 6;
+        if (*cp >= 0xD800 and *cp <= 0xDBFF) {
+            // a high surrogate needs a low one right after it
+            auto low = last - p >= 6 and p[0] == '\\' and p[1] == 'u'
+                           ? parse_hex4(p + 2)
+                           : std::nullopt;
+            if (!low or *low < 0xDC00 or *low > 0xDFFF) return q;
+            *cp = 0x10000 + ((*cp - 0xD800) << 10) + (*low - 0xDC00);
+            p += 6;
+        }
+        if (out != nullptr) append_utf8(*out, *cp);
+    }
+}
+
+inline auto check_string(const char *p, const char *last) -> const char * {
+    return decode_string<std::string>(p, last, nullptr);
+}
+
+// Decodes the body of a string literal (without quotes) and appends it to
+// `out`. Returns false on a malformed escape sequence.
+inline auto unescape(std::string_view raw, std::string &out) -> bool {
+    return decode_string(raw.data(), raw.data() + raw.size(), &out)
+           == nullptr;
+}
+
+} // namespace details
+
+struct ParseOptions {
+    // arrays and objects open at once; deeper input fails to parse. Parsing
+    // and generating take constant stack space at any depth, but destroying
+    // a Json recurses once per level.
+    size_t max_depth = 1024;
+    // longer input fails to parse; the structural index caps it at 4 GiB
+    size_t max_size = SIZE_MAX;
+};
+
+// Where and why parsing or validation failed.
+struct ParseError {
+    size_t offset = 0; // in bytes from the start of the input
+    size_t line = 0;   // 1-based
+    size_t column = 0; // 1-based, in bytes
+    const char *message = "";
+};
+
+namespace details {
+
+inline auto locate_error(
+    std::string_view input, size_t offset, const char *message)
+    -> ParseError {
+    const auto before = input.substr(0, offset);
+    const size_t newline = before.rfind('\n');
+    return {
+        offset, size_t(std::count(before.begin(), before.end(), '\n')) + 1,
+        newline == before.npos ? offset + 1 : offset - newline, message};
+}
+
+} // namespace details
+
+template<typename J>
+class BasicJsonParser {
   private:
+    using String = typename J::String;
+    using Array = typename J::Array;
+    using Object = typename J::Object;
+    using Value = typename J::Value;
+
     std::string_view json_str_;
-    size_t pos_;
+    std::vector<uint32_t> index_; // structural offsets, see json_scan.hpp
+    size_t pos_;                  // current entry of index_
+    typename J::allocator_type alloc_;
+    std::vector<char> closers_;   // open containers while validating
+    ParseError error_;
+    ParseOptions options_;
 
-    auto parse_whitespace() -> void {
-        for (; pos_ < json_str_.size() and std::isspace(json_str_[pos_]);
-             ++pos_)
-            ;
+    // an open container, and the key of its next member if it is an object
+    struct Frame {
+        Value value;
+        String key;
+    };
+    std::vector<Frame> frames_;
+
+    // the character at the current structural, '\0' at the end of input
+    auto peek() const -> char {
+        const size_t offset = index_[pos_];
+        return offset < json_str_.size() ? json_str_[offset] : '\0';
+    }
+
+    // a scalar must run up to whitespace or the next structural
+    auto scalar_ends_at(size_t end) const -> bool {
+        return end == json_str_.size() or end == index_[pos_ + 1]
+               or details::is_space(json_str_[end]);
+    }
+
+    auto parse_literal(std::string_view literal, Value value)
+        -> std::optional<Value> {
+        const size_t begin = index_[pos_];
+        if (json_str_.substr(begin, literal.size()) != literal
+            or !scalar_ends_at(begin + literal.size()))
+            return std::nullopt;
+        ++pos_;
+        return value;
     }
 
     auto parse_null() -> std::optional<Value> {
-        parse_whitespace();
-        if (json_str_.substr(pos_, 4) == "null") return pos_ += 4, Null{};
-        return std::nullopt;
+        return parse_literal("null", Null{});
     }
 
     auto parse_bool() -> std::optional<Value> {
-        parse_whitespace();
-        if (json_str_.substr(pos_, 4) == "true") return pos_ += 4, Bool{true};
-        if (json_str_.substr(pos_, 5) == "false") return pos_ += 5, Bool{false};
-        return std::nullopt;
+        if (peek() == 't') return parse_literal("true", Bool{true});
+        return parse_literal("false", Bool{false});
     }
 
     auto parse_number() -> std::optional<Value> {
-        parse_whitespace();
-        size_t tmp_pos = pos_;
+        const char *first = json_str_.data() + index_[pos_];
         bool is_float = false;
-        auto is_signs = [this] {
-            return json_str_[pos_] == 'e' or json_str_[pos_] == 'E'
-                   or json_str_[pos_] == '.';
-        };
-        for (; pos_ < json_str_.size()
-               and (std::isdigit(json_str_[pos_]) or is_signs());
-             ++pos_)
-            if (is_signs()) is_float |= true;
-        const std::string number{
-            json_str_.begin() + tmp_pos, json_str_.begin() + pos_};
-        if (is_float) {
-            try {
-                Float ret = std::stod(number);
-                return ret;
-            } catch (...) { return std::nullopt; }
-        }
-        try {
-            Int ret = std::stoi(number);
-            return ret;
-        } catch (...) { return std::nullopt; }
+        const char *last = details::scan_number(
+            first, json_str_.data() + json_str_.size(), is_float);
+        if (last == nullptr or !scalar_ends_at(last - json_str_.data()))
+            return std::nullopt;
+        ++pos_;
+        return details::to_number<Value>(first, last, is_float);
     }
 
+    // stage 1 records both quotes, so the next entry is the closing one
     auto parse_string() -> std::optional<String> {
-        ++pos_; // "
-        if (size_t endpos = json_str_.find('"', pos_);
-            endpos != json_str_.npos) {
-            std::swap(++endpos, pos_);
-            return std::string(
-                json_str_.begin() + endpos, json_str_.begin() + pos_ - 1);
-        }
-        return std::nullopt;
+        const size_t begin = index_[pos_] + 1;
+        const size_t end = index_[++pos_];
+        ++pos_;
+        const char *first = json_str_.data() + begin;
+        const char *last = json_str_.data() + end;
+        // most strings have nothing to decode and are copied in one go
+        const char *q = details::find_escape(first, last);
+        if (q == last) return String(first, last - first, alloc_);
+        String str(alloc_);
+        str.reserve(last - first);
+        str.append(first, q - first);
+        if (details::decode_string(q, last, &str) != nullptr)
+            return std::nullopt;
+        return str;
     }
 
-    auto parse_array() -> std::optional<Value> {
-        ++pos_; // [
-        for (Array vec{}; pos_ < json_str_.size();) {
-            if (auto ret = parse_value(); ret.has_value())
-                vec.push_back(std::move(ret.value()));
-            else
-                break;
-            parse_whitespace();
-            if (json_str_.at(pos_) == ',') ++pos_;
-            else if (json_str_.at(pos_) == ']')
-                return ++pos_, vec;
-            else
-                break;
+    // parses `"key":` into `key`
+    auto parse_key(String &key) -> bool {
+        if (peek() != '"') return false;
+        auto ret = parse_string();
+        if (!ret.has_value() or peek() != ':') return false;
+        ++pos_;
+        key = std::move(ret.value());
+        return true;
+    }
+
+    // Open containers live on frames_ instead of the call stack, so nesting
+    // costs heap space, bounded by max_depth, rather than stack space.
+    auto parse_value() -> std::optional<Value> {
+        frames_.clear();
+        for (;;) {
+            std::optional<Value> value;
+            switch (peek()) {
+                case 'n':
+                    value = parse_null();
+                    break;
+                case 't':
+                case 'f':
+                    value = parse_bool();
+                    break;
+                case '"':
+                    if (auto str = parse_string(); str.has_value())
+                        value.emplace(std::move(str.value()));
+                    break;
+                case '[':
+                case '{': {
+                    if (frames_.size() >= options_.max_depth)
+                        return std::nullopt;
+                    const bool is_object = peek() == '{';
+                    auto empty = is_object ? Value{Object(alloc_)}
+                                           : Value{Array(alloc_)};
+                    ++pos_;
+                    if (peek() == (is_object ? '}' : ']')) {
+                        ++pos_;
+                        value = std::move(empty);
+                        break;
+                    }
+                    auto &frame =
+                        frames_.emplace_back(std::move(empty), String(alloc_));
+                    if (is_object and !parse_key(frame.key))
+                        return std::nullopt;
+                    continue;
+                }
+                default:
+                    value = parse_number();
+            }
+            if (!value.has_value()) return std::nullopt;
+            // add the value to its container and close what it completes
+            for (;;) {
+                if (frames_.empty()) return value;
+                Frame &top = frames_.back();
+                auto *array = std::get_if<Array>(&top.value);
+                if (array != nullptr) array->push_back(std::move(*value));
+                else
+                    std::get<Object>(top.value)
+                        .insert_or_assign(
+                            std::move(top.key), std::move(*value));
+                if (peek() == ',') {
+                    ++pos_;
+                    if (array == nullptr and !parse_key(top.key))
+                        return std::nullopt;
+                    break;
+                }
+                if (peek() != (array != nullptr ? ']' : '}'))
+                    return std::nullopt;
+                ++pos_;
+                value = std::move(top.value);
+                frames_.pop_back();
+            }
         }
-        return std::nullopt;
     }
 
-    auto parse_object() -> std::optional<Value> {
-        ++pos_; // {
-        auto skip_signs = [this](char sign) {
-            parse_whitespace();
-            if (json_str_.at(pos_) == sign) return true;
-            return false;
-        };
-        for (Object map{}; pos_ < json_str_.size();) {
-            auto key = parse_string(); // key
-            if (!key.has_value()) break;
+    auto fail(size_t offset, const char *message) -> bool {
+        error_ = details::locate_error(json_str_, offset, message);
+        return false;
+    }
 
-            if (skip_signs(':')) ++pos_;
-            else
-                break;
+    auto index() -> bool {
+        if (json_str_.size() > options_.max_size)
+            return fail(options_.max_size, "Input is too large");
+        if (details::build_structural_index(json_str_, index_)) {
+            const char *data = json_str_.data();
+            const char *bad =
+                details::find_invalid_utf8(data, data + json_str_.size());
+            if (bad == nullptr) return true;
+            return fail(bad - data, "Invalid UTF-8");
+        }
+        if (json_str_.size() >= std::numeric_limits<uint32_t>::max())
+            return fail(0, "Input is too large");
+        // the opening quote is the last entry before the sentinel
+        return fail(index_[index_.size() - 2], "Unterminated string");
+    }
 
-            auto value = parse_value(); // value
-                                        //
-            if (!value.has_value()) break;
+    auto check_literal(std::string_view literal) -> bool {
+        const size_t begin = index_[pos_];
+        if (json_str_.substr(begin, literal.size()) != literal
+            or !scalar_ends_at(begin + literal.size()))
+            return fail(begin, "Invalid literal");
+        ++pos_;
+        return true;
+    }
 
-            map[key.value()] = value.value();
+    auto check_number() -> bool {
+        const char *first = json_str_.data() + index_[pos_];
+        bool is_float = false;
+        const char *last = details::scan_number(
+            first, json_str_.data() + json_str_.size(), is_float);
+        if (last == nullptr or !scalar_ends_at(last - json_str_.data()))
+            return fail(index_[pos_], "Invalid number");
+        // short integers always fit; anything else must convert as parse does
+        if ((is_float or last - first > 19)
+            and !details::to_number<Value>(first, last, is_float))
+            return fail(index_[pos_], "Number out of range");
+        ++pos_;
+        return true;
+    }
 
-            if (skip_signs(',')) ++pos_;
-            else if (skip_signs('}'))
-                return ++pos_, map;
-        }
-        return std::nullopt;
+    auto check_string() -> bool {
+        const char *first = json_str_.data() + index_[pos_] + 1;
+        const char *bad = details::check_string(
+            first, json_str_.data() + index_[pos_ + 1]);
+        if (bad != nullptr)
+            return fail(
+                bad - json_str_.data(),
+                *bad == '\\' ? "Invalid escape sequence"
+                              : "Control character in string");
+        pos_ += 2;
+        return true;
     }
 
-    auto parse_value() -> std::optional<Value> {
-        parse_whitespace();
-        switch (json_str_[pos_]) {
-            case 'n':
-                return parse_null();
-            case 't':
-                return parse_bool();
-            case 'f':
-                return parse_bool();
-            case '"':
-                return parse_string();
-            case '[':
-                return parse_array();
-            case '{':
-                return parse_object();
-            default:
-                return parse_number();
+    auto check_key() -> bool {
+        if (peek() != '"') return fail(index_[pos_], "Expected a string key");
+        if (!check_string()) return false;
+        if (peek() != ':') return fail(index_[pos_], "Expected ':'");
+        ++pos_;
+        return true;
+    }
+
+    // Walks the index with the grammar of parse_value, building nothing.
+    // Containers are tracked on closers_ rather than by recursion.
+    auto check_index() -> bool {
+        pos_ = 0;
+        closers_.clear();
+        for (;;) {
+            // a value starts at the current entry
+            const size_t at = index_[pos_];
+            bool ok = true;
+            switch (peek()) {
+                case '{':
+                case '[': {
+                    if (closers_.size() >= options_.max_depth)
+                        return fail(at, "Nesting too deep");
+                    const char closer = peek() == '{' ? '}' : ']';
+                    ++pos_;
+                    if (peek() == closer) {
+                        ++pos_;
+                        break;
+                    }
+                    closers_.push_back(closer);
+                    if (closer == '}' and !check_key()) return false;
+                    continue;
+                }
+                case '"':
+                    ok = check_string();
+                    break;
+                case 't':
+                    ok = check_literal("true");
+                    break;
+                case 'f':
+                    ok = check_literal("false");
+                    break;
+                case 'n':
+                    ok = check_literal("null");
+                    break;
+                case ']':
+                case '}':
+                case ',':
+                case ':':
+                    return fail(at, "Expected a value");
+                default:
+                    if (at == json_str_.size())
+                        return fail(at, "Unexpected end of input");
+                    ok = check_number();
+            }
+            if (!ok) return false;
+            // close every container this value ends
+            while (!closers_.empty() and peek() == closers_.back()) {
+                ++pos_;
+                closers_.pop_back();
+            }
+            if (closers_.empty()) {
+                if (pos_ + 1 == index_.size()) return true;
+                return fail(index_[pos_], "Trailing content");
+            }
+            if (peek() != ',') {
+                if (index_[pos_] == json_str_.size())
+                    return fail(index_[pos_], "Unexpected end of input");
+                return fail(
+                    index_[pos_], closers_.back() == ']'
+                                      ? "Expected ',' or ']'"
+                                      : "Expected ',' or '}'");
+            }
+            ++pos_;
+            if (closers_.back() == '}' and !check_key()) return false;
         }
     }
 
   public:
-    JsonParser(const JsonParser &other) = delete;
-    auto operator=(const JsonParser &other) -> JsonParser & = delete;
-    JsonParser(JsonParser &&other) noexcept = delete;
-    auto operator=(JsonParser &&other) noexcept -> JsonParser & = delete;
-
-    JsonParser() : json_str_(), pos_(0) {}
-    JsonParser(const std::string_view &json_str)
-        : json_str_(json_str), pos_(0) {}
-
-    auto parse() -> std::optional<Json> {
-        if (auto ret = parse_value(); ret.has_value()) {
-            return Json(ret.value());
-        }
+    BasicJsonParser(const BasicJsonParser &other) = delete;
+    auto operator=(const BasicJsonParser &other) -> BasicJsonParser & = delete;
+    BasicJsonParser(BasicJsonParser &&other) noexcept = delete;
+    auto operator=(BasicJsonParser &&other) noexcept
+        -> BasicJsonParser & = delete;
+
+    BasicJsonParser() : json_str_(), pos_(0) {}
+    explicit BasicJsonParser(
+        const ParseOptions &options,
+        const typename J::allocator_type &alloc = {})
+        : json_str_(), pos_(0), alloc_(alloc), options_(options) {}
+    BasicJsonParser(
+        const std::string_view &json_str,
+        const typename J::allocator_type &alloc = {})
+        : json_str_(json_str), pos_(0), alloc_(alloc) {}
+
+    // parses `json_str`, reusing the structural index of earlier calls
+    auto parse(std::string_view json_str) -> std::optional<J> {
+        json_str_ = json_str;
+        return parse();
+    }
+
+    auto parse() -> std::optional<J> {
+        pos_ = 0;
+        if (!index()) return std::nullopt;
+        // the whole input must be one value: only the sentinel may remain
+        auto ret = parse_value();
+        frames_.clear();
+        if (ret.has_value() and pos_ + 1 == index_.size())
+            return J(std::move(ret.value()));
+        // walk the index again to find where it went wrong; if the walk
+        // passes, report where parse_value stopped rather than no error
+        const size_t stopped = index_[pos_];
+        if (check_index()) fail(stopped, "Invalid value");
         return std::nullopt;
     }
+
+    // Checks that `json_str` is one valid value without building it. Costs
+    // the structural index and one pass over it.
+    auto validate(std::string_view json_str) -> bool {
+        json_str_ = json_str;
+        return index() and check_index();
+    }
+
+    // why the last parse or validate failed
+    auto error() const -> const ParseError & { return error_; }
 };
 
-auto parse(const std::string_view &json) -> std::optional<Json> {
+using JsonParser = BasicJsonParser<Json>;
+
+inline auto parse(const std::string_view &json) -> std::optional<Json> {
     JsonParser tmp{json};
     return tmp.parse();
 }
 
-class JsonGenerator {
+// As parse, setting `error` on failure.
+inline auto parse(const std::string_view &json, ParseError &error)
+    -> std::optional<Json> {
+    JsonParser tmp{json};
+    auto ret = tmp.parse();
+    if (!ret) error = tmp.error();
+    return ret;
+}
+
+inline auto parse(
+    const std::string_view &json, const ParseOptions &options,
+    ParseError *error = nullptr) -> std::optional<Json> {
+    JsonParser tmp{options};
+    auto ret = tmp.parse(json);
+    if (!ret and error != nullptr) *error = tmp.error();
+    return ret;
+}
+
+// Checks `json` without building a tree; sets `*error` on failure.
+inline auto validate(
+    std::string_view json, ParseError *error = nullptr,
+    const ParseOptions &options = {}) -> bool {
+    JsonParser tmp{options};
+    if (tmp.validate(json)) return true;
+    if (error != nullptr) *error = tmp.error();
+    return false;
+}
+
+namespace pmr {
+
+using Json = BasicJson<std::pmr::polymorphic_allocator<char>>;
+using String = Json::String;
+using Array = Json::Array;
+using Object = Json::Object;
+
+} // namespace pmr
+
+// Allocates every string, array and object of the tree from `resource`.
+// With a std::pmr::monotonic_buffer_resource, destroying the tree frees
+// nothing, and the resource releases everything at once.
+inline auto parse(
+    const std::string_view &json, std::pmr::memory_resource *resource)
+    -> std::optional<pmr::Json> {
+    BasicJsonParser<pmr::Json> tmp{json, resource};
+    return tmp.parse();
+}
+
+namespace pmr {
+
+// A tree and the arena that holds it. Destroying a Document drops the arena
+// in one step without visiting the nodes, so every allocation under root()
+// must come from resource(). Values built with allocator() or copied in
+// through the pmr containers already do.
+class Document {
   public:
-    auto generate(const Json &json) noexcept -> std::string {
-        return std::visit(
-            [this](auto &&arg) -> std::string {
+    explicit Document(
+        size_t initial_size = 0,
+        std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+        : arena_(
+            initial_size == 0
+                ? std::make_unique<std::pmr::monotonic_buffer_resource>(
+                    upstream)
+                : std::make_unique<std::pmr::monotonic_buffer_resource>(
+                    initial_size, upstream)),
+          root_(allocator().new_object<Json>()) {}
+
+    Document(const Document &other) = delete;
+    auto operator=(const Document &other) -> Document & = delete;
+    Document(Document &&other) noexcept = default;
+    auto operator=(Document &&other) noexcept -> Document & = default;
+
+    auto root() -> Json & { return *root_; }
+    auto root() const -> const Json & { return *root_; }
+    auto resource() const -> std::pmr::memory_resource * {
+        return arena_.get();
+    }
+    auto allocator() const -> Json::allocator_type { return arena_.get(); }
+
+  private:
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena_;
+    Json *root_; // lives in arena_ and is never destroyed
+};
+
+// The arena starts at the size of the input, which covers most documents
+// in one or two upstream allocations.
+inline auto parse(
+    const std::string_view &json,
+    std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+    -> std::optional<Document> {
+    Document doc{std::max<size_t>(json.size(), 1024), upstream};
+    auto ret = eee::parse(json, doc.resource());
+    if (!ret) return std::nullopt;
+    doc.root() = std::move(*ret);
+    return doc;
+}
+
+} // namespace pmr
+
+struct GenerateOptions {
+    bool pretty = false; // one member per line
+    int indent = 4;      // spaces per level when pretty
+};
+
+// Sinks collect the generated text. A sink provides put(char) and
+// append(const char *, size_t).
+
+// Appends to a caller-owned string, so repeated generation into the same
+// string reuses its capacity.
+class StringSink {
+  public:
+    StringSink(std::string &out) : out_(out) {}
+    auto put(char c) -> void { out_ += c; }
+    auto append(const char *data, size_t size) -> void {
+        out_.append(data, size);
+    }
+
+  private:
+    std::string &out_;
+};
+
+// Buffers text and hands it to `flush_` in chunks of at most N bytes.
+template<size_t N, typename Flush>
+class ChunkedSink {
+  public:
+    ChunkedSink(Flush flush) : flush_(flush) {}
+    ChunkedSink(const ChunkedSink &other) = delete;
+    auto operator=(const ChunkedSink &other) -> ChunkedSink & = delete;
+    ~ChunkedSink() { flush(); }
+
+    auto put(char c) -> void {
+        if (size_ == N) flush();
+        buf_[size_++] = c;
+    }
+    auto append(const char *data, size_t size) -> void {
+        if (size_ + size > N) {
+            flush();
+            if (size > N) return flush_(data, size);
+        }
+        std::memcpy(buf_ + size_, data, size);
+        size_ += size;
+    }
+    auto flush() -> void {
+        if (size_ != 0) flush_(buf_, size_);
+        size_ = 0;
+    }
+
+  private:
+    Flush flush_;
+    size_t size_ = 0;
+    char buf_[N];
+};
+
+inline auto stream_sink(std::ostream &out) {
+    return ChunkedSink<16384, std::function<void(const char *, size_t)>>(
+        [&out](const char *data, size_t size) {
+            out.write(data, static_cast<std::streamsize>(size));
+        });
+}
+
+#if __has_include(<unistd.h>)
+inline auto fd_sink(int fd) {
+    return ChunkedSink<65536, std::function<void(const char *, size_t)>>(
+        [fd](const char *data, size_t size) {
+            while (size != 0) {
+                const ssize_t n = ::write(fd, data, size);
+                if (n < 0 and errno == EINTR) continue;
+                if (n <= 0) return;
+                data += n;
+                size -= n;
+            }
+        });
+}
+#endif
+
+template<typename Sink>
+class JsonWriter {
+  public:
+    JsonWriter(Sink &sink, const GenerateOptions &options = {})
+        : sink_(sink), options_(options) {}
+
+    // Open containers are kept on an explicit stack, so any depth of
+    // nesting writes in constant stack space.
+    template<typename Allocator>
+    auto write(const BasicJson<Allocator> &json) -> void {
+        using J = BasicJson<Allocator>;
+        using Array = typename J::Array;
+        using Object = typename J::Object;
+        // an open container and its next element or member
+        struct Frame {
+            const Array *array;
+            const Object *object;
+            typename Array::const_iterator element;
+            typename Object::const_iterator member;
+        };
+        std::vector<Frame> stack;
+        const J *next = &json;
+        for (;;) {
+            if (next != nullptr) {
+                if (auto *array = std::get_if<Array>(&next->value_);
+                    array != nullptr and !array->empty()) {
+                    sink_.put('[');
+                    stack.push_back({array, nullptr, array->begin(), {}});
+                } else if (auto *object = std::get_if<Object>(&next->value_);
+                           object != nullptr and !object->empty()) {
+                    sink_.put('{');
+                    stack.push_back({nullptr, object, {}, object->begin()});
+                } else {
+                    write_scalar(*next);
+                }
+                next = nullptr;
+            }
+            if (stack.empty()) return;
+            Frame &top = stack.back();
+            const size_t depth = stack.size();
+            if (top.array != nullptr) {
+                if (top.element != top.array->end()) {
+                    if (top.element != top.array->begin()) sink_.put(',');
+                    newline(depth);
+                    next = &*top.element++;
+                    continue;
+                }
+                newline(depth - 1);
+                sink_.put(']');
+            } else {
+                if (top.member != top.object->end()) {
+                    if (top.member != top.object->begin()) sink_.put(',');
+                    newline(depth);
+                    const auto &[key, value] = *top.member++;
+                    write_string(key);
+                    sink_.put(':');
+                    if (options_.pretty) sink_.put(' ');
+                    next = &value;
+                    continue;
+                }
+                newline(depth - 1);
+                sink_.put('}');
+            }
+            stack.pop_back();
+        }
+    }
+
+    auto write_string(std::string_view str) -> void {
+        static constexpr char hex[] = "0123456789abcdef";
+        sink_.put('"');
+        const char *p = str.data(), *last = str.data() + str.size();
+        while (p != last) {
+            // clean runs are copied in bulk
+            const char *q = details::find_escape(p, last);
+            sink_.append(p, q - p);
+            if (q == last) break;
+            const uint8_t c = static_cast<uint8_t>(*q);
+            if (const char e = details::escape_table.table[c]; e != 'u') {
+                const char buf[2] = {'\\', e};
+                sink_.append(buf, 2);
+            } else {
+                const char buf[6] = {
+                    '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                sink_.append(buf, 6);
+            }
+            p = q + 1;
+        }
+        sink_.put('"');
+    }
+
+  private:
+    // everything but non-empty arrays and objects
+    template<typename Allocator>
+    auto write_scalar(const BasicJson<Allocator> &json) -> void {
+        using J = BasicJson<Allocator>;
+        std::visit(
+            [this](const auto &arg) {
                 using T = std::decay_t<decltype(arg)>;
                 if constexpr (std::is_same_v<Null, T>) {
-                    return "null";
+                    sink_.append("null", 4);
                 } else if constexpr (std::is_same_v<Bool, T>) {
-                    return arg ? "true" : "false";
+                    arg ? sink_.append("true", 4) : sink_.append("false", 5);
                 } else if constexpr (
-                    std::is_same_v<Int, T> or std::is_same_v<Float, T>) {
-                    return std::to_string(arg);
-                } else if constexpr (std::is_same_v<String, T>) {
-                    return "\"" + arg + "\"";
-                } else if constexpr (std::string ret{'['};
-                                     std::is_same_v<Array, T>) {
-                    for (auto it = arg.begin(); it != arg.end(); ++it) {
-                        if (it != arg.begin()) ret += ',';
-                        ret += generate(*it);
-                    }
-                    return ret + ']';
-                } else if constexpr (std::string ret{'{'};
-                                     std::is_same_v<Object, T>) {
-                    for (auto it = arg.begin(); it != arg.end(); ++it) {
-                        if (it != arg.begin()) ret += ',';
-                        auto [key, value] = *it;
-                        ret += "\"" + key + "\":" + generate(value);
-                    }
-                    return ret + '}';
+                    std::is_same_v<Int, T> or std::is_same_v<UInt, T>) {
+                    char buf[24];
+                    sink_.append(
+                        buf, std::to_chars(buf, buf + sizeof(buf), arg).ptr
+                                 - buf);
+                } else if constexpr (std::is_same_v<Float, T>) {
+                    char buf[32];
+                    sink_.append(buf, details::format_double(arg, buf) - buf);
+                } else if constexpr (std::is_same_v<typename J::String, T>) {
+                    write_string(arg);
+                } else if constexpr (std::is_same_v<typename J::Array, T>) {
+                    sink_.append("[]", 2);
+                } else if constexpr (std::is_same_v<typename J::Object, T>) {
+                    sink_.append("{}", 2);
                 }
             },
             json.value_);
     }
+
+    auto newline(size_t depth) -> void {
+        if (!options_.pretty) return;
+        sink_.put('\n');
+        for (size_t i = depth * options_.indent; i > 0;) {
+            static constexpr char spaces[] = "                ";
+            const size_t n = std::min(i, sizeof(spaces) - 1);
+            sink_.append(spaces, n);
+            i -= n;
+        }
+    }
+
+    Sink &sink_;
+    GenerateOptions options_;
+};
+
+class JsonGenerator {
+  public:
+    JsonGenerator() = default;
+    JsonGenerator(const GenerateOptions &options) : options_(options) {}
+
+    template<typename Allocator>
+    auto generate(const BasicJson<Allocator> &json) noexcept -> std::string {
+        std::string ret;
+        generate(json, ret);
+        return ret;
+    }
+
+    // appends to `out`
+    template<typename Allocator>
+    auto generate(const BasicJson<Allocator> &json, std::string &out) noexcept
+        -> void {
+        StringSink sink{out};
+        JsonWriter{sink, options_}.write(json);
+    }
+
+    template<typename Allocator>
+    auto generate(const BasicJson<Allocator> &json, std::ostream &out)
+        -> void {
+        auto sink = stream_sink(out);
+        JsonWriter{sink, options_}.write(json);
+    }
+
+  private:
+    GenerateOptions options_;
 };
 
-auto generate(const Json &json) noexcept -> std::string {
-    JsonGenerator tmp;
+template<typename Allocator>
+inline auto generate(
+    const BasicJson<Allocator> &json, const GenerateOptions &options = {})
+    noexcept -> std::string {
+    JsonGenerator tmp{options};
     return tmp.generate(json);
 }
 
-auto operator<<(std::ostream &out, const Json &json) -> std::ostream & {
-    out << generate(json);
+template<typename Allocator>
+inline auto generate(
+    const BasicJson<Allocator> &json, std::string &out,
+    const GenerateOptions &options = {}) noexcept -> void {
+    JsonGenerator tmp{options};
+    tmp.generate(json, out);
+}
+
+template<typename Allocator>
+inline auto generate(
+    const BasicJson<Allocator> &json, std::ostream &out,
+    const GenerateOptions &options = {}) -> void {
+    JsonGenerator tmp{options};
+    tmp.generate(json, out);
+}
+
+template<typename Allocator>
+inline auto operator<<(std::ostream &out, const BasicJson<Allocator> &json)
+    -> std::ostream & {
+    generate(json, out);
     return out;
 }
 
@@ -0,0 +1,481 @@
+#pragma once
+#include "json.hpp"
+#include "json_lazy.hpp"
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+
+// Binary encoding of Json values as CBOR (RFC 8949).
+//
+// to_cbor writes definite lengths only: integers in their shortest form,
+// Float as a 4-byte float when that is exact and as a double otherwise.
+// from_cbor accepts the data items Json can hold: integers, floats of any
+// width, text strings, arrays, maps with text keys, booleans and null. Byte
+// strings, tags, indefinite lengths and other simple values are rejected.
+//
+// A CborValue reads a buffer in place, like LazyValue does for text: strings
+// are returned as views into the buffer and containers know their size up
+// front, so nothing is decoded that is not asked for.
+
+namespace eee {
+
+namespace details {
+
+enum CborMajor : uint8_t {
+    kCborUInt = 0,
+    kCborNegInt = 1,
+    kCborBytes = 2,
+    kCborText = 3,
+    kCborArray = 4,
+    kCborMap = 5,
+    kCborTag = 6,
+    kCborSimple = 7,
+};
+
+inline constexpr uint8_t kCborFalse = 0xf4;
+inline constexpr uint8_t kCborTrue = 0xf5;
+inline constexpr uint8_t kCborNull = 0xf6;
+inline constexpr uint8_t kCborHalf = 25; // additional info of the floats
+inline constexpr uint8_t kCborDouble = 27;
+
+inline auto cbor_put_head(std::string &out, uint8_t major, uint64_t arg)
+    -> void {
+    char buf[9];
+    if (arg < 24) {
+        out += static_cast<char>(major << 5 | arg);
+        return;
+    }
+    // additional info 24..27: the argument follows in 1, 2, 4 or 8 bytes
+    const int info = arg <= 0xff ? 24 : arg <= 0xffff ? 25
+                                    : arg <= 0xffffffff ? 26
+                                                        : 27;
+    const int width = 1 << (info - 24);
+    buf[0] = static_cast<char>(major << 5 | info);
+    for (int i = width; i > 0; --i, arg >>= 8)
+        buf[i] = static_cast<char>(arg & 0xff);
+    out.append(buf, width + 1);
+}
+
+struct CborHead {
+    uint8_t major;
+    uint8_t info; // the low 5 bits of the initial byte
+    uint64_t arg;
+};
+
+// Reads the head at `p` and advances past it. Indefinite lengths and
+// reserved values fail.
+inline auto cbor_read_head(const char *&p, const char *last, CborHead &head)
+    -> bool {
+    if (p == last) return false;
+    const auto initial = static_cast<uint8_t>(*p++);
+    head.major = initial >> 5;
+    head.info = initial & 31;
+    if (head.info < 24) {
+        head.arg = head.info;
+        return true;
+    }
+    if (head.info > 27) return false;
+    const size_t width = size_t(1) << (head.info - 24);
+    if (size_t(last - p) < width) return false;
+    head.arg = 0;
+    for (size_t i = 0; i < width; ++i)
+        head.arg = head.arg << 8 | static_cast<uint8_t>(p[i]);
+    p += width;
+    return true;
+}
+
+inline auto cbor_half_to_double(uint16_t half) -> double {
+    const int exponent = half >> 10 & 0x1f;
+    const int mantissa = half & 0x3ff;
+    double value;
+    if (exponent == 0) value = std::ldexp(mantissa, -24);
+    else if (exponent != 31)
+        value = std::ldexp(mantissa + 1024, exponent - 25);
+    else
+        value = mantissa == 0 ? INFINITY : NAN;
+    return half & 0x8000 ? -value : value;
+}
+
+// the value of a float head
+inline auto cbor_float(const CborHead &head) -> double {
+    if (head.info == kCborHalf)
+        return cbor_half_to_double(static_cast<uint16_t>(head.arg));
+    if (head.info == kCborDouble) return std::bit_cast<double>(head.arg);
+    return std::bit_cast<float>(static_cast<uint32_t>(head.arg));
+}
+
+inline auto cbor_is_float(const CborHead &head) -> bool {
+    return head.major == kCborSimple and head.info >= kCborHalf
+           and head.info <= kCborDouble;
+}
+
+// Returns one past the data item at `p`, or nullptr if it is malformed.
+// Nested items are counted instead of recursed into.
+inline auto skip_cbor(const char *p, const char *last) -> const char * {
+    for (uint64_t pending = 1; pending != 0; --pending) {
+        CborHead head;
+        if (!cbor_read_head(p, last, head)) return nullptr;
+        // every pending item takes at least one byte
+        const auto left = static_cast<uint64_t>(last - p);
+        switch (head.major) {
+            case kCborBytes:
+            case kCborText:
+                if (head.arg > left) return nullptr;
+                p += head.arg;
+                break;
+            case kCborArray:
+                if (head.arg > left) return nullptr;
+                pending += head.arg;
+                break;
+            case kCborMap:
+                if (head.arg > left / 2) return nullptr;
+                pending += head.arg * 2;
+                break;
+            case kCborTag:
+                ++pending;
+                break;
+            default:
+                break;
+        }
+    }
+    return p;
+}
+
+template<typename Allocator>
+auto write_cbor(const BasicJson<Allocator> &json, std::string &out) -> void {
+    using J = BasicJson<Allocator>;
+    std::visit(
+        [&out](const auto &arg) {
+            using T = std::decay_t<decltype(arg)>;
+            if constexpr (std::is_same_v<Null, T>) {
+                out += static_cast<char>(kCborNull);
+            } else if constexpr (std::is_same_v<Bool, T>) {
+                out += static_cast<char>(arg ? kCborTrue : kCborFalse);
+            } else if constexpr (std::is_same_v<Int, T>) {
+                if (arg >= 0) cbor_put_head(out, kCborUInt, uint64_t(arg));
+                else
+                    cbor_put_head(out, kCborNegInt, ~uint64_t(arg));
+            } else if constexpr (std::is_same_v<UInt, T>) {
+                cbor_put_head(out, kCborUInt, arg);
+            } else if constexpr (std::is_same_v<Float, T>) {
+                const auto single = static_cast<float>(arg);
+                if (static_cast<double>(single) == arg or arg != arg) {
+                    out += static_cast<char>(0xfa);
+                    const auto bits = std::bit_cast<uint32_t>(single);
+                    for (int shift = 24; shift >= 0; shift -= 8)
+                        out += static_cast<char>(bits >> shift & 0xff);
+                } else {
+                    out += static_cast<char>(0xfb);
+                    const auto bits = std::bit_cast<uint64_t>(arg);
+                    for (int shift = 56; shift >= 0; shift -= 8)
+                        out += static_cast<char>(bits >> shift & 0xff);
+                }
+            } else if constexpr (std::is_same_v<typename J::String, T>) {
+                cbor_put_head(out, kCborText, arg.size());
+                out.append(arg.data(), arg.size());
+            } else if constexpr (std::is_same_v<typename J::Array, T>) {
+                cbor_put_head(out, kCborArray, arg.size());
+                for (const auto &item : arg) write_cbor(item, out);
+            } else if constexpr (std::is_same_v<typename J::Object, T>) {
+                cbor_put_head(out, kCborMap, arg.size());
+                for (const auto &[key, value] : arg) {
+                    cbor_put_head(out, kCborText, key.size());
+                    out.append(key.data(), key.size());
+                    write_cbor(value, out);
+                }
+            }
+        },
+        json.value_);
+}
+
+// Decodes the data item at `p` and advances past it. Containers may nest
+// `depth` levels further.
+inline auto read_cbor(const char *&p, const char *last, size_t depth)
+    -> std::optional<Json> {
+    CborHead head;
+    if (!cbor_read_head(p, last, head)) return std::nullopt;
+    const auto left = static_cast<uint64_t>(last - p);
+    switch (head.major) {
+        case kCborUInt:
+            if (head.arg <= uint64_t(INT64_MAX)) return Json(Int(head.arg));
+            return Json(UInt(head.arg));
+        case kCborNegInt:
+            if (head.arg <= uint64_t(INT64_MAX)) return Json(Int(~head.arg));
+            // below INT64_MIN, as the text parser does
+            return Json(-1.0 - static_cast<double>(head.arg));
+        case kCborText: {
+            if (head.arg > left) return std::nullopt;
+            String str(p, head.arg);
+            p += head.arg;
+            return Json(std::move(str));
+        }
+        case kCborArray: {
+            if (head.arg > left or depth == 0) return std::nullopt;
+            Array arr;
+            arr.reserve(head.arg);
+            for (uint64_t i = 0; i < head.arg; ++i) {
+                auto item = read_cbor(p, last, depth - 1);
+                if (!item) return std::nullopt;
+                arr.push_back(std::move(*item));
+            }
+            return Json(std::move(arr));
+        }
+        case kCborMap: {
+            if (head.arg > left / 2 or depth == 0) return std::nullopt;
+            Object obj;
+            for (uint64_t i = 0; i < head.arg; ++i) {
+                CborHead key;
+                if (!cbor_read_head(p, last, key) or key.major != kCborText
+                    or key.arg > uint64_t(last - p))
+                    return std::nullopt;
+                String name(p, key.arg);
+                p += key.arg;
+                auto value = read_cbor(p, last, depth - 1);
+                if (!value) return std::nullopt;
+                obj.insert_or_assign(std::move(name), std::move(*value));
+            }
+            return Json(std::move(obj));
+        }
+        case kCborSimple:
+            if (cbor_is_float(head)) return Json(cbor_float(head));
+            if (head.info == (kCborFalse & 31)) return Json(false);
+            if (head.info == (kCborTrue & 31)) return Json(true);
+            if (head.info == (kCborNull & 31)) return Json(nullptr);
+            return std::nullopt;
+        default: // byte strings and tags have no Json counterpart
+            return std::nullopt;
+    }
+}
+
+} // namespace details
+
+// appends the encoding of `json` to `out`
+template<typename Allocator>
+auto to_cbor(const BasicJson<Allocator> &json, std::string &out) -> void {
+    details::write_cbor(json, out);
+}
+
+template<typename Allocator>
+auto to_cbor(const BasicJson<Allocator> &json) -> std::string {
+    std::string out;
+    details::write_cbor(json, out);
+    return out;
+}
+
+// Decodes `bytes`, which must hold exactly one data item. The limits of
+// `options` apply as they do to text.
+inline auto from_cbor(std::string_view bytes, const ParseOptions &options = {})
+    -> std::optional<Json> {
+    if (bytes.size() > options.max_size) return std::nullopt;
+    const char *p = bytes.data();
+    const char *last = p + bytes.size();
+    auto ret = details::read_cbor(p, last, options.max_depth);
+    if (p != last) return std::nullopt;
+    return ret;
+}
+
+// One data item in a caller-owned CBOR buffer. Lookups skip the items they
+// pass over without decoding them. The buffer must outlive the view.
+class CborValue {
+  public:
+    CborValue(const char *first, const char *last)
+        : first_(first), last_(last) {}
+
+    auto is_null() const -> bool { return initial() == details::kCborNull; }
+    auto is_bool() const -> bool {
+        return initial() == details::kCborFalse
+               or initial() == details::kCborTrue;
+    }
+    auto is_number() const -> bool;
+    auto is_string() const -> bool {
+        return first_ != last_ and major() == details::kCborText;
+    }
+    auto is_array() const -> bool {
+        return first_ != last_ and major() == details::kCborArray;
+    }
+    auto is_object() const -> bool {
+        return first_ != last_ and major() == details::kCborMap;
+    }
+
+    // the encoded bytes of the whole item
+    auto raw() const -> std::string_view;
+
+    auto get_bool() const -> bool;
+    auto get_int() const -> int64_t;
+    auto get_uint() const -> uint64_t;
+    auto get_double() const -> double;
+    // a view into the buffer
+    auto get_string() const -> std::string_view;
+
+    // number of elements or members, read from the head
+    auto size() const -> size_t;
+    // first member named `key`
+    auto find(std::string_view key) const -> std::optional<CborValue>;
+    auto at(size_t index) const -> std::optional<CborValue>;
+    // RFC 6901, e.g. "/params/diagnostics/0/range"
+    auto at_pointer(std::string_view pointer) const
+        -> std::optional<CborValue>;
+
+    // builds this value, validating it
+    auto decode() const -> std::optional<Json> { return from_cbor(raw()); }
+
+  private:
+    auto initial() const -> uint8_t {
+        return first_ == last_ ? 0xff : static_cast<uint8_t>(*first_);
+    }
+    auto major() const -> uint8_t { return initial() >> 5; }
+    // the head of this item; `body` is set to what follows it
+    auto head(const char *&body) const -> details::CborHead;
+    auto member(std::string_view key) const -> std::optional<CborValue>;
+    auto element(size_t index) const -> std::optional<CborValue>;
+
+    const char *first_;
+    const char *last_;
+};
+
+inline auto cbor_view(std::string_view bytes) -> CborValue {
+    return {bytes.data(), bytes.data() + bytes.size()};
+}
+
+inline auto CborValue::head(const char *&body) const -> details::CborHead {
+    details::CborHead ret;
+    body = first_;
+    if (!details::cbor_read_head(body, last_, ret))
+        throw std::runtime_error("Malformed value");
+    return ret;
+}
+
+inline auto CborValue::is_number() const -> bool {
+    const char *body;
+    if (first_ == last_) return false;
+    if (major() == details::kCborUInt or major() == details::kCborNegInt)
+        return true;
+    return major() == details::kCborSimple
+           and details::cbor_is_float(head(body));
+}
+
+inline auto CborValue::raw() const -> std::string_view {
+    const char *end = details::skip_cbor(first_, last_);
+    if (end == nullptr) throw std::runtime_error("Malformed value");
+    return {first_, size_t(end - first_)};
+}
+
+inline auto CborValue::get_bool() const -> bool {
+    if (!is_bool()) throw std::runtime_error("Type is not Bool");
+    return initial() == details::kCborTrue;
+}
+
+inline auto CborValue::get_int() const -> int64_t {
+    const char *body;
+    if (first_ != last_ and major() <= details::kCborNegInt) {
+        const auto h = head(body);
+        if (h.arg <= uint64_t(INT64_MAX))
+            return h.major == details::kCborUInt ? int64_t(h.arg)
+                                                 : int64_t(~h.arg);
+    }
+    throw std::runtime_error("Type is not Int");
+}
+
+inline auto CborValue::get_uint() const -> uint64_t {
+    const char *body;
+    if (first_ == last_ or major() != details::kCborUInt)
+        throw std::runtime_error("Type is not UInt");
+    return head(body).arg;
+}
+
+inline auto CborValue::get_double() const -> double {
+    if (!is_number()) throw std::runtime_error("Type is not Float");
+    const char *body;
+    const auto h = head(body);
+    if (h.major == details::kCborUInt) return static_cast<double>(h.arg);
+    if (h.major == details::kCborNegInt)
+        return -1.0 - static_cast<double>(h.arg);
+    return details::cbor_float(h);
+}
+
+inline auto CborValue::get_string() const -> std::string_view {
+    if (!is_string()) throw std::runtime_error("Type is not String");
+    const char *body;
+    const auto h = head(body);
+    if (h.arg > uint64_t(last_ - body))
+        throw std::runtime_error("Malformed value");
+    return {body, size_t(h.arg)};
+}
+
+inline auto CborValue::size() const -> size_t {
+    if (!is_array() and !is_object())
+        throw std::runtime_error("Type is not Array or Object");
+    const char *body;
+    return head(body).arg;
+}
+
+inline auto CborValue::member(std::string_view key) const
+    -> std::optional<CborValue> {
+    const char *p;
+    const auto h = head(p);
+    for (uint64_t i = 0; i < h.arg and p != nullptr; ++i) {
+        details::CborHead name;
+        const char *value = p;
+        if (!details::cbor_read_head(value, last_, name)) return std::nullopt;
+        if (name.major == details::kCborText
+            and name.arg <= uint64_t(last_ - value)) {
+            const std::string_view text(value, name.arg);
+            value += name.arg;
+            if (text == key) return CborValue(value, last_);
+        } else {
+            value = details::skip_cbor(p, last_);
+            if (value == nullptr) return std::nullopt;
+        }
+        p = details::skip_cbor(value, last_);
+    }
+    return std::nullopt;
+}
+
+inline auto CborValue::element(size_t index) const
+    -> std::optional<CborValue> {
+    const char *p;
+    const auto h = head(p);
+    if (index >= h.arg) return std::nullopt;
+    for (size_t i = 0; i < index and p != nullptr; ++i)
+        p = details::skip_cbor(p, last_);
+    if (p == nullptr) return std::nullopt;
+    return CborValue(p, last_);
+}
+
+inline auto CborValue::find(std::string_view key) const
+    -> std::optional<CborValue> {
+    if (!is_object()) throw std::runtime_error("Type is not Object");
+    return member(key);
+}
+
+inline auto CborValue::at(size_t index) const -> std::optional<CborValue> {
+    if (!is_array()) throw std::runtime_error("Type is not Array");
+    return element(index);
+}
+
+inline auto CborValue::at_pointer(std::string_view pointer) const
+    -> std::optional<CborValue> {
+    if (!pointer.empty() and pointer[0] != '/') return std::nullopt;
+    std::optional<CborValue> cur = *this;
+    while (cur and !pointer.empty()) {
+        const size_t end = pointer.find('/', 1);
+        const auto token = pointer.substr(1, end - 1);
+        if (cur->is_object())
+            cur = cur->member(details::pointer_token(token));
+        else if (cur->is_array())
+            cur = cur->element(details::pointer_index(token));
+        else
+            return std::nullopt;
+        pointer = end == pointer.npos ? "" : pointer.substr(end);
+    }
+    return cur;
+}
+
+} // namespace eee
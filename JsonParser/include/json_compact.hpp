@@ -0,0 +1,868 @@
+#pragma once
+#include "json.hpp"
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Compact owning tree, an alternative to eee::Json for large documents.
+//
+// A Value is 16 bytes: an 8-byte payload, a 4-byte length and a tag in the
+// last byte. Strings of up to 15 bytes live inside the Value. An array or
+// object is one flat allocation. Object members keep insertion order and
+// point at keys interned in the Document's KeyPool, so a key repeated across
+// thousands of records is stored once. Objects with more than
+// kIndexThreshold members also get an open-addressing hash index.
+
+namespace eee::compact {
+
+enum class Type : uint8_t {
+    Null,
+    Bool,
+    Int,
+    UInt,
+    Float,
+    String,
+    Array,
+    Object,
+};
+
+// An interned key. The bytes follow the header.
+struct Key {
+    uint32_t size;
+    uint32_t hash;
+
+    auto view() const -> std::string_view {
+        return {reinterpret_cast<const char *>(this + 1), size};
+    }
+};
+
+class Value;
+struct Member;
+
+namespace details {
+
+enum class Kind : uint8_t {
+    Null,
+    False,
+    True,
+    Int,
+    UInt,
+    Float,
+    SmallString, // length in the high nibble of the tag
+    String,
+    Array,
+    Object,
+};
+
+inline auto hash(std::string_view str) -> uint32_t {
+    const uint64_t h = std::hash<std::string_view>{}(str);
+    return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+struct ArrayBlock {
+    uint32_t size;
+    uint32_t capacity;
+
+    auto data() -> Value *;
+};
+
+struct ObjectBlock {
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t *index; // member position + 1 per slot, null while small
+
+    auto data() -> Member *;
+};
+
+} // namespace details
+
+// Owns the interned keys of a Document. Keys never move once created.
+class KeyPool {
+  public:
+    KeyPool() = default;
+    KeyPool(const KeyPool &other) = delete;
+    auto operator=(const KeyPool &other) -> KeyPool & = delete;
+    KeyPool(KeyPool &&other) noexcept = default;
+    auto operator=(KeyPool &&other) noexcept -> KeyPool & = default;
+
+    auto intern(std::string_view key) -> const Key * {
+        const uint32_t hash = details::hash(key);
+        if ((size_ + 1) * 2 > slots_.size()) grow();
+        const size_t mask = slots_.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            if (slots_[i] == nullptr) {
+                ++size_;
+                return slots_[i] = make(key, hash);
+            }
+            if (slots_[i]->hash == hash and slots_[i]->view() == key)
+                return slots_[i];
+        }
+    }
+
+    auto size() const -> size_t { return size_; }
+
+  private:
+    static constexpr size_t kChunkSize = 16384;
+
+    auto make(std::string_view key, uint32_t hash) -> const Key * {
+        if (key.size() > UINT32_MAX) throw std::length_error("Key too long");
+        const size_t need =
+            (sizeof(Key) + key.size() + alignof(Key) - 1) & ~(alignof(Key) - 1);
+        if (chunks_.empty() or used_ + need > chunk_size_) {
+            chunk_size_ = std::max(kChunkSize, need);
+            chunks_.emplace_back(new char[chunk_size_]);
+            used_ = 0;
+        }
+        char *p = chunks_.back().get() + used_;
+        used_ += need;
+        auto *ret = new (p) Key{static_cast<uint32_t>(key.size()), hash};
+        std::memcpy(p + sizeof(Key), key.data(), key.size());
+        return ret;
+    }
+
+    auto grow() -> void {
+        std::vector<const Key *> old(std::max<size_t>(64, slots_.size() * 2));
+        old.swap(slots_);
+        const size_t mask = slots_.size() - 1;
+        for (const Key *key : old) {
+            if (key == nullptr) continue;
+            size_t i = key->hash & mask;
+            while (slots_[i] != nullptr) i = (i + 1) & mask;
+            slots_[i] = key;
+        }
+    }
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    size_t chunk_size_ = 0;
+    size_t used_ = 0;
+    std::vector<const Key *> slots_;
+    size_t size_ = 0;
+};
+
+class Value {
+  public:
+    // objects above this size keep a hash index next to the members
+    static constexpr uint32_t kIndexThreshold = 16;
+
+    Value() noexcept { set_kind(details::Kind::Null); }
+    Value(std::nullptr_t) noexcept : Value() {}
+    Value(bool value) noexcept {
+        set_kind(value ? details::Kind::True : details::Kind::False);
+    }
+    template<std::integral T>
+        requires(!std::is_same_v<T, bool>)
+    Value(T value) noexcept {
+        if constexpr (std::is_signed_v<T>) {
+            store(static_cast<Int>(value));
+            set_kind(details::Kind::Int);
+        } else {
+            store(static_cast<UInt>(value));
+            const bool big = static_cast<UInt>(value) > UInt(INT64_MAX);
+            set_kind(big ? details::Kind::UInt : details::Kind::Int);
+        }
+    }
+    Value(Float value) noexcept {
+        store(value);
+        set_kind(details::Kind::Float);
+    }
+    Value(std::string_view str) { assign_string(str); }
+    Value(const char *str) : Value(std::string_view(str)) {}
+    Value(const std::string &str) : Value(std::string_view(str)) {}
+
+    static auto array(size_t capacity = 0) -> Value;
+    static auto object(size_t capacity = 0) -> Value;
+
+    Value(const Value &other);
+    auto operator=(const Value &other) -> Value & {
+        if (this != &other) Value(other).swap(*this);
+        return *this;
+    }
+    Value(Value &&other) noexcept {
+        std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+        other.reset();
+    }
+    auto operator=(Value &&other) noexcept -> Value & {
+        other.swap(*this);
+        return *this;
+    }
+    ~Value() { release(); }
+
+    auto swap(Value &other) noexcept -> void {
+        unsigned char tmp[sizeof(bytes_)];
+        std::memcpy(tmp, bytes_, sizeof(bytes_));
+        std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+        std::memcpy(other.bytes_, tmp, sizeof(bytes_));
+    }
+
+    auto type() const -> Type;
+    auto is_null() const -> bool { return type() == Type::Null; }
+    auto is_bool() const -> bool { return type() == Type::Bool; }
+    auto is_int() const -> bool { return type() == Type::Int; }
+    auto is_uint() const -> bool { return type() == Type::UInt; }
+    auto is_float() const -> bool { return type() == Type::Float; }
+    auto is_number() const -> bool {
+        return is_int() or is_uint() or is_float();
+    }
+    auto is_string() const -> bool { return type() == Type::String; }
+    auto is_array() const -> bool { return type() == Type::Array; }
+    auto is_object() const -> bool { return type() == Type::Object; }
+
+    auto get_bool() const -> bool;
+    auto get_int() const -> int64_t;
+    auto get_uint() const -> uint64_t;
+    auto get_double() const -> double;
+    // valid until the value is modified or destroyed
+    auto get_string() const -> std::string_view;
+
+    auto size() const -> size_t;
+
+    auto items() -> std::span<Value>;
+    auto items() const -> std::span<const Value>;
+    auto operator[](size_t index) -> Value &;
+    auto operator[](size_t index) const -> const Value &;
+    auto push_back(Value value) -> void;
+
+    // members in insertion order
+    auto members() -> std::span<Member>;
+    auto members() const -> std::span<const Member>;
+    auto find(std::string_view key) -> Value *;
+    auto find(std::string_view key) const -> const Value *;
+    auto operator[](std::string_view key) -> Value &;
+    auto operator[](std::string_view key) const -> const Value &;
+    // `key` must come from the KeyPool of the Document that owns this value
+    auto insert_or_assign(const Key *key, Value value) -> Value &;
+
+    auto to_json() const -> Json;
+
+  private:
+    auto kind() const -> details::Kind {
+        return static_cast<details::Kind>(bytes_[15] & 0x0F);
+    }
+    auto set_kind(details::Kind kind, uint8_t high = 0) -> void {
+        bytes_[15] = static_cast<unsigned char>(kind) | (high << 4);
+    }
+    template<typename T>
+    auto load() const -> T {
+        T value;
+        std::memcpy(&value, bytes_, sizeof(T));
+        return value;
+    }
+    template<typename T>
+    auto store(T value) -> void {
+        std::memcpy(bytes_, &value, sizeof(T));
+    }
+    auto length() const -> uint32_t {
+        uint32_t len;
+        std::memcpy(&len, bytes_ + 8, sizeof(len));
+        return len;
+    }
+    auto set_length(uint32_t len) -> void {
+        std::memcpy(bytes_ + 8, &len, sizeof(len));
+    }
+
+    auto array_block() const -> details::ArrayBlock * {
+        return load<details::ArrayBlock *>();
+    }
+    auto object_block() const -> details::ObjectBlock * {
+        return load<details::ObjectBlock *>();
+    }
+    auto find_member(std::string_view key, uint32_t hash) const -> Member *;
+
+    auto assign_string(std::string_view str) -> void;
+    auto reset() -> void {
+        std::memset(bytes_, 0, sizeof(bytes_));
+        set_kind(details::Kind::Null);
+    }
+    auto release() noexcept -> void;
+
+    alignas(8) unsigned char bytes_[16] = {};
+};
+
+static_assert(sizeof(Value) == 16);
+
+struct Member {
+    const Key *key;
+    Value value;
+};
+
+namespace details {
+
+inline auto ArrayBlock::data() -> Value * {
+    return reinterpret_cast<Value *>(this + 1);
+}
+
+inline auto ObjectBlock::data() -> Member * {
+    return reinterpret_cast<Member *>(this + 1);
+}
+
+inline auto allocate_array(size_t capacity) -> ArrayBlock * {
+    if (capacity > UINT32_MAX) throw std::length_error("Array too large");
+    void *p = ::operator new(sizeof(ArrayBlock) + capacity * sizeof(Value));
+    return new (p) ArrayBlock{0, static_cast<uint32_t>(capacity)};
+}
+
+inline auto allocate_object(size_t capacity) -> ObjectBlock * {
+    if (capacity > UINT32_MAX / 2) throw std::length_error("Object too large");
+    void *p = ::operator new(sizeof(ObjectBlock) + capacity * sizeof(Member));
+    return new (p) ObjectBlock{0, static_cast<uint32_t>(capacity), nullptr};
+}
+
+// slot count for an object that can hold `capacity` members
+inline auto index_slots(uint32_t capacity) -> size_t {
+    return std::bit_ceil(size_t(capacity) * 2);
+}
+
+inline auto index_insert(ObjectBlock *block, uint32_t position) -> void {
+    const size_t mask = index_slots(block->capacity) - 1;
+    size_t i = block->data()[position].key->hash & mask;
+    while (block->index[i] != 0) i = (i + 1) & mask;
+    block->index[i] = position + 1;
+}
+
+inline auto build_index(ObjectBlock *block) -> void {
+    delete[] block->index;
+    block->index = new uint32_t[index_slots(block->capacity)]();
+    for (uint32_t i = 0; i < block->size; ++i) index_insert(block, i);
+}
+
+inline auto free_array(ArrayBlock *block) noexcept -> void {
+    std::destroy_n(block->data(), block->size);
+    ::operator delete(block);
+}
+
+inline auto free_object(ObjectBlock *block) noexcept -> void {
+    std::destroy_n(block->data(), block->size);
+    delete[] block->index;
+    ::operator delete(block);
+}
+
+} // namespace details
+
+inline auto Value::array(size_t capacity) -> Value {
+    Value ret;
+    ret.store(details::allocate_array(capacity));
+    ret.set_kind(details::Kind::Array);
+    return ret;
+}
+
+inline auto Value::object(size_t capacity) -> Value {
+    Value ret;
+    ret.store(details::allocate_object(capacity));
+    ret.set_kind(details::Kind::Object);
+    return ret;
+}
+
+inline Value::Value(const Value &other) {
+    switch (other.kind()) {
+        case details::Kind::String:
+            reset();
+            assign_string(other.get_string());
+            break;
+        case details::Kind::Array: {
+            const auto *src = other.array_block();
+            auto *dst = details::allocate_array(src->size);
+            store(dst);
+            set_kind(details::Kind::Array);
+            for (const auto &item : other.items()) {
+                new (dst->data() + dst->size) Value(item);
+                ++dst->size;
+            }
+            break;
+        }
+        case details::Kind::Object: {
+            const auto *src = other.object_block();
+            auto *dst = details::allocate_object(src->size);
+            store(dst);
+            set_kind(details::Kind::Object);
+            for (const auto &member : other.members()) {
+                new (dst->data() + dst->size) Member{member.key, member.value};
+                ++dst->size;
+            }
+            if (dst->size > kIndexThreshold) details::build_index(dst);
+            break;
+        }
+        default:
+            std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+    }
+}
+
+inline auto Value::release() noexcept -> void {
+    switch (kind()) {
+        case details::Kind::String:
+            delete[] load<char *>();
+            break;
+        case details::Kind::Array:
+            details::free_array(array_block());
+            break;
+        case details::Kind::Object:
+            details::free_object(object_block());
+            break;
+        default:
+            break;
+    }
+}
+
+inline auto Value::assign_string(std::string_view str) -> void {
+    if (str.size() < 16) {
+        std::memcpy(bytes_, str.data(), str.size());
+        set_kind(details::Kind::SmallString, static_cast<uint8_t>(str.size()));
+        return;
+    }
+    if (str.size() > UINT32_MAX) throw std::length_error("String too long");
+    char *p = new char[str.size()];
+    std::memcpy(p, str.data(), str.size());
+    store(p);
+    set_length(static_cast<uint32_t>(str.size()));
+    set_kind(details::Kind::String);
+}
+
+inline auto Value::type() const -> Type {
+    using details::Kind;
+    switch (kind()) {
+        case Kind::Null:
+            return Type::Null;
+        case Kind::False:
+        case Kind::True:
+            return Type::Bool;
+        case Kind::Int:
+            return Type::Int;
+        case Kind::UInt:
+            return Type::UInt;
+        case Kind::Float:
+            return Type::Float;
+        case Kind::SmallString:
+        case Kind::String:
+            return Type::String;
+        case Kind::Array:
+            return Type::Array;
+        case Kind::Object:
+            return Type::Object;
+    }
+    return Type::Null;
+}
+
+inline auto Value::get_bool() const -> bool {
+    if (kind() == details::Kind::True) return true;
+    if (kind() == details::Kind::False) return false;
+    throw std::runtime_error("Type is not Bool");
+}
+
+inline auto Value::get_int() const -> int64_t {
+    if (kind() == details::Kind::Int) return load<Int>();
+    throw std::runtime_error("Type is not Int");
+}
+
+inline auto Value::get_uint() const -> uint64_t {
+    if (kind() == details::Kind::UInt) return load<UInt>();
+    if (kind() == details::Kind::Int and load<Int>() >= 0) return load<UInt>();
+    throw std::runtime_error("Type is not UInt");
+}
+
+inline auto Value::get_double() const -> double {
+    switch (kind()) {
+        case details::Kind::Int:
+            return static_cast<double>(load<Int>());
+        case details::Kind::UInt:
+            return static_cast<double>(load<UInt>());
+        case details::Kind::Float:
+            return load<Float>();
+        default:
+            throw std::runtime_error("Type is not Float");
+    }
+}
+
+inline auto Value::get_string() const -> std::string_view {
+    if (kind() == details::Kind::SmallString)
+        return {
+            reinterpret_cast<const char *>(bytes_), size_t(bytes_[15] >> 4)};
+    if (kind() == details::Kind::String) return {load<char *>(), length()};
+    throw std::runtime_error("Type is not String");
+}
+
+inline auto Value::size() const -> size_t {
+    if (kind() == details::Kind::Array) return array_block()->size;
+    if (kind() == details::Kind::Object) return object_block()->size;
+    throw std::runtime_error("Type is not Object or Array");
+}
+
+inline auto Value::items() -> std::span<Value> {
+    if (kind() != details::Kind::Array)
+        throw std::runtime_error("Type is not Array");
+    auto *block = array_block();
+    return {block->data(), block->size};
+}
+
+inline auto Value::items() const -> std::span<const Value> {
+    return const_cast<Value *>(this)->items();
+}
+
+inline auto Value::operator[](size_t index) -> Value & {
+    auto arr = items();
+    if (index >= arr.size()) throw std::out_of_range("Index out of range");
+    return arr[index];
+}
+
+inline auto Value::operator[](size_t index) const -> const Value & {
+    return const_cast<Value &>(*this)[index];
+}
+
+inline auto Value::push_back(Value value) -> void {
+    items(); // type check
+    auto *block = array_block();
+    if (block->size == block->capacity) {
+        auto *grown = details::allocate_array(
+            std::max<size_t>(4, size_t(block->capacity) * 2));
+        for (auto &item : std::span(block->data(), block->size)) {
+            new (grown->data() + grown->size) Value(std::move(item));
+            ++grown->size;
+        }
+        details::free_array(block);
+        store(block = grown);
+    }
+    new (block->data() + block->size) Value(std::move(value));
+    ++block->size;
+}
+
+inline auto Value::members() -> std::span<Member> {
+    if (kind() != details::Kind::Object)
+        throw std::runtime_error("Type is not Object");
+    auto *block = object_block();
+    return {block->data(), block->size};
+}
+
+inline auto Value::members() const -> std::span<const Member> {
+    return const_cast<Value *>(this)->members();
+}
+
+inline auto Value::find_member(std::string_view key, uint32_t hash) const
+    -> Member * {
+    auto *block = object_block();
+    Member *data = block->data();
+    if (block->index == nullptr) {
+        for (uint32_t i = 0; i < block->size; ++i)
+            if (data[i].key->hash == hash and data[i].key->view() == key)
+                return data + i;
+        return nullptr;
+    }
+    const size_t mask = details::index_slots(block->capacity) - 1;
+    for (size_t i = hash & mask; block->index[i] != 0; i = (i + 1) & mask) {
+        Member *m = data + block->index[i] - 1;
+        if (m->key->hash == hash and m->key->view() == key) return m;
+    }
+    return nullptr;
+}
+
+inline auto Value::find(std::string_view key) -> Value * {
+    members(); // type check
+    Member *m = find_member(key, details::hash(key));
+    return m ? &m->value : nullptr;
+}
+
+inline auto Value::find(std::string_view key) const -> const Value * {
+    return const_cast<Value *>(this)->find(key);
+}
+
+inline auto Value::operator[](std::string_view key) -> Value & {
+    if (auto *ret = find(key)) return *ret;
+    throw std::out_of_range("Key not found");
+}
+
+inline auto Value::operator[](std::string_view key) const -> const Value & {
+    return const_cast<Value &>(*this)[key];
+}
+
+inline auto Value::insert_or_assign(const Key *key, Value value) -> Value & {
+    members(); // type check
+    if (Member *m = find_member(key->view(), key->hash)) {
+        m->value = std::move(value);
+        return m->value;
+    }
+    auto *block = object_block();
+    if (block->size == block->capacity) {
+        auto *grown = details::allocate_object(
+            std::max<size_t>(4, size_t(block->capacity) * 2));
+        for (auto &m : std::span(block->data(), block->size)) {
+            new (grown->data() + grown->size) Member{m.key, std::move(m.value)};
+            ++grown->size;
+        }
+        details::free_object(block);
+        store(block = grown);
+        if (block->size > kIndexThreshold) details::build_index(block);
+    }
+    Member *m = new (block->data() + block->size) Member{key, std::move(value)};
+    ++block->size;
+    if (block->index != nullptr)
+        details::index_insert(block, block->size - 1);
+    else if (block->size > kIndexThreshold)
+        details::build_index(block);
+    return m->value;
+}
+
+inline auto Value::to_json() const -> Json {
+    switch (type()) {
+        case Type::Null:
+            return Json(nullptr);
+        case Type::Bool:
+            return Json(get_bool());
+        case Type::Int:
+            return Json(get_int());
+        case Type::UInt:
+            return Json(get_uint());
+        case Type::Float:
+            return Json(get_double());
+        case Type::String:
+            return Json(std::string(get_string()));
+        case Type::Array: {
+            Array arr;
+            arr.reserve(size());
+            for (const auto &item : items()) arr.push_back(item.to_json());
+            return Json(std::move(arr));
+        }
+        case Type::Object: {
+            Object obj;
+            for (const auto &[key, value] : members())
+                obj.emplace(key->view(), value.to_json());
+            return Json(std::move(obj));
+        }
+    }
+    return {};
+}
+
+class Document {
+  public:
+    auto root() -> Value & { return root_; }
+    auto root() const -> const Value & { return root_; }
+
+    // interns `key` for use with Value::insert_or_assign on this document
+    auto key(std::string_view key) -> const Key * { return keys_.intern(key); }
+    auto keys() const -> const KeyPool & { return keys_; }
+
+  private:
+    friend class Parser;
+
+    KeyPool keys_;
+    Value root_;
+};
+
+// Parses into a Document. Keeps its structural index and scratch stacks
+// between calls.
+class Parser {
+  public:
+    Parser() = default;
+    explicit Parser(const ParseOptions &options) : options_(options) {}
+
+    auto parse(std::string_view input, Document &doc) -> bool;
+
+  private:
+    // an open container: its children start at `base` of values_ or
+    // members_, and `key` names the next member of an object
+    struct Frame {
+        bool is_object;
+        size_t base;
+        const Key *key;
+    };
+
+    auto peek() const -> char {
+        const size_t offset = index_[pos_];
+        return offset < input_.size() ? input_[offset] : '\0';
+    }
+    auto scalar_ends_at(size_t end) const -> bool {
+        return end == input_.size() or end == index_[pos_ + 1]
+               or ::eee::details::is_space(input_[end]);
+    }
+
+    auto parse_value(Value &out) -> bool;
+    auto parse_string() -> std::optional<std::string_view>;
+    auto parse_key(const Key *&key) -> bool;
+    auto parse_number(Value &out) -> bool;
+    auto parse_literal(std::string_view literal, Value value, Value &out)
+        -> bool;
+    auto close_array(size_t base) -> Value;
+    auto close_object(size_t base) -> Value;
+
+    std::string_view input_;
+    std::vector<uint32_t> index_; // structural offsets of input_
+    size_t pos_ = 0;
+    KeyPool *keys_ = nullptr;
+    ParseOptions options_;
+    std::vector<Frame> frames_;   // the open containers, outermost first
+    std::vector<Value> values_;   // items of the open arrays
+    std::vector<Member> members_; // members of the open objects
+    std::string scratch_;         // decoded escapes
+};
+
+// decoded body of the string at pos_; points into the input or scratch_
+inline auto Parser::parse_string() -> std::optional<std::string_view> {
+    const size_t begin = index_[pos_] + 1;
+    const size_t end = index_[++pos_];
+    ++pos_;
+    auto raw = input_.substr(begin, end - begin);
+    const char *first = raw.data();
+    const char *last = first + raw.size();
+    if (::eee::details::find_invalid_utf8(first, last) != nullptr)
+        return std::nullopt;
+    // no escapes and no control characters: the body is the string
+    if (::eee::details::find_escape(first, last) == last) return raw;
+    scratch_.clear();
+    if (!::eee::details::unescape(raw, scratch_)) return std::nullopt;
+    return std::string_view(scratch_);
+}
+
+// parses `"key":` and interns the key
+inline auto Parser::parse_key(const Key *&key) -> bool {
+    if (peek() != '"') return false;
+    auto str = parse_string();
+    if (!str or peek() != ':') return false;
+    ++pos_;
+    key = keys_->intern(*str);
+    return true;
+}
+
+inline auto Parser::parse_number(Value &out) -> bool {
+    const char *first = input_.data() + index_[pos_];
+    bool is_float = false;
+    const char *last = ::eee::details::scan_number(
+        first, input_.data() + input_.size(), is_float);
+    if (last == nullptr or !scalar_ends_at(last - input_.data())) return false;
+    ++pos_;
+    auto number = ::eee::details::to_number(first, last, is_float);
+    if (!number) return false;
+    if (auto *i = std::get_if<Int>(&*number)) out = Value(*i);
+    else if (auto *u = std::get_if<UInt>(&*number))
+        out = Value(*u);
+    else
+        out = Value(std::get<Float>(*number));
+    return true;
+}
+
+inline auto Parser::parse_literal(
+    std::string_view literal, Value value, Value &out) -> bool {
+    const size_t begin = index_[pos_];
+    if (input_.substr(begin, literal.size()) != literal
+        or !scalar_ends_at(begin + literal.size()))
+        return false;
+    ++pos_;
+    out = std::move(value);
+    return true;
+}
+
+// builds an array from the items above `base`
+inline auto Parser::close_array(size_t base) -> Value {
+    Value ret = Value::array(values_.size() - base);
+    for (size_t i = base; i < values_.size(); ++i)
+        ret.push_back(std::move(values_[i]));
+    values_.resize(base);
+    return ret;
+}
+
+// builds an object from the members above `base`; a repeated key keeps the
+// last value, as eee::Json does
+inline auto Parser::close_object(size_t base) -> Value {
+    Value ret = Value::object(members_.size() - base);
+    for (size_t i = base; i < members_.size(); ++i)
+        ret.insert_or_assign(members_[i].key, std::move(members_[i].value));
+    members_.resize(base);
+    return ret;
+}
+
+// Open containers live on frames_ and their children on values_ and
+// members_, so nesting costs heap space, bounded by max_depth, rather than
+// stack space. A container is built once its closer is reached.
+inline auto Parser::parse_value(Value &out) -> bool {
+    frames_.clear();
+    for (;;) {
+        Value value;
+        bool ok = true;
+        switch (peek()) {
+            case 'n':
+                ok = parse_literal("null", Value{}, value);
+                break;
+            case 't':
+                ok = parse_literal("true", Value{true}, value);
+                break;
+            case 'f':
+                ok = parse_literal("false", Value{false}, value);
+                break;
+            case '"': {
+                auto str = parse_string();
+                if (str) value = Value(*str);
+                ok = str.has_value();
+                break;
+            }
+            case '[':
+            case '{': {
+                if (frames_.size() >= options_.max_depth) return false;
+                const bool is_object = peek() == '{';
+                ++pos_;
+                if (peek() == (is_object ? '}' : ']')) {
+                    ++pos_;
+                    value = is_object ? Value::object(0) : Value::array(0);
+                    break;
+                }
+                auto &frame = frames_.emplace_back(Frame{
+                    is_object, is_object ? members_.size() : values_.size(),
+                    nullptr});
+                if (is_object and !parse_key(frame.key)) return false;
+                continue;
+            }
+            default:
+                ok = parse_number(value);
+        }
+        if (!ok) return false;
+        // add the value to its container and close what it completes
+        for (;;) {
+            if (frames_.empty()) {
+                out = std::move(value);
+                return true;
+            }
+            Frame &top = frames_.back();
+            if (top.is_object) members_.push_back({top.key, std::move(value)});
+            else
+                values_.push_back(std::move(value));
+            if (peek() == ',') {
+                ++pos_;
+                if (top.is_object and !parse_key(top.key)) return false;
+                break;
+            }
+            if (peek() != (top.is_object ? '}' : ']')) return false;
+            ++pos_;
+            value = top.is_object ? close_object(top.base)
+                                  : close_array(top.base);
+            frames_.pop_back();
+        }
+    }
+}
+
+inline auto Parser::parse(std::string_view input, Document &doc) -> bool {
+    input_ = input;
+    pos_ = 0;
+    keys_ = &doc.keys_;
+    values_.clear();
+    members_.clear();
+    if (input.size() > options_.max_size) return false;
+    if (!::eee::details::build_structural_index(input, index_)) return false;
+    // the whole input must be one value: only the sentinel may remain
+    return parse_value(doc.root_) and pos_ + 1 == index_.size();
+}
+
+// Nesting past options.max_depth and input past options.max_size fail to
+// parse, as with eee::parse.
+inline auto parse(std::string_view input, const ParseOptions &options = {})
+    -> std::optional<Document> {
+    Document doc;
+    Parser parser{options};
+    if (!parser.parse(input, doc)) return std::nullopt;
+    return doc;
+}
+
+} // namespace eee::compact
@@ -0,0 +1,641 @@
+#pragma once
+#include "json.hpp"
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only DOM over a caller-owned buffer.
+//
+// Strings, keys and (optionally) number text are kept as offsets into the
+// input, so the input must outlive the Document. Every node lives in one
+// contiguous tape; a container records the tape index one past its last
+// descendant, which makes skipping a subtree O(1).
+
+namespace eee::dom {
+
+enum class Type : uint8_t {
+    Null,
+    Bool,
+    Int,
+    UInt,
+    Float,
+    String,
+    Array,
+    Object,
+};
+
+namespace details {
+
+enum class Kind : uint8_t {
+    Null,
+    True,
+    False,
+    Int,
+    UInt,
+    Float,
+    RawNumber,
+    String,
+    Key,
+    Array,
+    Object,
+};
+
+enum Flags : uint8_t {
+    ESCAPED = 1, // string body contains at least one backslash
+    FLOATING = 2, // raw number has a fraction or exponent
+    UNSIGNED = 4, // raw number is an integer above INT64_MAX
+};
+
+struct TapeNode {
+    Kind kind;
+    uint8_t flags;
+    uint32_t len;     // string / number text length, or container size
+    uint64_t payload; // text offset, number bits, or container end index
+};
+
+static_assert(sizeof(TapeNode) == 16);
+
+} // namespace details
+
+struct Options {
+    // keep numbers as text and convert on access
+    bool raw_numbers = false;
+};
+
+class Element;
+class Document;
+
+class ArrayRange {
+  public:
+    class iterator;
+    ArrayRange(const Document *doc, uint32_t begin, uint32_t end)
+        : doc_(doc), begin_(begin), end_(end) {}
+    auto begin() const -> iterator;
+    auto end() const -> iterator;
+
+  private:
+    const Document *doc_;
+    uint32_t begin_, end_;
+};
+
+class ObjectRange {
+  public:
+    class iterator;
+    ObjectRange(const Document *doc, uint32_t begin, uint32_t end)
+        : doc_(doc), begin_(begin), end_(end) {}
+    auto begin() const -> iterator;
+    auto end() const -> iterator;
+
+  private:
+    const Document *doc_;
+    uint32_t begin_, end_;
+};
+
+class Element {
+  public:
+    Element(const Document *doc, uint32_t index) : doc_(doc), index_(index) {}
+
+    auto type() const -> Type;
+    auto is_null() const -> bool { return type() == Type::Null; }
+    auto is_bool() const -> bool { return type() == Type::Bool; }
+    auto is_int() const -> bool { return type() == Type::Int; }
+    auto is_uint() const -> bool { return type() == Type::UInt; }
+    auto is_float() const -> bool { return type() == Type::Float; }
+    auto is_number() const -> bool {
+        return is_int() or is_uint() or is_float();
+    }
+    auto is_string() const -> bool { return type() == Type::String; }
+    auto is_array() const -> bool { return type() == Type::Array; }
+    auto is_object() const -> bool { return type() == Type::Object; }
+
+    auto get_bool() const -> bool;
+    auto get_int() const -> int64_t;
+    auto get_uint() const -> uint64_t;
+    auto get_double() const -> double;
+    // number text as written in the input (raw_numbers mode only)
+    auto raw_number() const -> std::string_view;
+
+    // string body exactly as written, escapes included
+    auto raw_string() const -> std::string_view;
+    auto has_escapes() const -> bool;
+    // view of the decoded string; `scratch` is used only when the string
+    // contains escapes
+    auto get_string(std::string &scratch) const -> std::string_view;
+    auto get_string() const -> std::string;
+
+    // number of elements or members
+    auto size() const -> size_t;
+    auto get_array() const -> ArrayRange;
+    auto get_object() const -> ObjectRange;
+    auto find(std::string_view key) const -> std::optional<Element>;
+    auto operator[](std::string_view key) const -> Element;
+    // O(index): siblings are skipped through their end links
+    auto operator[](size_t index) const -> Element;
+
+    auto to_json() const -> Json;
+
+  private:
+    friend class ArrayRange;
+    friend class ObjectRange;
+
+    auto node() const -> const details::TapeNode &;
+    auto text() const -> std::string_view;
+    auto next() const -> uint32_t;
+
+    const Document *doc_;
+    uint32_t index_;
+};
+
+class ArrayRange::iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Element;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    iterator(const Document *doc, uint32_t index) : doc_(doc), index_(index) {}
+    auto operator*() const -> Element { return {doc_, index_}; }
+    auto operator++() -> iterator &;
+    auto operator++(int) -> iterator {
+        auto ret = *this;
+        ++*this;
+        return ret;
+    }
+    auto operator==(const iterator &other) const -> bool {
+        return index_ == other.index_;
+    }
+
+  private:
+    const Document *doc_ = nullptr;
+    uint32_t index_ = 0;
+};
+
+struct Member {
+    Element key;
+    Element value;
+};
+
+class ObjectRange::iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Member;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    iterator(const Document *doc, uint32_t index) : doc_(doc), index_(index) {}
+    auto operator*() const -> Member {
+        return {{doc_, index_}, {doc_, index_ + 1}};
+    }
+    auto operator++() -> iterator &;
+    auto operator++(int) -> iterator {
+        auto ret = *this;
+        ++*this;
+        return ret;
+    }
+    auto operator==(const iterator &other) const -> bool {
+        return index_ == other.index_;
+    }
+
+  private:
+    const Document *doc_ = nullptr;
+    uint32_t index_ = 0;
+};
+
+class Document {
+  public:
+    Document() = default;
+
+    auto root() const -> Element { return {this, 0}; }
+    auto input() const -> std::string_view { return input_; }
+    // number of tape nodes, i.e. values plus object keys
+    auto node_count() const -> size_t { return tape_.size(); }
+
+  private:
+    friend class Element;
+    friend class ArrayRange;
+    friend class ObjectRange;
+    friend class DomParser;
+
+    std::string_view input_;
+    std::vector<details::TapeNode> tape_;
+};
+
+// Reusable parser: a Document that is parsed into again keeps its tape
+// capacity, and the parser keeps its structural index, so a steady stream of
+// similar inputs allocates nothing.
+class DomParser {
+  public:
+    DomParser() = default;
+    DomParser(const Options &options) : options_(options) {}
+
+    auto parse(std::string_view input, Document &doc) -> bool;
+
+  private:
+    enum class State : uint8_t { VALUE, KEY, NEXT };
+
+    auto peek() const -> char {
+        const size_t offset = index_[pos_];
+        return offset < input_.size() ? input_[offset] : '\0';
+    }
+    auto scalar_ends_at(size_t end) const -> bool {
+        return end == input_.size() or end == index_[pos_ + 1]
+               or ::eee::details::is_space(input_[end]);
+    }
+    auto push(details::Kind kind, uint8_t flags, size_t len, uint64_t payload)
+        -> void {
+        tape_->push_back(
+            {kind, flags, static_cast<uint32_t>(len), payload});
+    }
+    auto parse_string(details::Kind kind) -> bool;
+    auto parse_number() -> bool;
+    auto parse_literal(std::string_view literal, details::Kind kind) -> bool;
+
+    Options options_;
+    std::string_view input_;
+    std::vector<uint32_t> index_; // structural offsets of input_
+    size_t pos_ = 0;              // current entry of index_
+    std::vector<details::TapeNode> *tape_ = nullptr;
+    std::vector<uint32_t> stack_; // tape indices of the open containers
+};
+
+inline auto DomParser::parse_string(details::Kind kind) -> bool {
+    if (peek() != '"') return false;
+    const size_t begin = index_[pos_] + 1;
+    const size_t end = index_[++pos_]; // closing quote
+    ++pos_;
+    const auto body = input_.substr(begin, end - begin);
+    // checked now, as eee::parse does, though decoding waits for a read
+    const char *first = body.data();
+    const char *last = first + body.size();
+    if (::eee::details::check_string(first, last) != nullptr
+        or ::eee::details::find_invalid_utf8(first, last) != nullptr)
+        return false;
+    const uint8_t flags =
+        std::memchr(body.data(), '\\', body.size()) ? details::ESCAPED : 0;
+    push(kind, flags, body.size(), begin);
+    return true;
+}
+
+inline auto DomParser::parse_number() -> bool {
+    const char *first = input_.data() + index_[pos_];
+    const char *last = input_.data() + input_.size();
+    bool is_float = false;
+    const char *end = ::eee::details::scan_number(first, last, is_float);
+    if (end == nullptr or !scalar_ends_at(end - input_.data())) return false;
+    ++pos_;
+    if (options_.raw_numbers) {
+        uint8_t flags = is_float ? details::FLOATING : 0;
+        // only integers of 19+ digits can leave the Int range
+        if (!is_float and end - first >= 19) {
+            auto value = ::eee::details::to_number(first, end, false);
+            if (!value) return false;
+            if (std::holds_alternative<UInt>(*value))
+                flags |= details::UNSIGNED;
+            else if (std::holds_alternative<Float>(*value))
+                flags |= details::FLOATING;
+        }
+        push(
+            details::Kind::RawNumber, flags, end - first,
+            first - input_.data());
+        return true;
+    }
+    auto value = ::eee::details::to_number(first, end, is_float);
+    if (!value) return false;
+    if (auto *i = std::get_if<Int>(&*value)) {
+        push(details::Kind::Int, 0, 0, static_cast<uint64_t>(*i));
+    } else if (auto *u = std::get_if<UInt>(&*value)) {
+        push(details::Kind::UInt, 0, 0, *u);
+    } else {
+        uint64_t bits;
+        std::memcpy(&bits, &std::get<Float>(*value), sizeof(bits));
+        push(details::Kind::Float, 0, 0, bits);
+    }
+    return true;
+}
+
+inline auto DomParser::parse_literal(std::string_view literal, details::Kind kind)
+    -> bool {
+    const size_t begin = index_[pos_];
+    if (input_.substr(begin, literal.size()) != literal
+        or !scalar_ends_at(begin + literal.size()))
+        return false;
+    ++pos_;
+    push(kind, 0, 0, 0);
+    return true;
+}
+
+inline auto DomParser::parse(std::string_view input, Document &doc) -> bool {
+    using details::Kind;
+    doc.input_ = input;
+    doc.tape_.clear();
+    input_ = input;
+    pos_ = 0;
+    tape_ = &doc.tape_;
+    stack_.clear();
+    if (!::eee::details::build_structural_index(input, index_)) return false;
+    // every node starts at a structural of its own
+    if (doc.tape_.capacity() < index_.size()) doc.tape_.reserve(index_.size());
+
+    auto open = [this](Kind kind) {
+        stack_.push_back(static_cast<uint32_t>(tape_->size()));
+        push(kind, 0, 0, 0);
+        ++pos_;
+    };
+    auto close = [this] {
+        (*tape_)[stack_.back()].payload = tape_->size();
+        stack_.pop_back();
+        ++pos_;
+    };
+
+    for (State state = State::VALUE;;) {
+        const char c = peek();
+        switch (state) {
+            case State::VALUE: {
+                bool ok = true;
+                state = State::NEXT;
+                switch (c) {
+                    case '{':
+                        open(Kind::Object);
+                        if (peek() == '}') close();
+                        else
+                            state = State::KEY;
+                        break;
+                    case '[':
+                        open(Kind::Array);
+                        if (peek() == ']') close();
+                        else
+                            state = State::VALUE;
+                        break;
+                    case '"':
+                        ok = parse_string(Kind::String);
+                        break;
+                    case 't':
+                        ok = parse_literal("true", Kind::True);
+                        break;
+                    case 'f':
+                        ok = parse_literal("false", Kind::False);
+                        break;
+                    case 'n':
+                        ok = parse_literal("null", Kind::Null);
+                        break;
+                    default:
+                        ok = parse_number();
+                }
+                if (!ok) return false;
+                if (state == State::NEXT and stack_.empty())
+                    return pos_ + 1 == index_.size();
+                break;
+            }
+            case State::KEY: {
+                if (!parse_string(Kind::Key) or peek() != ':') return false;
+                ++pos_;
+                state = State::VALUE;
+                break;
+            }
+            case State::NEXT: {
+                auto &top = (*tape_)[stack_.back()];
+                ++top.len;
+                const bool is_object = top.kind == Kind::Object;
+                if (c == ',') {
+                    ++pos_;
+                    state = is_object ? State::KEY : State::VALUE;
+                } else if (c == (is_object ? '}' : ']')) {
+                    close();
+                    if (stack_.empty()) return pos_ + 1 == index_.size();
+                } else {
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+}
+
+inline auto parse(std::string_view input, const Options &options = {})
+    -> std::optional<Document> {
+    Document doc;
+    DomParser parser{options};
+    if (!parser.parse(input, doc)) return std::nullopt;
+    return doc;
+}
+
+inline auto Element::node() const -> const details::TapeNode & {
+    return doc_->tape_[index_];
+}
+
+inline auto Element::text() const -> std::string_view {
+    return doc_->input_.substr(node().payload, node().len);
+}
+
+inline auto Element::next() const -> uint32_t {
+    const auto &n = node();
+    if (n.kind == details::Kind::Array or n.kind == details::Kind::Object)
+        return static_cast<uint32_t>(n.payload);
+    return index_ + 1;
+}
+
+inline auto Element::type() const -> Type {
+    using details::Kind;
+    switch (node().kind) {
+        case Kind::Null:
+            return Type::Null;
+        case Kind::True:
+        case Kind::False:
+            return Type::Bool;
+        case Kind::Int:
+            return Type::Int;
+        case Kind::UInt:
+            return Type::UInt;
+        case Kind::Float:
+            return Type::Float;
+        case Kind::RawNumber:
+            if (node().flags & details::FLOATING) return Type::Float;
+            return node().flags & details::UNSIGNED ? Type::UInt : Type::Int;
+        case Kind::String:
+        case Kind::Key:
+            return Type::String;
+        case Kind::Array:
+            return Type::Array;
+        case Kind::Object:
+            return Type::Object;
+    }
+    return Type::Null;
+}
+
+inline auto Element::get_bool() const -> bool {
+    if (node().kind == details::Kind::True) return true;
+    if (node().kind == details::Kind::False) return false;
+    throw std::runtime_error("Type is not Bool");
+}
+
+inline auto Element::get_int() const -> int64_t {
+    const auto &n = node();
+    if (n.kind == details::Kind::Int) return static_cast<int64_t>(n.payload);
+    if (type() == Type::Int) {
+        const auto str = text();
+        int64_t value = 0;
+        std::from_chars(str.data(), str.data() + str.size(), value);
+        return value;
+    }
+    throw std::runtime_error("Type is not Int");
+}
+
+inline auto Element::get_uint() const -> uint64_t {
+    const auto &n = node();
+    if (n.kind == details::Kind::UInt) return n.payload;
+    if (type() == Type::UInt) {
+        const auto str = text();
+        uint64_t value = 0;
+        std::from_chars(str.data(), str.data() + str.size(), value);
+        return value;
+    }
+    if (type() == Type::Int and get_int() >= 0)
+        return static_cast<uint64_t>(get_int());
+    throw std::runtime_error("Type is not UInt");
+}
+
+inline auto Element::get_double() const -> double {
+    const auto &n = node();
+    switch (n.kind) {
+        case details::Kind::Int:
+            return static_cast<double>(static_cast<int64_t>(n.payload));
+        case details::Kind::UInt:
+            return static_cast<double>(n.payload);
+        case details::Kind::Float: {
+            double value;
+            std::memcpy(&value, &n.payload, sizeof(value));
+            return value;
+        }
+        case details::Kind::RawNumber: {
+            const auto str = text();
+            double value = 0;
+            std::from_chars(str.data(), str.data() + str.size(), value);
+            return value;
+        }
+        default:
+            throw std::runtime_error("Type is not Float");
+    }
+}
+
+inline auto Element::raw_number() const -> std::string_view {
+    if (node().kind != details::Kind::RawNumber)
+        throw std::runtime_error("Number was not kept as text");
+    return text();
+}
+
+inline auto Element::raw_string() const -> std::string_view {
+    if (!is_string()) throw std::runtime_error("Type is not String");
+    return text();
+}
+
+inline auto Element::has_escapes() const -> bool {
+    return node().flags & details::ESCAPED;
+}
+
+inline auto Element::get_string(std::string &scratch) const
+    -> std::string_view {
+    const auto raw = raw_string();
+    if (!has_escapes()) return raw;
+    scratch.clear();
+    if (!::eee::details::unescape(raw, scratch))
+        throw std::runtime_error("Invalid escape sequence");
+    return scratch;
+}
+
+inline auto Element::get_string() const -> std::string {
+    std::string scratch;
+    return std::string(get_string(scratch));
+}
+
+inline auto Element::size() const -> size_t {
+    if (!is_array() and !is_object())
+        throw std::runtime_error("Type is not Object or Array");
+    return node().len;
+}
+
+inline auto Element::get_array() const -> ArrayRange {
+    if (!is_array()) throw std::runtime_error("Type is not Array");
+    return {doc_, index_ + 1, next()};
+}
+
+inline auto Element::get_object() const -> ObjectRange {
+    if (!is_object()) throw std::runtime_error("Type is not Object");
+    return {doc_, index_ + 1, next()};
+}
+
+inline auto Element::find(std::string_view key) const
+    -> std::optional<Element> {
+    std::string scratch;
+    for (auto [k, v] : get_object()) {
+        const auto name =
+            k.has_escapes() ? k.get_string(scratch) : k.raw_string();
+        if (name == key) return v;
+    }
+    return std::nullopt;
+}
+
+inline auto Element::operator[](std::string_view key) const -> Element {
+    if (auto ret = find(key)) return *ret;
+    throw std::out_of_range("Key not found");
+}
+
+inline auto Element::operator[](size_t index) const -> Element {
+    if (index >= size()) throw std::out_of_range("Index out of range");
+    auto it = get_array().begin();
+    for (; index > 0; --index) ++it;
+    return *it;
+}
+
+inline auto Element::to_json() const -> Json {
+    switch (type()) {
+        case Type::Null:
+            return Json(nullptr);
+        case Type::Bool:
+            return Json(get_bool());
+        case Type::Int:
+            return Json(get_int());
+        case Type::UInt:
+            return Json(get_uint());
+        case Type::Float:
+            return Json(get_double());
+        case Type::String:
+            return Json(get_string());
+        case Type::Array: {
+            Array arr;
+            arr.reserve(size());
+            for (auto e : get_array()) arr.push_back(e.to_json());
+            return Json(std::move(arr));
+        }
+        case Type::Object: {
+            Object obj;
+            for (auto [k, v] : get_object())
+                obj.emplace(k.get_string(), v.to_json());
+            return Json(std::move(obj));
+        }
+    }
+    return {};
+}
+
+inline auto ArrayRange::begin() const -> iterator { return {doc_, begin_}; }
+inline auto ArrayRange::end() const -> iterator { return {doc_, end_}; }
+
+inline auto ArrayRange::iterator::operator++() -> iterator & {
+    index_ = Element{doc_, index_}.next();
+    return *this;
+}
+
+inline auto ObjectRange::begin() const -> iterator { return {doc_, begin_}; }
+inline auto ObjectRange::end() const -> iterator { return {doc_, end_}; }
+
+inline auto ObjectRange::iterator::operator++() -> iterator & {
+    index_ = Element{doc_, index_ + 1}.next();
+    return *this;
+}
+
+} // namespace eee::dom
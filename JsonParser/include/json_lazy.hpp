@@ -0,0 +1,426 @@
+#pragma once
+#include "json.hpp"
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// On-demand access to a document without parsing it.
+//
+// A LazyValue marks where one value starts in a caller-owned buffer. Lookups
+// walk forward from there and skip the members they do not need by bracket
+// matching, so skipped subtrees are neither built nor validated; only the
+// value that is finally read gets checked. Trailing content after the root
+// value is ignored. The input must outlive every LazyValue taken from it.
+
+namespace eee {
+
+namespace details {
+
+inline auto skip_space(const char *p, const char *last) -> const char * {
+    while (p != last and is_space(*p)) ++p;
+    return p;
+}
+
+// `p` is at an opening quote. Returns one past the closing quote, or nullptr.
+inline auto skip_string(const char *p, const char *last) -> const char * {
+    for (const char *from = p + 1;;) {
+        const auto *q =
+            static_cast<const char *>(std::memchr(from, '"', last - from));
+        if (q == nullptr) return nullptr;
+        // escaped if an odd number of backslashes precede it
+        const char *b = q;
+        while (b != from and b[-1] == '\\') --b;
+        if ((q - b) % 2 == 0) return q + 1;
+        from = q + 1;
+    }
+}
+
+// whether a literal or number may end at `p`
+inline auto ends_scalar(const char *p, const char *last) -> bool {
+    return p == last or is_space(*p) or *p == ',' or *p == ']' or *p == '}';
+}
+
+inline auto skip_value(const char *p, const char *last) -> const char * {
+    if (p == last) return nullptr;
+    switch (*p) {
+        case '"':
+            return skip_string(p, last);
+        case '[':
+        case '{':
+            return find_closing_bracket(p, last);
+        default: {
+            const char *begin = p;
+            while (!ends_scalar(p, last)) ++p;
+            return p == begin ? nullptr : p;
+        }
+    }
+}
+
+// Compares the body of a key literal with `key`.
+inline auto key_equals(std::string_view raw, std::string_view key) -> bool {
+    if (raw.find('\\') == raw.npos) return raw == key;
+    std::string decoded;
+    return unescape(raw, decoded) and decoded == key;
+}
+
+// A JSON Pointer reference token with ~1 and ~0 decoded.
+inline auto pointer_token(std::string_view token) -> std::string {
+    std::string ret;
+    for (size_t i = 0; i < token.size(); ++i) {
+        if (token[i] == '~' and i + 1 < token.size()
+            and (token[i + 1] == '0' or token[i + 1] == '1'))
+            ret += token[++i] == '0' ? '~' : '/';
+        else
+            ret += token[i];
+    }
+    return ret;
+}
+
+// Array index named by a token, or SIZE_MAX if the token is not one.
+inline auto pointer_index(std::string_view token) -> size_t {
+    if (token.empty() or token.size() > 18
+        or (token[0] == '0' and token.size() > 1))
+        return SIZE_MAX;
+    size_t index = 0;
+    for (char c : token) {
+        if (!is_digit(c)) return SIZE_MAX;
+        index = index * 10 + (c - '0');
+    }
+    return index;
+}
+
+// Calls `f(key_body, value)` for each member of the object at `p` until it
+// returns false. Returns one past the object, or nullptr if the object is
+// malformed or `f` stopped the walk; `p` is left at the stopping point.
+template<typename F>
+auto for_each_member(const char *&p, const char *last, F &&f)
+    -> const char * {
+    p = skip_space(p + 1, last);
+    if (p != last and *p == '}') return p + 1;
+    for (;;) {
+        if (p == last or *p != '"') return nullptr;
+        const char *key_end = skip_string(p, last);
+        if (key_end == nullptr) return nullptr;
+        const std::string_view key(p + 1, key_end - p - 2);
+        p = skip_space(key_end, last);
+        if (p == last or *p != ':') return nullptr;
+        p = skip_space(p + 1, last);
+        if (!f(key, p)) return nullptr;
+        p = skip_space(p, last);
+        if (p == last) return nullptr;
+        if (*p == '}') return p + 1;
+        if (*p != ',') return nullptr;
+        p = skip_space(p + 1, last);
+    }
+}
+
+// As for_each_member, with `f(index, value)` for each array element.
+template<typename F>
+auto for_each_element(const char *&p, const char *last, F &&f)
+    -> const char * {
+    p = skip_space(p + 1, last);
+    if (p != last and *p == ']') return p + 1;
+    for (size_t index = 0;; ++index) {
+        if (!f(index, p)) return nullptr;
+        p = skip_space(p, last);
+        if (p == last) return nullptr;
+        if (*p == ']') return p + 1;
+        if (*p != ',') return nullptr;
+        p = skip_space(p + 1, last);
+    }
+}
+
+} // namespace details
+
+class LazyValue {
+  public:
+    LazyValue(const char *first, const char *last)
+        : first_(first), last_(last) {}
+
+    auto is_null() const -> bool { return peek() == 'n'; }
+    auto is_bool() const -> bool { return peek() == 't' or peek() == 'f'; }
+    auto is_number() const -> bool {
+        return peek() == '-' or details::is_digit(peek());
+    }
+    auto is_string() const -> bool { return peek() == '"'; }
+    auto is_array() const -> bool { return peek() == '['; }
+    auto is_object() const -> bool { return peek() == '{'; }
+
+    // text of the whole value; finds its end by bracket matching
+    auto raw() const -> std::string_view;
+
+    auto get_bool() const -> bool;
+    auto get_int() const -> int64_t;
+    auto get_uint() const -> uint64_t;
+    auto get_double() const -> double;
+    auto get_string(std::string &scratch) const -> std::string_view;
+    auto get_string() const -> std::string;
+
+    // first member named `key`
+    auto find(std::string_view key) const -> std::optional<LazyValue>;
+    auto at(size_t index) const -> std::optional<LazyValue>;
+    // RFC 6901, e.g. "/params/diagnostics/0/range"
+    auto at_pointer(std::string_view pointer) const
+        -> std::optional<LazyValue>;
+
+    // builds this value, validating it
+    auto parse() const -> std::optional<Json> { return eee::parse(raw()); }
+
+  private:
+    auto peek() const -> char { return first_ == last_ ? '\0' : *first_; }
+    auto member(std::string_view key) const -> std::optional<LazyValue>;
+    auto element(size_t index) const -> std::optional<LazyValue>;
+    auto number() const -> std::optional<Value>;
+
+    const char *first_; // first character of the value
+    const char *last_;  // end of the input
+};
+
+inline auto lazy(std::string_view input) -> LazyValue {
+    const char *last = input.data() + input.size();
+    return {details::skip_space(input.data(), last), last};
+}
+
+inline auto LazyValue::raw() const -> std::string_view {
+    const char *end = details::skip_value(first_, last_);
+    if (end == nullptr) throw std::runtime_error("Malformed value");
+    return {first_, size_t(end - first_)};
+}
+
+inline auto LazyValue::number() const -> std::optional<Value> {
+    if (!is_number()) return std::nullopt;
+    bool is_float = false;
+    const char *end = details::scan_number(first_, last_, is_float);
+    if (end == nullptr or !details::ends_scalar(end, last_))
+        return std::nullopt;
+    return details::to_number(first_, end, is_float);
+}
+
+inline auto LazyValue::get_bool() const -> bool {
+    const auto text = std::string_view(first_, last_ - first_);
+    if (text.starts_with("true") and details::ends_scalar(first_ + 4, last_))
+        return true;
+    if (text.starts_with("false") and details::ends_scalar(first_ + 5, last_))
+        return false;
+    throw std::runtime_error("Type is not Bool");
+}
+
+inline auto LazyValue::get_int() const -> int64_t {
+    const auto value = number();
+    if (auto *i = value ? std::get_if<Int>(&*value) : nullptr) return *i;
+    throw std::runtime_error("Type is not Int");
+}
+
+inline auto LazyValue::get_uint() const -> uint64_t {
+    const auto value = number();
+    if (auto *u = value ? std::get_if<UInt>(&*value) : nullptr) return *u;
+    if (auto *i = value ? std::get_if<Int>(&*value) : nullptr; i and *i >= 0)
+        return static_cast<uint64_t>(*i);
+    throw std::runtime_error("Type is not UInt");
+}
+
+inline auto LazyValue::get_double() const -> double {
+    const auto value = number();
+    if (!value) throw std::runtime_error("Type is not Float");
+    return std::visit(
+        [](auto arg) -> double {
+            if constexpr (std::is_arithmetic_v<decltype(arg)>)
+                return static_cast<double>(arg);
+            else
+                return 0;
+        },
+        *value);
+}
+
+inline auto LazyValue::get_string(std::string &scratch) const
+    -> std::string_view {
+    const char *end = is_string() ? details::skip_string(first_, last_)
+                                  : nullptr;
+    if (end == nullptr) throw std::runtime_error("Type is not String");
+    const std::string_view raw(first_ + 1, end - first_ - 2);
+    if (raw.find('\\') == raw.npos) return raw;
+    scratch.clear();
+    if (!details::unescape(raw, scratch))
+        throw std::runtime_error("Invalid escape sequence");
+    return scratch;
+}
+
+inline auto LazyValue::get_string() const -> std::string {
+    std::string scratch;
+    return std::string(get_string(scratch));
+}
+
+inline auto LazyValue::member(std::string_view key) const
+    -> std::optional<LazyValue> {
+    std::optional<LazyValue> ret;
+    const char *p = first_;
+    details::for_each_member(
+        p, last_, [&](std::string_view name, const char *&value) {
+            if (details::key_equals(name, key)) {
+                ret.emplace(value, last_);
+                return false;
+            }
+            return (value = details::skip_value(value, last_)) != nullptr;
+        });
+    return ret;
+}
+
+inline auto LazyValue::element(size_t index) const
+    -> std::optional<LazyValue> {
+    std::optional<LazyValue> ret;
+    const char *p = first_;
+    details::for_each_element(p, last_, [&](size_t i, const char *&value) {
+        if (i == index) {
+            ret.emplace(value, last_);
+            return false;
+        }
+        return (value = details::skip_value(value, last_)) != nullptr;
+    });
+    return ret;
+}
+
+inline auto LazyValue::find(std::string_view key) const
+    -> std::optional<LazyValue> {
+    if (!is_object()) throw std::runtime_error("Type is not Object");
+    return member(key);
+}
+
+inline auto LazyValue::at(size_t index) const -> std::optional<LazyValue> {
+    if (!is_array()) throw std::runtime_error("Type is not Array");
+    return element(index);
+}
+
+inline auto LazyValue::at_pointer(std::string_view pointer) const
+    -> std::optional<LazyValue> {
+    if (!pointer.empty() and pointer[0] != '/') return std::nullopt;
+    std::optional<LazyValue> cur = *this;
+    while (cur and !pointer.empty()) {
+        const size_t end = pointer.find('/', 1);
+        const auto token = pointer.substr(1, end - 1);
+        if (cur->is_object())
+            cur = cur->member(details::pointer_token(token));
+        else if (cur->is_array())
+            cur = cur->element(details::pointer_index(token));
+        else
+            return std::nullopt;
+        pointer = end == pointer.npos ? "" : pointer.substr(end);
+    }
+    return cur;
+}
+
+// Pulls a fixed set of JSON Pointers out of documents in one forward pass.
+// The pointers are compiled into a trie; subtrees no pointer goes through
+// are skipped, and the walk stops once every pointer has been found.
+class Extractor {
+  public:
+    Extractor(std::initializer_list<std::string_view> pointers)
+        : Extractor(std::vector<std::string_view>(pointers)) {}
+    explicit Extractor(const std::vector<std::string_view> &pointers)
+        : nodes_(1), count_(pointers.size()) {
+        for (size_t i = 0; i < pointers.size(); ++i) add(pointers[i], i);
+    }
+
+    auto size() const -> size_t { return count_; }
+
+    // out[i] holds the value of the i-th pointer, if the document has it
+    auto extract(std::string_view input,
+                 std::vector<std::optional<LazyValue>> &out) const -> void {
+        out.assign(count_, std::nullopt);
+        const char *last = input.data() + input.size();
+        size_t remaining = count_;
+        walk(details::skip_space(input.data(), last), last, 0, out, remaining);
+    }
+
+    auto extract(std::string_view input) const
+        -> std::vector<std::optional<LazyValue>> {
+        std::vector<std::optional<LazyValue>> out;
+        extract(input, out);
+        return out;
+    }
+
+  private:
+    struct Edge {
+        std::string key;
+        size_t index; // SIZE_MAX if `key` cannot name an array element
+        uint32_t node;
+    };
+    struct Node {
+        std::vector<uint32_t> targets; // pointers that end here
+        std::vector<Edge> children;
+    };
+
+    auto add(std::string_view pointer, size_t target) -> void {
+        if (!pointer.empty() and pointer[0] != '/')
+            throw std::invalid_argument("JSON Pointer must start with '/'");
+        uint32_t node = 0;
+        while (!pointer.empty()) {
+            const size_t end = pointer.find('/', 1);
+            auto key = details::pointer_token(pointer.substr(1, end - 1));
+            pointer = end == pointer.npos ? "" : pointer.substr(end);
+            auto &children = nodes_[node].children;
+            auto it = std::find_if(
+                children.begin(), children.end(),
+                [&key](const Edge &e) { return e.key == key; });
+            if (it != children.end()) {
+                node = it->node;
+                continue;
+            }
+            const auto next = static_cast<uint32_t>(nodes_.size());
+            const size_t index = details::pointer_index(key);
+            children.push_back({std::move(key), index, next});
+            nodes_.emplace_back();
+            node = next;
+        }
+        nodes_[node].targets.push_back(static_cast<uint32_t>(target));
+    }
+
+    // Returns one past the value at `p`, or nullptr once the walk is over.
+    auto walk(const char *p, const char *last, uint32_t node,
+              std::vector<std::optional<LazyValue>> &out,
+              size_t &remaining) const -> const char * {
+        const Node &n = nodes_[node];
+        for (uint32_t target : n.targets) {
+            // a repeated key keeps its first value
+            if (out[target]) continue;
+            out[target].emplace(p, last);
+            --remaining;
+        }
+        if (remaining == 0) return nullptr;
+        if (n.children.empty() or p == last)
+            return details::skip_value(p, last);
+        auto descend = [&](const Edge *edge, const char *&value) {
+            value = edge ? walk(value, last, edge->node, out, remaining)
+                         : details::skip_value(value, last);
+            return value != nullptr;
+        };
+        if (*p == '{') {
+            return details::for_each_member(
+                p, last, [&](std::string_view key, const char *&value) {
+                    const Edge *edge = nullptr;
+                    for (const auto &e : n.children)
+                        if (details::key_equals(key, e.key)) edge = &e;
+                    return descend(edge, value);
+                });
+        }
+        if (*p == '[') {
+            return details::for_each_element(
+                p, last, [&](size_t index, const char *&value) {
+                    const Edge *edge = nullptr;
+                    for (const auto &e : n.children)
+                        if (e.index == index) edge = &e;
+                    return descend(edge, value);
+                });
+        }
+        return details::skip_value(p, last);
+    }
+
+    std::vector<Node> nodes_;
+    size_t count_;
+};
+
+} // namespace eee
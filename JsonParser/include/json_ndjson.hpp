@@ -0,0 +1,233 @@
+#pragma once
+#include "json.hpp"
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if __has_include(<sys/mman.h>) and __has_include(<fcntl.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define EEE_JSON_MMAP 1
+#endif
+
+// Parallel parsing of newline-delimited JSON (NDJSON / JSON Lines).
+//
+// The input is cut into batches of whole lines, and each batch is parsed by
+// one task on a thread pool. `Pool` only needs submit(f), as ctp::ThreadPool
+// provides. Records are handed to the callback on the calling thread, so the
+// callback needs no locking. At most max_in_flight batches are parsed or
+// waiting for delivery at any time.
+
+namespace eee {
+
+struct NdjsonOptions {
+    bool ordered = true;          // deliver records in input order
+    size_t batch_size = 1 << 20;  // bytes of input per task
+    size_t max_in_flight = 8;     // batches submitted but not yet delivered
+};
+
+namespace details {
+
+// Submits batches to the pool and delivers their records through
+// callback(offset, record): `offset` is the byte offset of the line in the
+// input, `record` is nullopt if the line is not valid JSON. Blank lines are
+// skipped.
+template<typename Pool, typename Callback>
+class NdjsonPipeline {
+  public:
+    NdjsonPipeline(Pool &pool, Callback &callback, const NdjsonOptions &options)
+        : pool_(pool), callback_(callback), options_(options) {
+        if (options_.max_in_flight == 0) options_.max_in_flight = 1;
+    }
+    NdjsonPipeline(const NdjsonPipeline &other) = delete;
+    auto operator=(const NdjsonPipeline &other) -> NdjsonPipeline & = delete;
+    // tasks refer to this object, so wait for them even when unwinding
+    ~NdjsonPipeline() {
+        std::unique_lock lock(mutex_);
+        ready_.wait(lock, [this] { return completed_ == submitted_; });
+    }
+
+    // Queues `text`, which must consist of whole lines starting at `offset`.
+    // `owned`, if set, keeps the text alive until the batch is delivered.
+    auto submit(
+        std::string_view text, size_t offset,
+        std::shared_ptr<const std::string> owned = {}) -> void {
+        while (in_flight_ >= options_.max_in_flight) deliver_one();
+        auto batch = std::make_shared<Batch>();
+        batch->id = submitted_++;
+        batch->offset = offset;
+        batch->text = text;
+        batch->owned = std::move(owned);
+        ++in_flight_;
+        pool_.submit([this, batch] { run(batch); });
+    }
+
+    // Splits `input` into batches of about batch_size bytes.
+    auto submit_lines(
+        std::string_view input, size_t offset,
+        std::shared_ptr<const std::string> owned = {}) -> void {
+        while (!input.empty()) {
+            size_t end = std::min(options_.batch_size, input.size());
+            if (end < input.size()) {
+                const void *nl = std::memchr(
+                    input.data() + end, '\n', input.size() - end);
+                end = nl ? static_cast<const char *>(nl) - input.data() + 1
+                         : input.size();
+            }
+            submit(input.substr(0, end), offset, owned);
+            input.remove_prefix(end);
+            offset += end;
+        }
+    }
+
+    auto finish() -> void {
+        while (in_flight_ > 0) deliver_one();
+    }
+
+  private:
+    struct Batch {
+        size_t id;
+        size_t offset;
+        std::string_view text;
+        std::shared_ptr<const std::string> owned;
+        std::vector<std::pair<size_t, std::optional<Json>>> records;
+        std::exception_ptr error;
+    };
+
+    auto run(const std::shared_ptr<Batch> &batch) -> void {
+        try {
+            JsonParser parser;
+            std::string_view text = batch->text;
+            for (size_t pos = 0; pos < text.size();) {
+                size_t end = text.find('\n', pos);
+                if (end == text.npos) end = text.size();
+                auto line = text.substr(pos, end - pos);
+                if (!line.empty() and line.back() == '\r')
+                    line.remove_suffix(1);
+                if (line.find_first_not_of(" \t") != line.npos)
+                    batch->records.emplace_back(
+                        batch->offset + pos, parser.parse(line));
+                pos = end + 1;
+            }
+        } catch (...) {
+            batch->error = std::current_exception();
+        }
+        std::unique_lock lock(mutex_);
+        done_.emplace(batch->id, batch);
+        ++completed_;
+        ready_.notify_all();
+    }
+
+    auto deliver_one() -> void {
+        std::shared_ptr<Batch> batch;
+        {
+            std::unique_lock lock(mutex_);
+            ready_.wait(lock, [this] {
+                return options_.ordered ? done_.count(next_) != 0
+                                        : !done_.empty();
+            });
+            auto it = options_.ordered ? done_.find(next_) : done_.begin();
+            batch = std::move(it->second);
+            done_.erase(it);
+        }
+        ++next_;
+        --in_flight_;
+        if (batch->error) std::rethrow_exception(batch->error);
+        for (auto &[offset, record] : batch->records)
+            callback_(offset, std::move(record));
+    }
+
+    Pool &pool_;
+    Callback &callback_;
+    NdjsonOptions options_;
+    size_t in_flight_ = 0;
+    size_t next_ = 0; // next batch id to deliver when ordered
+
+    std::mutex mutex_; // guards the members below
+    std::condition_variable ready_;
+    std::map<size_t, std::shared_ptr<Batch>> done_;
+    size_t submitted_ = 0;
+    size_t completed_ = 0;
+};
+
+} // namespace details
+
+// Parses every line of `input` on `pool` and calls
+// callback(size_t offset, std::optional<Json> record) on this thread.
+template<typename Pool, typename Callback>
+auto parse_ndjson(
+    std::string_view input, Pool &pool, Callback &&callback,
+    const NdjsonOptions &options = {}) -> void {
+    details::NdjsonPipeline<Pool, Callback> pipeline{pool, callback, options};
+    pipeline.submit_lines(input, 0);
+    pipeline.finish();
+}
+
+// As parse_ndjson, reading the file at `path`: mapped into memory where
+// mmap is available, otherwise read in blocks of batch_size bytes. Returns
+// false if the file cannot be opened.
+template<typename Pool, typename Callback>
+auto parse_ndjson_file(
+    const std::string &path, Pool &pool, Callback &&callback,
+    const NdjsonOptions &options = {}) -> bool {
+#ifdef EEE_JSON_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    if (size == 0) {
+        ::close(fd);
+        return true;
+    }
+    void *data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return false;
+    ::madvise(data, size, MADV_SEQUENTIAL);
+    struct Unmap {
+        void *data;
+        size_t size;
+        ~Unmap() { ::munmap(data, size); }
+    } unmap{data, size};
+    parse_ndjson(
+        std::string_view(static_cast<const char *>(data), size), pool,
+        callback, options);
+    return true;
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    details::NdjsonPipeline<Pool, Callback> pipeline{pool, callback, options};
+    std::string carry; // a partial last line
+    size_t offset = 0;
+    while (in) {
+        auto block = std::make_shared<std::string>(std::move(carry));
+        const size_t have = block->size();
+        block->resize(have + std::max<size_t>(options.batch_size, 1));
+        in.read(block->data() + have, block->size() - have);
+        block->resize(have + static_cast<size_t>(in.gcount()));
+        const size_t cut = in ? block->rfind('\n') + 1 : block->size();
+        carry.assign(*block, cut);
+        block->resize(cut);
+        pipeline.submit(*block, offset, block);
+        offset += cut;
+    }
+    pipeline.finish();
+    return true;
+#endif
+}
+
+} // namespace eee
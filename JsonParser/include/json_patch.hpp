@@ -0,0 +1,624 @@
+#pragma once
+#include "json.hpp"
+#include "json_lazy.hpp"
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// In-place updates: JSON Patch (RFC 6902) and JSON Merge Patch (RFC 7396).
+//
+// Both edit the target tree where it stands. Values taken from a patch
+// passed as an rvalue are moved in, and values that an operation moves or
+// removes are moved out, so no subtree is rebuilt. apply_patch is atomic:
+// if any operation fails, the ones already applied are undone in reverse.
+//
+// TrackedJson keeps a tree together with its generated text and regenerates
+// only the branches a patch touched; untouched branches are copied from the
+// previous text.
+
+namespace eee {
+
+namespace details {
+
+using PointerTokens = std::vector<std::string>;
+
+// Splits a JSON Pointer into unescaped tokens; "" names the root.
+inline auto split_pointer(std::string_view pointer, PointerTokens &tokens)
+    -> bool {
+    tokens.clear();
+    if (pointer.empty()) return true;
+    if (pointer[0] != '/') return false;
+    while (!pointer.empty()) {
+        const size_t end = pointer.find('/', 1);
+        tokens.push_back(pointer_token(pointer.substr(1, end - 1)));
+        pointer.remove_prefix(end == pointer.npos ? pointer.size() : end);
+    }
+    return true;
+}
+
+// RFC 6902 equality: numbers compare by value, objects ignore member order.
+template<typename Allocator>
+auto json_equal(const BasicJson<Allocator> &a, const BasicJson<Allocator> &b)
+    -> bool {
+    using J = BasicJson<Allocator>;
+    const auto as_number = [](const J &j, Float &out) {
+        if (auto *i = std::get_if<Int>(&j.value_)) out = Float(*i);
+        else if (auto *u = std::get_if<UInt>(&j.value_)) out = Float(*u);
+        else if (auto *f = std::get_if<Float>(&j.value_)) out = *f;
+        else return false;
+        return true;
+    };
+    if (a.value_.index() != b.value_.index()) {
+        Float x, y;
+        if (!as_number(a, x) or !as_number(b, y)) return false;
+        auto *i = std::get_if<Int>(&a.value_);
+        auto *u = std::get_if<UInt>(&b.value_);
+        if (i == nullptr) i = std::get_if<Int>(&b.value_);
+        if (u == nullptr) u = std::get_if<UInt>(&a.value_);
+        if (i != nullptr and u != nullptr) return *i >= 0 and UInt(*i) == *u;
+        return x == y;
+    }
+    if (auto *arr = std::get_if<typename J::Array>(&a.value_)) {
+        const auto &other = std::get<typename J::Array>(b.value_);
+        return std::equal(
+            arr->begin(), arr->end(), other.begin(), other.end(),
+            json_equal<Allocator>);
+    }
+    if (auto *obj = std::get_if<typename J::Object>(&a.value_)) {
+        const auto &other = std::get<typename J::Object>(b.value_);
+        return std::equal(
+            obj->begin(), obj->end(), other.begin(), other.end(),
+            [](const auto &x, const auto &y) {
+                return x.first == y.first and json_equal(x.second, y.second);
+            });
+    }
+    return std::visit(
+        [&b](const auto &x) {
+            using T = std::decay_t<decltype(x)>;
+            if constexpr (
+                std::is_same_v<T, typename J::Array>
+                or std::is_same_v<T, typename J::Object>)
+                return false; // handled above
+            else
+                return x == std::get<T>(b.value_);
+        },
+        a.value_);
+}
+
+// Observer of a Patcher that ignores every change.
+struct NoPatchObserver {
+    static constexpr bool kTracksPositions = false;
+    auto inserted(const PointerTokens &, size_t) -> void {}
+    auto erasing(const PointerTokens &, size_t) -> void {}
+    auto replaced(const PointerTokens &, size_t) -> void {}
+};
+
+// Applies patches to `root_` through three primitives (insert, erase,
+// replace) and reports each one to the observer with the path of the child
+// and its position among its siblings, in map order for objects. Positions
+// are only worked out for observers with kTracksPositions.
+template<typename J, typename Observer>
+class Patcher {
+  public:
+    Patcher(J &root, Observer &observer) : root_(root), observer_(observer) {}
+
+    // `patch` is an array of operations. With `movable`, values are moved
+    // out of it.
+    auto apply(const J &patch, bool movable) -> bool {
+        auto *ops = std::get_if<Array>(&patch.value_);
+        if (ops == nullptr) return false;
+        undo_.clear();
+        for (const J &op : *ops) {
+            if (!run(op, movable)) {
+                rollback();
+                return false;
+            }
+        }
+        undo_.clear();
+        return true;
+    }
+
+    auto merge(const J &patch, bool movable) -> void {
+        path_.clear();
+        merge_at(patch, movable);
+    }
+
+  private:
+    using String = typename J::String;
+    using Array = typename J::Array;
+    using Object = typename J::Object;
+
+    // How to revert one applied operation.
+    struct Undo {
+        enum Kind { ERASE, INSERT, REPLACE, MOVE } kind;
+        PointerTokens path;
+        PointerTokens from;     // MOVE: where the value came from
+        std::optional<J> value; // INSERT, REPLACE: the old value; MOVE: the
+                                // member the move displaced, if any
+    };
+
+    // the value `n` tokens of `path` lead to
+    auto resolve(const PointerTokens &path, size_t n) const -> J * {
+        J *cur = &root_;
+        for (size_t i = 0; i < n and cur != nullptr; ++i)
+            cur = child(*cur, path[i]);
+        return cur;
+    }
+
+    static auto child(J &parent, const std::string &token) -> J * {
+        if (auto *obj = std::get_if<Object>(&parent.value_)) {
+            auto it = obj->find(String(token.begin(), token.end()));
+            return it == obj->end() ? nullptr : &it->second;
+        }
+        if (auto *arr = std::get_if<Array>(&parent.value_)) {
+            const size_t index = pointer_index(token);
+            return index < arr->size() ? &(*arr)[index] : nullptr;
+        }
+        return nullptr;
+    }
+
+    static auto position(const Object &obj, typename Object::const_iterator it)
+        -> size_t {
+        if constexpr (Observer::kTracksPositions)
+            return std::distance(obj.begin(), it);
+        else
+            return 0;
+    }
+
+    // Adds `value` as the child of its parent named by path.back(); "-"
+    // appends to an array and is rewritten to the index used. An existing
+    // member is replaced and handed back in `displaced`.
+    auto insert(PointerTokens &path, J &&value, std::optional<J> &displaced)
+        -> bool {
+        J *parent = resolve(path, path.size() - 1);
+        if (parent == nullptr) return false;
+        if (auto *arr = std::get_if<Array>(&parent->value_)) {
+            const size_t index = path.back() == "-"
+                                     ? arr->size()
+                                     : pointer_index(path.back());
+            if (index > arr->size()) return false;
+            arr->insert(arr->begin() + index, std::move(value));
+            path.back() = std::to_string(index);
+            observer_.inserted(path, index);
+            return true;
+        }
+        auto *obj = std::get_if<Object>(&parent->value_);
+        if (obj == nullptr) return false;
+        auto [it, fresh] = obj->try_emplace(
+            String(path.back().begin(), path.back().end()));
+        if (!fresh) displaced.emplace(std::move(it->second));
+        it->second = std::move(value);
+        if (fresh) observer_.inserted(path, position(*obj, it));
+        else observer_.replaced(path, position(*obj, it));
+        return true;
+    }
+
+    auto erase(const PointerTokens &path, std::optional<J> &removed) -> bool {
+        if (path.empty()) return false;
+        J *parent = resolve(path, path.size() - 1);
+        if (parent == nullptr) return false;
+        if (auto *arr = std::get_if<Array>(&parent->value_)) {
+            const size_t index = pointer_index(path.back());
+            if (index >= arr->size()) return false;
+            observer_.erasing(path, index);
+            removed.emplace(std::move((*arr)[index]));
+            arr->erase(arr->begin() + index);
+            return true;
+        }
+        auto *obj = std::get_if<Object>(&parent->value_);
+        if (obj == nullptr) return false;
+        auto it = obj->find(String(path.back().begin(), path.back().end()));
+        if (it == obj->end()) return false;
+        observer_.erasing(path, position(*obj, it));
+        removed.emplace(std::move(it->second));
+        obj->erase(it);
+        return true;
+    }
+
+    // Swaps `value` into an existing value; `value` then holds the old one.
+    auto replace(const PointerTokens &path, J &value) -> bool {
+        if (path.empty()) {
+            observer_.replaced(path, 0);
+            root_.swap(value);
+            return true;
+        }
+        J *parent = resolve(path, path.size() - 1);
+        if (parent == nullptr) return false;
+        if (auto *arr = std::get_if<Array>(&parent->value_)) {
+            const size_t index = pointer_index(path.back());
+            if (index >= arr->size()) return false;
+            observer_.replaced(path, index);
+            (*arr)[index].swap(value);
+            return true;
+        }
+        auto *obj = std::get_if<Object>(&parent->value_);
+        if (obj == nullptr) return false;
+        auto it = obj->find(String(path.back().begin(), path.back().end()));
+        if (it == obj->end()) return false;
+        observer_.replaced(path, position(*obj, it));
+        it->second.swap(value);
+        return true;
+    }
+
+    // add, and the second half of copy
+    auto add(PointerTokens &path, J &&value) -> bool {
+        if (path.empty()) {
+            replace(path, value);
+            undo_.push_back({Undo::REPLACE, {}, {}, std::move(value)});
+            return true;
+        }
+        std::optional<J> displaced;
+        if (!insert(path, std::move(value), displaced)) return false;
+        if (displaced.has_value())
+            undo_.push_back({Undo::REPLACE, path, {}, std::move(displaced)});
+        else
+            undo_.push_back({Undo::ERASE, path, {}, std::nullopt});
+        return true;
+    }
+
+    auto run(const J &op, bool movable) -> bool {
+        auto *obj = std::get_if<Object>(&op.value_);
+        if (obj == nullptr) return false;
+        const auto member = [obj](const char *key) -> const J * {
+            auto it = obj->find(key);
+            return it == obj->end() ? nullptr : &it->second;
+        };
+        const auto pointer = [&member](const char *key, PointerTokens &out) {
+            const J *str = member(key);
+            auto *s = str ? std::get_if<String>(&str->value_) : nullptr;
+            return s != nullptr and split_pointer(*s, out);
+        };
+        const J *name = member("op");
+        auto *kind = name ? std::get_if<String>(&name->value_) : nullptr;
+        PointerTokens path, from;
+        if (kind == nullptr or !pointer("path", path)) return false;
+        const J *value = member("value");
+        const auto take = [movable](const J &v) -> J {
+            return movable ? std::move(const_cast<J &>(v)) : v;
+        };
+
+        if (*kind == "add") {
+            return value != nullptr and add(path, take(*value));
+        } else if (*kind == "remove") {
+            std::optional<J> removed;
+            if (!erase(path, removed)) return false;
+            undo_.push_back({Undo::INSERT, path, {}, std::move(removed)});
+            return true;
+        } else if (*kind == "replace") {
+            if (value == nullptr) return false;
+            J old = take(*value);
+            if (!replace(path, old)) return false;
+            undo_.push_back({Undo::REPLACE, path, {}, std::move(old)});
+            return true;
+        } else if (*kind == "move") {
+            if (!pointer("from", from)) return false;
+            if (from == path) return true;
+            // a value cannot be moved into itself
+            if (from.size() < path.size()
+                and std::equal(from.begin(), from.end(), path.begin()))
+                return false;
+            std::optional<J> moved, displaced;
+            if (!erase(from, moved)) return false;
+            if (path.empty()) {
+                displaced.emplace(std::move(*moved));
+                replace(path, *displaced);
+            } else if (!insert(path, std::move(*moved), displaced)) {
+                insert(from, std::move(*moved), displaced);
+                return false;
+            }
+            undo_.push_back(
+                {Undo::MOVE, std::move(path), std::move(from),
+                 std::move(displaced)});
+            return true;
+        } else if (*kind == "copy") {
+            if (!pointer("from", from)) return false;
+            const J *source = resolve(from, from.size());
+            return source != nullptr and add(path, J(*source));
+        } else if (*kind == "test") {
+            const J *target = resolve(path, path.size());
+            return value != nullptr and target != nullptr
+                   and json_equal(*target, *value);
+        }
+        return false;
+    }
+
+    auto rollback() -> void {
+        std::optional<J> scratch;
+        for (auto it = undo_.rbegin(); it != undo_.rend(); ++it) {
+            Undo &undo = *it;
+            scratch.reset();
+            switch (undo.kind) {
+                case Undo::ERASE:
+                    erase(undo.path, scratch);
+                    break;
+                case Undo::INSERT:
+                    insert(undo.path, std::move(*undo.value), scratch);
+                    break;
+                case Undo::REPLACE:
+                    replace(undo.path, *undo.value);
+                    break;
+                case Undo::MOVE: {
+                    // take the value back out of `path`, restoring what it
+                    // displaced, and put it back where it came from
+                    std::optional<J> moved;
+                    if (undo.value.has_value()) {
+                        replace(undo.path, *undo.value);
+                        moved = std::move(undo.value);
+                    } else {
+                        erase(undo.path, moved);
+                    }
+                    if (undo.from.empty()) replace(undo.from, *moved);
+                    else insert(undo.from, std::move(*moved), scratch);
+                    break;
+                }
+            }
+        }
+        undo_.clear();
+    }
+
+    // RFC 7396 MergePatch(value at path_, patch)
+    auto merge_at(const J &patch, bool movable) -> void {
+        auto *members = std::get_if<Object>(&patch.value_);
+        if (members == nullptr) {
+            J value = movable ? std::move(const_cast<J &>(patch)) : patch;
+            set(std::move(value));
+            return;
+        }
+        const J *target = resolve(path_, path_.size());
+        if (!std::holds_alternative<Object>(target->value_)) set(J(Object()));
+        for (const auto &[key, value] : *members) {
+            path_.emplace_back(key.begin(), key.end());
+            std::optional<J> scratch;
+            if (std::holds_alternative<Null>(value.value_)) {
+                erase(path_, scratch);
+            } else if (std::holds_alternative<Object>(value.value_)) {
+                if (resolve(path_, path_.size()) == nullptr)
+                    insert(path_, J(Object()), scratch);
+                merge_at(value, movable);
+            } else {
+                J v = movable ? std::move(const_cast<J &>(value)) : value;
+                insert(path_, std::move(v), scratch);
+            }
+            path_.pop_back();
+        }
+    }
+
+    // replaces the value at path_
+    auto set(J &&value) -> void {
+        if (path_.empty()) {
+            replace(path_, value);
+            return;
+        }
+        std::optional<J> displaced;
+        insert(path_, std::move(value), displaced);
+    }
+
+    J &root_;
+    Observer &observer_;
+    std::vector<Undo> undo_;
+    PointerTokens path_; // merge_at: the value being merged into
+};
+
+} // namespace details
+
+// Applies a JSON Patch (RFC 6902) to `doc` in place. Returns false, leaving
+// `doc` as it was, if the patch is malformed or any operation fails.
+template<typename Allocator>
+auto apply_patch(BasicJson<Allocator> &doc, const BasicJson<Allocator> &patch)
+    -> bool {
+    details::NoPatchObserver observer;
+    return details::Patcher{doc, observer}.apply(patch, false);
+}
+
+// As above, moving values out of `patch` instead of copying them.
+template<typename Allocator>
+auto apply_patch(BasicJson<Allocator> &doc, BasicJson<Allocator> &&patch)
+    -> bool {
+    details::NoPatchObserver observer;
+    return details::Patcher{doc, observer}.apply(patch, true);
+}
+
+// Applies a JSON Merge Patch (RFC 7396) to `doc` in place.
+template<typename Allocator>
+auto merge_patch(BasicJson<Allocator> &doc, const BasicJson<Allocator> &patch)
+    -> void {
+    details::NoPatchObserver observer;
+    details::Patcher{doc, observer}.merge(patch, false);
+}
+
+template<typename Allocator>
+auto merge_patch(BasicJson<Allocator> &doc, BasicJson<Allocator> &&patch)
+    -> void {
+    details::NoPatchObserver observer;
+    details::Patcher{doc, observer}.merge(patch, true);
+}
+
+// A Json tree and its compact text, regenerated incrementally.
+//
+// Every value has a cache entry holding where its text sits inside its
+// parent's text and whether that text is still current. Edits mark the path
+// from the root to the edited value stale; generate() then writes stale
+// values afresh and copies current ones out of the previous text, so its
+// cost is the size of the change plus a copy of the unchanged bytes.
+class TrackedJson {
+  public:
+    TrackedJson() = default;
+    explicit TrackedJson(Json root) : root_(std::move(root)) {}
+
+    auto root() const -> const Json & { return root_; }
+
+    auto apply_patch(const Json &patch) -> bool {
+        return details::Patcher{root_, *this}.apply(patch, false);
+    }
+    auto apply_patch(Json &&patch) -> bool {
+        return details::Patcher{root_, *this}.apply(patch, true);
+    }
+    auto merge_patch(const Json &patch) -> void {
+        details::Patcher{root_, *this}.merge(patch, false);
+    }
+    auto merge_patch(Json &&patch) -> void {
+        details::Patcher{root_, *this}.merge(patch, true);
+    }
+
+    // The value at `pointer` for editing in place, or nullptr. Its cached
+    // text is dropped, so the edit must be made before the next generate().
+    auto edit(std::string_view pointer) -> Json * {
+        details::PointerTokens path;
+        if (!details::split_pointer(pointer, path)) return nullptr;
+        Json *value = &root_;
+        Cache *cache = &cache_;
+        cache->current = false;
+        for (const std::string &token : path) {
+            size_t index;
+            Json *next = child(*value, token, index);
+            if (next == nullptr) return nullptr;
+            if (cache != nullptr) {
+                cache = synced(*cache, *value, 0) ? &cache->children[index]
+                                                  : nullptr;
+                if (cache != nullptr) cache->current = false;
+            }
+            value = next;
+        }
+        if (cache != nullptr) *cache = Cache{};
+        return value;
+    }
+
+    // The compact text of root(), as generate(root()) would give.
+    auto generate() -> const std::string & {
+        if (cache_.current) return text_;
+        std::string next;
+        next.reserve(text_.size() + text_.size() / 8);
+        write(cache_, root_, 0, next);
+        text_.swap(next);
+        return text_;
+    }
+
+    // Patcher observer: keeps the caches in step with the tree.
+    static constexpr bool kTracksPositions = true;
+    auto inserted(const details::PointerTokens &path, size_t pos) -> void {
+        if (Cache *parent = stale_parent(path, 1))
+            parent->children.insert(parent->children.begin() + pos, Cache{});
+    }
+    auto erasing(const details::PointerTokens &path, size_t pos) -> void {
+        if (Cache *parent = stale_parent(path, 0))
+            parent->children.erase(parent->children.begin() + pos);
+    }
+    auto replaced(const details::PointerTokens &path, size_t pos) -> void {
+        if (path.empty()) cache_ = Cache{};
+        else if (Cache *parent = stale_parent(path, 0))
+            parent->children[pos] = Cache{};
+    }
+
+  private:
+    struct Cache {
+        size_t offset = 0; // of the text within the parent's text
+        size_t size = 0;
+        bool current = false;
+        std::vector<Cache> children; // one per element or member, in order
+    };
+
+    // the child named by `token`, with its position among its siblings
+    static auto child(Json &parent, const std::string &token, size_t &index)
+        -> Json * {
+        if (auto *obj = std::get_if<Object>(&parent.value_)) {
+            auto it = obj->find(String(token));
+            index = std::distance(obj->begin(), it);
+            return it == obj->end() ? nullptr : &it->second;
+        }
+        if (auto *arr = std::get_if<Array>(&parent.value_)) {
+            index = details::pointer_index(token);
+            return index < arr->size() ? &(*arr)[index] : nullptr;
+        }
+        return nullptr;
+    }
+
+    // Marks the ancestors of path.back() stale and returns the parent's
+    // cache, or nullptr if it has not been generated yet and so has no
+    // per-child entries to update. `added` is 1 when the child has just
+    // been inserted into the tree.
+    auto stale_parent(const details::PointerTokens &path, size_t added)
+        -> Cache * {
+        Json *value = &root_;
+        Cache *cache = &cache_;
+        cache->current = false;
+        for (size_t i = 0; i + 1 < path.size(); ++i) {
+            if (!synced(*cache, *value, 0)) return nullptr;
+            size_t index;
+            value = child(*value, path[i], index);
+            cache = &cache->children[index];
+            cache->current = false;
+        }
+        if (!synced(*cache, *value, added)) {
+            cache->children.clear();
+            return nullptr;
+        }
+        return cache;
+    }
+
+    // whether `cache` has one entry per child of `value`, counting `added`
+    // children as not yet entered
+    static auto synced(const Cache &cache, const Json &value, size_t added)
+        -> bool {
+        size_t count = 0;
+        if (auto *arr = std::get_if<Array>(&value.value_)) count = arr->size();
+        else if (auto *obj = std::get_if<Object>(&value.value_))
+            count = obj->size();
+        return count != 0 and cache.children.size() + added == count;
+    }
+
+    // Appends the text of `value` to `out`; `old` is where its text started
+    // in text_.
+    auto write(Cache &cache, const Json &value, size_t old, std::string &out)
+        -> void {
+        const size_t start = out.size();
+        if (cache.current) {
+            out.append(text_, old, cache.size);
+            return;
+        }
+        StringSink sink{out};
+        JsonWriter writer{sink};
+        // an entry per child, kept for those whose text is still current
+        const auto write_child = [&](size_t i, const Json &v) {
+            Cache &c = cache.children[i];
+            const size_t child_old = old + c.offset;
+            c.offset = out.size() - start;
+            write(c, v, child_old, out);
+        };
+        if (auto *arr = std::get_if<Array>(&value.value_);
+            arr != nullptr and !arr->empty()) {
+            cache.children.resize(arr->size());
+            out += '[';
+            for (size_t i = 0; i < arr->size(); ++i) {
+                if (i != 0) out += ',';
+                write_child(i, (*arr)[i]);
+            }
+            out += ']';
+        } else if (auto *obj = std::get_if<Object>(&value.value_);
+                   obj != nullptr and !obj->empty()) {
+            cache.children.resize(obj->size());
+            out += '{';
+            size_t i = 0;
+            for (const auto &[key, member] : *obj) {
+                if (i != 0) out += ',';
+                writer.write_string(key);
+                out += ':';
+                write_child(i++, member);
+            }
+            out += '}';
+        } else {
+            cache.children.clear();
+            writer.write(value);
+        }
+        cache.size = out.size() - start;
+        cache.current = true;
+    }
+
+    Json root_;
+    Cache cache_;
+    std::string text_;
+};
+
+} // namespace eee
@@ -0,0 +1,608 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) and (defined(__GNUC__) or defined(__clang__))
+#define EEE_JSON_X86 1
+#include <immintrin.h>
+#endif
+
+// Stage 1 of the parser: classify the input 64 bytes at a time and record
+// the offset of every structural character ({}[]:,), of both quotes of every
+// string and of the first byte of every other scalar. Escaped quotes and
+// anything between the quotes of a string are never recorded, so stage 2
+// walks the index without looking at whitespace or string bodies.
+
+namespace eee::details {
+
+struct BlockMasks {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op; // { } [ ] : ,
+    uint64_t space;
+};
+
+enum CharClass : uint8_t {
+    CC_QUOTE = 1,
+    CC_BACKSLASH = 2,
+    CC_OP = 4,
+    CC_SPACE = 8,
+};
+
+constexpr auto make_char_classes() {
+    struct {
+        uint8_t table[256]{};
+    } ret;
+    ret.table[uint8_t('"')] = CC_QUOTE;
+    ret.table[uint8_t('\\')] = CC_BACKSLASH;
+    for (char c : {'{', '}', '[', ']', ':', ','}) ret.table[uint8_t(c)] = CC_OP;
+    for (char c : {' ', '\t', '\n', '\r'}) ret.table[uint8_t(c)] = CC_SPACE;
+    return ret;
+}
+
+inline constexpr auto char_classes = make_char_classes();
+
+// A kernel classifies `count` consecutive 64-byte blocks at once, so the
+// target-specific code is entered once per batch rather than once per block.
+struct ScalarKernel {
+    static auto classify(const char *blocks, size_t count, BlockMasks *out)
+        -> void {
+        for (size_t b = 0; b < count; ++b, blocks += 64) {
+            BlockMasks m{};
+            for (int i = 0; i < 64; ++i) {
+                const uint8_t cc = char_classes.table[uint8_t(blocks[i])];
+                const uint64_t bit = uint64_t(1) << i;
+                if (cc & CC_QUOTE) m.quote |= bit;
+                if (cc & CC_BACKSLASH) m.backslash |= bit;
+                if (cc & CC_OP) m.op |= bit;
+                if (cc & CC_SPACE) m.space |= bit;
+            }
+            out[b] = m;
+        }
+    }
+};
+
+#ifdef EEE_JSON_X86
+
+// SSE2 is part of x86-64, so this kernel needs no runtime check.
+struct Sse2Kernel {
+    [[gnu::always_inline]] static inline auto mask16(const char *p)
+        -> BlockMasks {
+        const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        auto eq = [&in](char c) { return _mm_cmpeq_epi8(in, _mm_set1_epi8(c)); };
+        // '[' | 0x20 == '{' and ']' | 0x20 == '}'
+        const __m128i lower = _mm_or_si128(in, _mm_set1_epi8(0x20));
+        const __m128i op = _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi8(lower, _mm_set1_epi8('{')),
+                _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+            _mm_or_si128(eq(':'), eq(',')));
+        const __m128i space = _mm_or_si128(
+            _mm_or_si128(eq(' '), eq('\t')), _mm_or_si128(eq('\n'), eq('\r')));
+        return {
+            uint64_t(uint16_t(_mm_movemask_epi8(eq('"')))),
+            uint64_t(uint16_t(_mm_movemask_epi8(eq('\\')))),
+            uint64_t(uint16_t(_mm_movemask_epi8(op))),
+            uint64_t(uint16_t(_mm_movemask_epi8(space)))};
+    }
+
+    static auto classify(const char *blocks, size_t count, BlockMasks *out)
+        -> void {
+        for (size_t b = 0; b < count; ++b, blocks += 64) {
+            BlockMasks m{};
+            for (int i = 0; i < 4; ++i) {
+                const BlockMasks part = mask16(blocks + 16 * i);
+                m.quote |= part.quote << (16 * i);
+                m.backslash |= part.backslash << (16 * i);
+                m.op |= part.op << (16 * i);
+                m.space |= part.space << (16 * i);
+            }
+            out[b] = m;
+        }
+    }
+};
+
+struct Avx2Kernel {
+    [[gnu::always_inline, gnu::target("avx2")]] static inline auto
+    eq(__m256i in, char c) -> __m256i {
+        return _mm256_cmpeq_epi8(in, _mm256_set1_epi8(c));
+    }
+
+    [[gnu::always_inline, gnu::target("avx2")]] static inline auto
+    mask32(const char *p) -> BlockMasks {
+        const __m256i in =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        const __m256i lower = _mm256_or_si256(in, _mm256_set1_epi8(0x20));
+        const __m256i op = _mm256_or_si256(
+            _mm256_or_si256(eq(lower, '{'), eq(lower, '}')),
+            _mm256_or_si256(eq(in, ':'), eq(in, ',')));
+        const __m256i space = _mm256_or_si256(
+            _mm256_or_si256(eq(in, ' '), eq(in, '\t')),
+            _mm256_or_si256(eq(in, '\n'), eq(in, '\r')));
+        return {
+            uint64_t(uint32_t(_mm256_movemask_epi8(eq(in, '"')))),
+            uint64_t(uint32_t(_mm256_movemask_epi8(eq(in, '\\')))),
+            uint64_t(uint32_t(_mm256_movemask_epi8(op))),
+            uint64_t(uint32_t(_mm256_movemask_epi8(space)))};
+    }
+
+    [[gnu::target("avx2")]] static auto
+    classify(const char *blocks, size_t count, BlockMasks *out) -> void {
+        for (size_t b = 0; b < count; ++b, blocks += 64) {
+            const BlockMasks lo = mask32(blocks);
+            const BlockMasks hi = mask32(blocks + 32);
+            out[b] = {
+                lo.quote | hi.quote << 32, lo.backslash | hi.backslash << 32,
+                lo.op | hi.op << 32, lo.space | hi.space << 32};
+        }
+    }
+};
+
+#endif
+
+// Carries state from one 64-byte block to the next.
+class StructuralScanner {
+  public:
+    static auto prefix_xor(uint64_t x) -> uint64_t {
+        x ^= x << 1;
+        x ^= x << 2;
+        x ^= x << 4;
+        x ^= x << 8;
+        x ^= x << 16;
+        x ^= x << 32;
+        return x;
+    }
+
+    // Returns the bits of the characters escaped by a backslash.
+    auto find_escaped(uint64_t backslash) -> uint64_t {
+        if (backslash == 0 and prev_escaped_ == 0) return 0;
+        uint64_t escaped = prev_escaped_;
+        // a backslash that is itself escaped does not start an escape
+        uint64_t starts = backslash & ~prev_escaped_;
+        prev_escaped_ = 0;
+        while (starts != 0) {
+            const int i = __builtin_ctzll(starts);
+            if (i == 63) {
+                prev_escaped_ = 1;
+                break;
+            }
+            escaped |= uint64_t(2) << i;
+            starts &= ~(uint64_t(3) << i);
+        }
+        return escaped;
+    }
+
+    auto next(const BlockMasks &m) -> uint64_t {
+        const uint64_t quote = m.quote & ~find_escaped(m.backslash);
+        // from each opening quote up to, not including, its closing quote
+        const uint64_t in_string = prefix_xor(quote) ^ prev_in_string_;
+        prev_in_string_ = uint64_t(int64_t(in_string) >> 63);
+        const uint64_t outside = ~in_string & ~quote;
+        const uint64_t op = m.op & outside;
+        const uint64_t scalar = ~(m.op | m.space) & outside;
+        const uint64_t scalar_start = scalar & ~(scalar << 1 | prev_scalar_);
+        prev_scalar_ = scalar >> 63;
+        return op | quote | scalar_start;
+    }
+
+    auto in_string() const -> bool { return prev_in_string_ != 0; }
+
+  private:
+    uint64_t prev_escaped_ = 0;
+    uint64_t prev_in_string_ = 0;
+    uint64_t prev_scalar_ = 0;
+};
+
+// Appends the structural offsets of `input` to `out`, followed by
+// input.size() as a sentinel. Returns false if a string is left open.
+template<typename Kernel>
+auto index_structurals(std::string_view input, std::vector<uint32_t> &out)
+    -> bool {
+    constexpr size_t batch = 16;
+    BlockMasks masks[batch];
+    StructuralScanner scanner;
+    size_t n = out.size();
+    auto flatten = [&](const BlockMasks *m, size_t count, size_t base) {
+        if (out.size() < n + 64 * count)
+            out.resize(std::max(out.size() * 2, n + 64 * count));
+        uint32_t *dst = out.data() + n;
+        for (size_t b = 0; b < count; ++b, base += 64) {
+            for (uint64_t bits = scanner.next(m[b]); bits != 0;
+                 bits &= bits - 1)
+                *dst++ = static_cast<uint32_t>(base + std::countr_zero(bits));
+        }
+        n = dst - out.data();
+    };
+    const char *data = input.data();
+    size_t pos = 0;
+    while (pos + 64 <= input.size()) {
+        const size_t count = std::min(batch, (input.size() - pos) / 64);
+        Kernel::classify(data + pos, count, masks);
+        flatten(masks, count, pos);
+        pos += 64 * count;
+    }
+    if (pos < input.size()) {
+        char tail[64];
+        std::memset(tail, ' ', sizeof(tail));
+        std::memcpy(tail, data + pos, input.size() - pos);
+        Kernel::classify(tail, 1, masks);
+        flatten(masks, 1, pos);
+    }
+    out.resize(n);
+    out.push_back(static_cast<uint32_t>(input.size()));
+    return !scanner.in_string();
+}
+
+inline auto index_structurals_scalar(
+    std::string_view input, std::vector<uint32_t> &out) -> bool {
+    return index_structurals<ScalarKernel>(input, out);
+}
+
+#ifdef EEE_JSON_X86
+inline auto index_structurals_sse2(
+    std::string_view input, std::vector<uint32_t> &out) -> bool {
+    return index_structurals<Sse2Kernel>(input, out);
+}
+
+inline auto index_structurals_avx2(
+    std::string_view input, std::vector<uint32_t> &out) -> bool {
+    return index_structurals<Avx2Kernel>(input, out);
+}
+#endif
+
+using IndexFn = auto (*)(std::string_view, std::vector<uint32_t> &) -> bool;
+
+// Picks the widest kernel the running CPU supports.
+inline auto best_indexer() -> IndexFn {
+#ifdef EEE_JSON_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return index_structurals_avx2;
+    return index_structurals_sse2;
+#else
+    return index_structurals_scalar;
+#endif
+}
+
+// Fills `out` with the structural offsets of `input` plus a trailing
+// input.size() sentinel. Returns false for inputs of 4 GiB or more and for
+// inputs that end inside a string.
+inline auto build_structural_index(
+    std::string_view input, std::vector<uint32_t> &out) -> bool {
+    static const IndexFn indexer = best_indexer();
+    out.clear();
+    if (input.size() >= std::numeric_limits<uint32_t>::max()) return false;
+    return indexer(input, out);
+}
+
+// Escape letter for each byte a JSON string cannot hold verbatim: the quote,
+// the backslash and the control characters. 'u' means \\u00XX.
+constexpr auto make_escape_table() {
+    struct {
+        char table[256]{};
+    } ret;
+    for (int c = 0; c < 0x20; ++c) ret.table[c] = 'u';
+    ret.table[uint8_t('"')] = '"';
+    ret.table[uint8_t('\\')] = '\\';
+    ret.table[uint8_t('\b')] = 'b';
+    ret.table[uint8_t('\f')] = 'f';
+    ret.table[uint8_t('\n')] = 'n';
+    ret.table[uint8_t('\r')] = 'r';
+    ret.table[uint8_t('\t')] = 't';
+    return ret;
+}
+
+inline constexpr auto escape_table = make_escape_table();
+
+// First byte in [p, last) that needs escaping, or last.
+inline auto find_escape(const char *p, const char *last) -> const char * {
+#ifdef EEE_JSON_X86
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    for (; last - p >= 16; p += 16) {
+        const __m128i in =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        // max(in, 0x1F) == 0x1F  <=>  in <= 0x1F as unsigned bytes
+        const __m128i hit = _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi8(in, quote), _mm_cmpeq_epi8(in, backslash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(in, control), control));
+        if (const int mask = _mm_movemask_epi8(hit); mask != 0)
+            return p + std::countr_zero(static_cast<unsigned>(mask));
+    }
+#endif
+    for (; p != last and escape_table.table[uint8_t(*p)] == 0; ++p)
+        ;
+    return p;
+}
+
+struct BracketMasks {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t open;  // { [
+    uint64_t close; // } ]
+};
+
+inline auto classify_brackets(const char *block) -> BracketMasks {
+    BracketMasks m{};
+#ifdef EEE_JSON_X86
+    for (int i = 0; i < 4; ++i) {
+        const __m128i in =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * i));
+        const __m128i lower = _mm_or_si128(in, _mm_set1_epi8(0x20));
+        auto bits = [i](__m128i eq) {
+            return uint64_t(uint16_t(_mm_movemask_epi8(eq))) << (16 * i);
+        };
+        m.quote |= bits(_mm_cmpeq_epi8(in, _mm_set1_epi8('"')));
+        m.backslash |= bits(_mm_cmpeq_epi8(in, _mm_set1_epi8('\\')));
+        m.open |= bits(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')));
+        m.close |= bits(_mm_cmpeq_epi8(lower, _mm_set1_epi8('}')));
+    }
+#else
+    for (int i = 0; i < 64; ++i) {
+        const uint64_t bit = uint64_t(1) << i;
+        const char c = static_cast<char>(block[i] | 0x20);
+        if (block[i] == '"') m.quote |= bit;
+        if (block[i] == '\\') m.backslash |= bit;
+        if (c == '{') m.open |= bit;
+        if (c == '}') m.close |= bit;
+    }
+#endif
+    return m;
+}
+
+// `p` is at '[' or '{'. Returns one past the bracket that closes it, or
+// nullptr if the input ends first. Brackets inside strings are masked out
+// 64 bytes at a time, as in stage 1; whether the brackets pair up by kind
+// is not checked.
+inline auto find_closing_bracket(const char *p, const char *last)
+    -> const char * {
+    StructuralScanner scanner; // only for its escape carry
+    uint64_t prev_in_string = 0;
+    size_t depth = 0;
+    for (const char *block = p; block < last; block += 64) {
+        char tail[64];
+        const char *src = block;
+        if (last - block < 64) {
+            std::memset(tail, ' ', sizeof(tail));
+            std::memcpy(tail, block, last - block);
+            src = tail;
+        }
+        const BracketMasks m = classify_brackets(src);
+        const uint64_t quote = m.quote & ~scanner.find_escaped(m.backslash);
+        const uint64_t in_string =
+            StructuralScanner::prefix_xor(quote) ^ prev_in_string;
+        prev_in_string = uint64_t(int64_t(in_string) >> 63);
+        const uint64_t open = m.open & ~in_string;
+        const uint64_t close = m.close & ~in_string;
+        // the depth cannot reach zero inside this block
+        if (depth > size_t(std::popcount(close))) {
+            depth += std::popcount(open) - std::popcount(close);
+            continue;
+        }
+        for (uint64_t bits = open | close; bits != 0; bits &= bits - 1) {
+            const int i = std::countr_zero(bits);
+            if (open >> i & 1) ++depth;
+            else if (--depth == 0)
+                return block + i + 1;
+        }
+    }
+    return nullptr;
+}
+
+// UTF-8 validation. Each kernel returns the first byte of the first
+// malformed sequence (overlong forms, surrogates and code points above
+// U+10FFFF included), or nullptr if [p, last) is valid.
+
+// Checks one sequence at a time, skipping ASCII 8 bytes at a time.
+inline auto find_invalid_utf8_scalar(const char *p, const char *last)
+    -> const char * {
+    while (p != last) {
+        if (last - p >= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            if ((word & 0x8080808080808080) == 0) {
+                p += 8;
+                continue;
+            }
+        }
+        const auto c = static_cast<uint8_t>(*p);
+        if (c < 0x80) {
+            ++p;
+            continue;
+        }
+        // the allowed range of the second byte depends on the first
+        int size;
+        uint8_t lo = 0x80, hi = 0xBF;
+        if (c >= 0xC2 and c <= 0xDF) size = 2;
+        else if (c >= 0xE0 and c <= 0xEF) {
+            size = 3;
+            if (c == 0xE0) lo = 0xA0;
+            else if (c == 0xED)
+                hi = 0x9F;
+        } else if (c >= 0xF0 and c <= 0xF4) {
+            size = 4;
+            if (c == 0xF0) lo = 0x90;
+            else if (c == 0xF4)
+                hi = 0x8F;
+        } else {
+            return p;
+        }
+        if (last - p < size) return p;
+        const auto c1 = static_cast<uint8_t>(p[1]);
+        if (c1 < lo or c1 > hi) return p;
+        for (int i = 2; i < size; ++i)
+            if ((static_cast<uint8_t>(p[i]) & 0xC0) != 0x80) return p;
+        p += size;
+    }
+    return nullptr;
+}
+
+#ifdef EEE_JSON_X86
+
+// Keiser and Lemire, "Validating UTF-8 in less than one instruction per
+// byte" (2021): three nibble lookups classify every pair of adjacent bytes,
+// and a saturating subtraction finds the bytes that must continue a 3- or
+// 4-byte sequence. Blocks of pure ASCII only check for a sequence left
+// open by the block before.
+struct Utf8Avx2 {
+    static constexpr uint8_t TOO_SHORT = 1 << 0;
+    static constexpr uint8_t TOO_LONG = 1 << 1;
+    static constexpr uint8_t OVERLONG_3 = 1 << 2;
+    static constexpr uint8_t TOO_LARGE = 1 << 3;
+    static constexpr uint8_t SURROGATE = 1 << 4;
+    static constexpr uint8_t OVERLONG_2 = 1 << 5;
+    static constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+    static constexpr uint8_t OVERLONG_4 = 1 << 6;
+    static constexpr uint8_t TWO_CONTS = 1 << 7;
+    static constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    [[gnu::always_inline, gnu::target("avx2")]] static inline auto
+    lookup(__m256i nibbles, const uint8_t (&table)[16]) -> __m256i {
+        const __m128i t =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(table));
+        return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(t), nibbles);
+    }
+
+    [[gnu::always_inline, gnu::target("avx2")]] static inline auto
+    high_nibbles(__m256i v) -> __m256i {
+        return _mm256_and_si256(
+            _mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+    }
+
+    // the input shifted right by N bytes, with the end of `prev` shifted in
+    template<int N>
+    [[gnu::always_inline, gnu::target("avx2")]] static inline auto
+    prev(__m256i in, __m256i prev) -> __m256i {
+        return _mm256_alignr_epi8(
+            in, _mm256_permute2x128_si256(prev, in, 0x21), 16 - N);
+    }
+
+    [[gnu::always_inline, gnu::target("avx2")]] static inline auto
+    check(__m256i in, __m256i prev_in) -> __m256i {
+        static constexpr uint8_t byte_1_high[16] = {
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            TOO_LONG, TOO_LONG, TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            TOO_SHORT | OVERLONG_2, TOO_SHORT,
+            TOO_SHORT | OVERLONG_3 | SURROGATE,
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4};
+        static constexpr uint8_t byte_1_low[16] = {
+            CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+            CARRY | OVERLONG_2, CARRY, CARRY, CARRY | TOO_LARGE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000};
+        static constexpr uint8_t byte_2_high[16] = {
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            TOO_SHORT, TOO_SHORT,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000
+                | OVERLONG_4,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT};
+        const __m256i low = _mm256_set1_epi8(0x0F);
+        const __m256i prev1 = prev<1>(in, prev_in);
+        const __m256i special = _mm256_and_si256(
+            _mm256_and_si256(
+                lookup(high_nibbles(prev1), byte_1_high),
+                lookup(_mm256_and_si256(prev1, low), byte_1_low)),
+            lookup(high_nibbles(in), byte_2_high));
+        // bytes two or three after a 3- or 4-byte lead must continue it
+        const __m256i third = _mm256_subs_epu8(
+            prev<2>(in, prev_in), _mm256_set1_epi8(char(0xE0 - 0x80)));
+        const __m256i fourth = _mm256_subs_epu8(
+            prev<3>(in, prev_in), _mm256_set1_epi8(char(0xF0 - 0x80)));
+        const __m256i must_continue = _mm256_and_si256(
+            _mm256_or_si256(third, fourth), _mm256_set1_epi8(char(0x80)));
+        return _mm256_xor_si256(must_continue, special);
+    }
+
+    // nonzero where the last bytes of `in` start an unfinished sequence
+    [[gnu::always_inline, gnu::target("avx2")]] static inline auto
+    incomplete(__m256i in) -> __m256i {
+        const __m256i max = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            char(0xF0 - 1), char(0xE0 - 1), char(0xC0 - 1));
+        return _mm256_subs_epu8(in, max);
+    }
+
+    [[gnu::target("avx2")]] static auto
+    find_invalid(const char *first, const char *last) -> const char * {
+        __m256i prev_in = _mm256_setzero_si256();
+        __m256i prev_incomplete = _mm256_setzero_si256();
+        const char *p = first;
+        for (; p < last; p += 64) {
+            __m256i in[2];
+            if (last - p >= 64) {
+                in[0] =
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                in[1] = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(p + 32));
+            } else {
+                // pad with ASCII, which closes nothing left open
+                alignas(32) char tail[64] = {};
+                std::memcpy(tail, p, last - p);
+                in[0] = _mm256_load_si256(reinterpret_cast<__m256i *>(tail));
+                in[1] =
+                    _mm256_load_si256(reinterpret_cast<__m256i *>(tail + 32));
+            }
+            __m256i error;
+            if (_mm256_movemask_epi8(_mm256_or_si256(in[0], in[1])) == 0) {
+                error = prev_incomplete;
+                prev_incomplete = _mm256_setzero_si256();
+            } else {
+                error = _mm256_or_si256(
+                    check(in[0], prev_in), check(in[1], in[0]));
+                prev_incomplete = incomplete(in[1]);
+            }
+            prev_in = in[1];
+            if (!_mm256_testz_si256(error, error)) break;
+        }
+        if (p >= last and _mm256_testz_si256(prev_incomplete, prev_incomplete))
+            return nullptr;
+        // The error is in this block or in a sequence begun just before it.
+        // Earlier blocks are valid, so back up to that sequence's lead byte.
+        p = std::min(p, last);
+        for (int i = 0; i < 4 and p != first; ++i) {
+            const auto c = static_cast<uint8_t>(p[-1]);
+            if (c < 0x80) break;
+            --p;
+            if (c >= 0xC0) break;
+        }
+        return find_invalid_utf8_scalar(p, last);
+    }
+};
+
+#endif
+
+// Picks the widest kernel the running CPU supports, and finds the first
+// malformed UTF-8 sequence in [p, last), or returns nullptr.
+inline auto find_invalid_utf8(const char *p, const char *last)
+    -> const char * {
+    using Fn = auto (*)(const char *, const char *) -> const char *;
+    static const Fn fn = []() -> Fn {
+#ifdef EEE_JSON_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return Utf8Avx2::find_invalid;
+#endif
+        return find_invalid_utf8_scalar;
+    }();
+    return fn(p, last);
+}
+
+} // namespace eee::details
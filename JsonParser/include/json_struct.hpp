@@ -0,0 +1,409 @@
+#pragma once
+#include "json.hpp"
+#include "json_lazy.hpp"
+#include <array>
+#include <bit>
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Direct conversion between JSON text and C++ structs.
+//
+//     struct Point { int x; int y; };
+//     EEE_JSON_FIELDS(Point, x, y)
+//
+//     auto p = eee::parse<Point>(R"({"x":1,"y":2})");
+//     std::string text = eee::generate(*p);
+//
+// EEE_JSON_FIELDS goes in the namespace of the struct and names its public
+// members. Reading walks the text once, with no intermediate Json: each key
+// is looked up in a perfect hash table built at compile time and the value
+// is read straight into the member. Unknown members are skipped without
+// being validated; members missing from the text keep their value.
+// eee::JsonTraits<T> can be specialized for other types.
+
+namespace eee {
+
+namespace details {
+
+template<typename Class, typename T>
+struct Field {
+    std::string_view name;
+    T Class::*member;
+};
+
+template<typename Class, typename T>
+constexpr auto field(std::string_view name, T Class::*member) {
+    return Field<Class, T>{name, member};
+}
+
+constexpr auto field_hash(std::string_view key, uint32_t seed) -> uint32_t {
+    uint32_t h = 2166136261u ^ seed;
+    for (char c : key) {
+        h ^= static_cast<uint8_t>(c);
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+// Maps each of N names to its position without collisions.
+template<size_t N>
+struct PerfectHash {
+    static constexpr size_t size = std::bit_ceil(N * 4 + 1);
+
+    uint32_t seed = 0;
+    std::array<int16_t, size> slots{};
+
+    constexpr auto find(
+        std::string_view key, const std::array<std::string_view, N> &names)
+        const -> int {
+        const int i = slots[field_hash(key, seed) & (size - 1)];
+        return i >= 0 and names[i] == key ? i : -1;
+    }
+};
+
+// Tries seeds until every name lands in its own slot. Fails to compile,
+// by exceeding the constexpr step limit, if two names are equal.
+template<size_t N>
+constexpr auto make_perfect_hash(const std::array<std::string_view, N> &names)
+    -> PerfectHash<N> {
+    static_assert(N < INT16_MAX);
+    PerfectHash<N> ret;
+    for (uint32_t seed = 0;; ++seed) {
+        ret.seed = seed;
+        ret.slots.fill(-1);
+        bool ok = true;
+        for (size_t i = 0; i < N and ok; ++i) {
+            auto &slot =
+                ret.slots[field_hash(names[i], seed) & (ret.size - 1)];
+            ok = slot < 0;
+            slot = static_cast<int16_t>(i);
+        }
+        if (ok) return ret;
+    }
+}
+
+} // namespace details
+
+// read(p, last, out) parses the value at `p` into `out` and leaves `p` one
+// past it; write(out, value) appends the value's text.
+template<typename T>
+struct JsonTraits;
+
+template<typename T>
+concept has_json_traits = requires { JsonTraits<T>::read; };
+
+template<typename T>
+concept has_json_fields =
+    requires { eee_json_fields(static_cast<const T *>(nullptr)); };
+
+namespace details {
+
+inline auto read_literal(const char *&p, const char *last, std::string_view lit)
+    -> bool {
+    if (std::string_view(p, last - p).substr(0, lit.size()) != lit)
+        return false;
+    p += lit.size();
+    return true;
+}
+
+template<typename T>
+auto read_number(const char *&p, const char *last, T &out) -> bool {
+    bool is_float = false;
+    const char *end = scan_number(p, last, is_float);
+    if (end == nullptr or (is_float and std::is_integral_v<T>)) return false;
+    // from_chars rejects values that do not fit T
+    if (std::from_chars(p, end, out).ec != std::errc{}) return false;
+    p = end;
+    return true;
+}
+
+inline auto write_string(std::string &out, std::string_view str) -> void {
+    StringSink sink{out};
+    JsonWriter<StringSink>{sink}.write_string(str);
+}
+
+} // namespace details
+
+template<>
+struct JsonTraits<bool> {
+    static auto read(const char *&p, const char *last, bool &out) -> bool {
+        if (details::read_literal(p, last, "true")) out = true;
+        else if (details::read_literal(p, last, "false"))
+            out = false;
+        else
+            return false;
+        return true;
+    }
+    static auto write(std::string &out, bool value) -> void {
+        out += value ? "true" : "false";
+    }
+};
+
+template<typename T>
+    requires std::is_arithmetic_v<T> and (!std::is_same_v<T, bool>)
+struct JsonTraits<T> {
+    static auto read(const char *&p, const char *last, T &out) -> bool {
+        return details::read_number(p, last, out);
+    }
+    static auto write(std::string &out, T value) -> void {
+        char buf[32];
+        if constexpr (std::is_floating_point_v<T>)
+            out.append(buf, details::format_double(value, buf) - buf);
+        else
+            out.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
+    }
+};
+
+template<>
+struct JsonTraits<std::string> {
+    static auto read(const char *&p, const char *last, std::string &out)
+        -> bool {
+        const char *end = p != last and *p == '"'
+                              ? details::skip_string(p, last)
+                              : nullptr;
+        if (end == nullptr) return false;
+        const std::string_view raw(p + 1, end - p - 2);
+        out.clear();
+        if (raw.find('\\') == raw.npos) out.assign(raw);
+        else if (!details::unescape(raw, out))
+            return false;
+        p = end;
+        return true;
+    }
+    static auto write(std::string &out, const std::string &value) -> void {
+        details::write_string(out, value);
+    }
+};
+
+template<typename T>
+struct JsonTraits<std::optional<T>> {
+    static auto read(const char *&p, const char *last, std::optional<T> &out)
+        -> bool {
+        if (details::read_literal(p, last, "null")) {
+            out.reset();
+            return true;
+        }
+        return JsonTraits<T>::read(p, last, out.emplace());
+    }
+    static auto write(std::string &out, const std::optional<T> &value)
+        -> void {
+        if (value) JsonTraits<T>::write(out, *value);
+        else
+            out += "null";
+    }
+};
+
+template<typename T>
+struct JsonTraits<std::vector<T>> {
+    static auto read(const char *&p, const char *last, std::vector<T> &out)
+        -> bool {
+        if (p == last or *p != '[') return false;
+        out.clear();
+        const char *end = details::for_each_element(
+            p, last, [&](size_t, const char *&value) {
+                return JsonTraits<T>::read(value, last, out.emplace_back());
+            });
+        return end != nullptr and (p = end);
+    }
+    static auto write(std::string &out, const std::vector<T> &value) -> void {
+        out += '[';
+        for (size_t i = 0; i < value.size(); ++i) {
+            if (i != 0) out += ',';
+            JsonTraits<T>::write(out, value[i]);
+        }
+        out += ']';
+    }
+};
+
+// std::map and std::unordered_map with string keys
+template<typename Map>
+    requires std::is_same_v<typename Map::key_type, std::string>
+             and requires { typename Map::mapped_type; }
+struct JsonTraits<Map> {
+    using T = typename Map::mapped_type;
+
+    static auto read(const char *&p, const char *last, Map &out) -> bool {
+        if (p == last or *p != '{') return false;
+        out.clear();
+        std::string key;
+        const char *end = details::for_each_member(
+            p, last, [&](std::string_view raw, const char *&value) {
+                key.clear();
+                if (!details::unescape(raw, key)) return false;
+                return JsonTraits<T>::read(value, last, out[key]);
+            });
+        return end != nullptr and (p = end);
+    }
+    static auto write(std::string &out, const Map &value) -> void {
+        out += '{';
+        bool first = true;
+        for (const auto &[key, item] : value) {
+            if (!first) out += ',';
+            first = false;
+            details::write_string(out, key);
+            out += ':';
+            JsonTraits<T>::write(out, item);
+        }
+        out += '}';
+    }
+};
+
+// any value, kept as a generic tree
+template<>
+struct JsonTraits<Json> {
+    static auto read(const char *&p, const char *last, Json &out) -> bool {
+        const char *end = details::skip_value(p, last);
+        if (end == nullptr) return false;
+        auto ret = eee::parse(std::string_view(p, end - p));
+        if (!ret) return false;
+        out = std::move(*ret);
+        p = end;
+        return true;
+    }
+    static auto write(std::string &out, const Json &value) -> void {
+        eee::generate(value, out);
+    }
+};
+
+template<typename T>
+    requires has_json_fields<T>
+struct JsonTraits<T> {
+    static constexpr auto fields =
+        eee_json_fields(static_cast<const T *>(nullptr));
+    static constexpr size_t count = std::tuple_size_v<decltype(fields)>;
+    static constexpr auto names = []<size_t... I>(std::index_sequence<I...>) {
+        return std::array<std::string_view, count>{
+            std::get<I>(fields).name...};
+    }(std::make_index_sequence<count>{});
+    static constexpr auto table = details::make_perfect_hash(names);
+
+    static auto read(const char *&p, const char *last, T &out) -> bool {
+        if (p == last or *p != '{') return false;
+        std::string scratch;
+        const char *end = details::for_each_member(
+            p, last, [&](std::string_view key, const char *&value) {
+                if (key.find('\\') != key.npos) {
+                    scratch.clear();
+                    if (!details::unescape(key, scratch)) return false;
+                    key = scratch;
+                }
+                const int index = table.find(key, names);
+                if (index < 0)
+                    return (value = details::skip_value(value, last))
+                           != nullptr;
+                return read_field(
+                    index, value, last, out, std::make_index_sequence<count>{});
+            });
+        return end != nullptr and (p = end);
+    }
+
+    static auto write(std::string &out, const T &value) -> void {
+        out += '{';
+        [&]<size_t... I>(std::index_sequence<I...>) {
+            ((out += I == 0 ? "\"" : ",\"", out += std::get<I>(fields).name,
+              out += "\":", write_member(out, value, std::get<I>(fields))),
+             ...);
+        }(std::make_index_sequence<count>{});
+        out += '}';
+    }
+
+  private:
+    template<size_t... I>
+    static auto read_field(
+        int index, const char *&p, const char *last, T &out,
+        std::index_sequence<I...>) -> bool {
+        bool ok = false;
+        ((index == int(I)
+              ? (ok = read_member(p, last, out, std::get<I>(fields)), true)
+              : false)
+         or ...);
+        return ok;
+    }
+
+    template<typename M>
+    static auto read_member(
+        const char *&p, const char *last, T &out,
+        const details::Field<T, M> &field) -> bool {
+        return JsonTraits<M>::read(p, last, out.*field.member);
+    }
+
+    template<typename M>
+    static auto write_member(
+        std::string &out, const T &value, const details::Field<T, M> &field)
+        -> void {
+        JsonTraits<M>::write(out, value.*field.member);
+    }
+};
+
+// Reads `json` into `out`. The whole input must be one value.
+template<typename T>
+    requires has_json_traits<T>
+auto parse_into(std::string_view json, T &out) -> bool {
+    const char *last = json.data() + json.size();
+    const char *p = details::skip_space(json.data(), last);
+    return JsonTraits<T>::read(p, last, out)
+           and details::skip_space(p, last) == last;
+}
+
+template<typename T>
+    requires has_json_traits<T>
+auto parse(std::string_view json) -> std::optional<T> {
+    T out{};
+    if (!parse_into(json, out)) return std::nullopt;
+    return out;
+}
+
+// appends the text of a struct declared with EEE_JSON_FIELDS
+template<typename T>
+    requires has_json_fields<T>
+auto generate(const T &value, std::string &out) -> void {
+    JsonTraits<T>::write(out, value);
+}
+
+template<typename T>
+    requires has_json_fields<T>
+auto generate(const T &value) -> std::string {
+    std::string out;
+    JsonTraits<T>::write(out, value);
+    return out;
+}
+
+} // namespace eee
+
+#define EEE_JSON_PARENS ()
+#define EEE_JSON_EXPAND(...)                                                   \
+    EEE_JSON_EXPAND4(EEE_JSON_EXPAND4(EEE_JSON_EXPAND4(__VA_ARGS__)))
+#define EEE_JSON_EXPAND4(...)                                                  \
+    EEE_JSON_EXPAND3(EEE_JSON_EXPAND3(EEE_JSON_EXPAND3(__VA_ARGS__)))
+#define EEE_JSON_EXPAND3(...)                                                  \
+    EEE_JSON_EXPAND2(EEE_JSON_EXPAND2(EEE_JSON_EXPAND2(__VA_ARGS__)))
+#define EEE_JSON_EXPAND2(...)                                                  \
+    EEE_JSON_EXPAND1(EEE_JSON_EXPAND1(EEE_JSON_EXPAND1(__VA_ARGS__)))
+#define EEE_JSON_EXPAND1(...) __VA_ARGS__
+
+// expands to `::eee::details::field("name", &Type::name)` per member,
+// separated by commas; up to 81 members
+#define EEE_JSON_FIELD_LIST(Type, ...)                                         \
+    __VA_OPT__(EEE_JSON_EXPAND(EEE_JSON_FIELD_LIST_NEXT(Type, __VA_ARGS__)))
+#define EEE_JSON_FIELD_LIST_NEXT(Type, name, ...)                              \
+    ::eee::details::field(#name, &Type::name)                                  \
+        __VA_OPT__(, EEE_JSON_FIELD_LIST_AGAIN EEE_JSON_PARENS(                \
+                         Type, __VA_ARGS__))
+#define EEE_JSON_FIELD_LIST_AGAIN() EEE_JSON_FIELD_LIST_NEXT
+
+// Declares the members of `Type` that map to JSON members of the same name.
+// Use at namespace scope, in the namespace of `Type`.
+#define EEE_JSON_FIELDS(Type, ...)                                             \
+    [[maybe_unused]] constexpr auto eee_json_fields(const Type *) {            \
+        return std::make_tuple(EEE_JSON_FIELD_LIST(Type, __VA_ARGS__));        \
+    }
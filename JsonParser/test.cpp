@@ -1,10 +1,103 @@
 #include "include/json.hpp"
+#include "include/json_dom.hpp"
+#include "include/json_cbor.hpp"
+#include "include/json_compact.hpp"
+#include "include/json_lazy.hpp"
+#include "include/json_ndjson.hpp"
+#include "include/json_patch.hpp"
+#include "include/json_struct.hpp"
+#include "ThreadPool.hpp"
+#include "alloc_count.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <ios>
 #include <iostream>
 #include <sstream>
 #include <vector>
 
+// MB/s of `f` over `input`, timed across four runs
+template<typename F>
+auto mbps(std::string_view input, F f) -> int {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 4; ++i) f();
+    const std::chrono::duration<double> d =
+        std::chrono::steady_clock::now() - start;
+    return static_cast<int>(input.size() * 4 / d.count() / 1e6);
+}
+
+// an array of `n` small records
+auto make_records(int n) -> std::string {
+    std::string records = "[";
+    for (int i = 0; i < n; ++i) {
+        if (i != 0) records += ',';
+        records += "{\"id\":" + std::to_string(i)
+                   + ",\"name\":\"user" + std::to_string(i)
+                   + "\",\"active\":true,\"score\":" + std::to_string(i * 0.5)
+                   + ",\"email\":\"user" + std::to_string(i)
+                   + "@example.com\",\"tags\":[\"a\",\"b\"]}";
+    }
+    return records + "]";
+}
+
+namespace lsp {
+
+struct Position {
+    int line = 0;
+    int character = 0;
+};
+EEE_JSON_FIELDS(Position, line, character)
+
+struct Range {
+    Position start;
+    Position end;
+};
+EEE_JSON_FIELDS(Range, start, end)
+
+struct Diagnostic {
+    Range range;
+    std::optional<int> severity;
+    std::string message;
+    std::vector<std::string> tags;
+    std::map<std::string, eee::Json> data;
+};
+EEE_JSON_FIELDS(Diagnostic, range, severity, message, tags, data)
+
+} // namespace lsp
+
+// the records of make_records
+struct Record {
+    int64_t id = 0;
+    std::string name;
+    bool active = false;
+    double score = 0;
+    std::string email;
+    std::vector<std::string> tags;
+};
+EEE_JSON_FIELDS(Record, id, name, active, score, email, tags)
+
+// the most members EEE_JSON_FIELDS takes
+struct Wide {
+    int f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15,
+        f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29,
+        f30, f31, f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43,
+        f44, f45, f46, f47, f48, f49, f50, f51, f52, f53, f54, f55, f56, f57,
+        f58, f59, f60, f61, f62, f63, f64, f65, f66, f67, f68, f69, f70, f71,
+        f72, f73, f74, f75, f76, f77, f78, f79, f80;
+};
+EEE_JSON_FIELDS(
+    Wide,
+    f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16,
+    f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29, f30, f31,
+    f32, f33, f34, f35, f36, f37, f38, f39, f40, f41, f42, f43, f44, f45, f46,
+    f47, f48, f49, f50, f51, f52, f53, f54, f55, f56, f57, f58, f59, f60, f61,
+    f62, f63, f64, f65, f66, f67, f68, f69, f70, f71, f72, f73, f74, f75, f76,
+    f77, f78, f79, f80)
+
 void test0() {
     std::string s =
         "{\"numbers\":[23,66,5,33,46,78],\"checked\":true,\"id\":38934,\"object\":{\"t\":\"json校验器\",\"w\":\"json检查\"},\"host\":\"json-online.com\"}";
@@ -42,9 +135,927 @@ void test1() {
     std::cout << j3 << "\n";
 }
 
+void test2() {
+    std::string s =
+        "{\"id\":38934,\"pi\":3.25,\"ok\":false,\"none\":null,"
+        "\"tags\":[\"a\",\"b\\\"c\",[],{}],\"t\":\"json\\u6821\\u9a8c\"}";
+    auto doc = eee::dom::parse(s);
+    assert(doc.has_value());
+    auto root = doc->root();
+    assert(root.size() == 6);
+    assert(root["id"].get_int() == 38934);
+    assert(root["pi"].get_double() == 3.25);
+    assert(!root["ok"].get_bool() and root["none"].is_null());
+    assert(root["tags"].size() == 4 and root["tags"][3].is_object());
+    assert(root["tags"][1].has_escapes());
+    assert(root["tags"][1].get_string() == "b\"c");
+    assert(root["t"].get_string() == "json\u6821\u9a8c");
+    std::cout << root.to_json() << "\n";
+
+    eee::dom::DomParser parser{{.raw_numbers = true}};
+    eee::dom::Document reused;
+    for (auto bad : {"[1,]", "{\"a\" 1}", "[1 2]", "\"abc", "01", "[] x",
+                     "\"a\x01\"", "\"\\q\"", "\"\\ud800\"", "\"\xc3\"",
+                     "\"\xff\"", "{\"\xff\":1}"}) {
+        assert(!parser.parse(bad, reused));
+        assert(!eee::dom::parse(bad));
+    }
+    assert(parser.parse("[-1.5e3, 42]", reused));
+    assert(reused.root()[0].raw_number() == "-1.5e3");
+    assert(reused.root()[1].get_int() == 42);
+}
+
+void test3() {
+    // quotes and brackets inside strings are not structural
+    auto json = eee::parse(
+        " { \"a\" : [ 1 , \"x\\\"]{,\" ] ,\n\t\"b\" : { } } ");
+    assert(json.has_value());
+    assert(json.value()["a"].size() == 2 and json.value()["b"].size() == 0);
+    std::cout << json.value() << "\n";
+    for (auto bad : {"", "[1,2", "[1 2]", "{\"a\":1,}", "\"open", "nul",
+                     "truex", "[] []", "1x"})
+        assert(!eee::parse(bad).has_value());
+}
+
+void test4() {
+    std::string s = "[0,-7,9223372036854775807,-9223372036854775808,"
+                    "18446744073709551615,18446744073709551616,0.1,-2.5e-3,"
+                    "1e300,3.0]";
+    auto json = eee::parse(s);
+    assert(json.has_value());
+    auto &arr = std::get<eee::Array>(json.value().value_);
+    assert(std::get<eee::Int>(arr[1].value_) == -7);
+    assert(std::get<eee::Int>(arr[2].value_) == INT64_MAX);
+    assert(std::get<eee::Int>(arr[3].value_) == INT64_MIN);
+    assert(std::get<eee::UInt>(arr[4].value_) == UINT64_MAX);
+    assert(std::holds_alternative<eee::Float>(arr[5].value_));
+    assert(std::get<eee::Float>(arr[6].value_) == 0.1);
+    // shortest round-trip text; integral doubles stay doubles
+    std::string g = eee::generate(json.value());
+    std::cout << g << "\n";
+    assert(eee::generate(eee::parse(g).value()) == g);
+    assert(std::holds_alternative<eee::Float>(
+        std::get<eee::Array>(eee::parse(g).value().value_)[9].value_));
+    for (auto bad : {"-", "01", "1.", ".5", "1e", "1.2.3e", "+1", "1e400"})
+        assert(!eee::parse(bad).has_value());
+    // too small for a double is zero, with its sign; only overflow fails
+    auto tiny =
+        eee::parse("[1e-400,-1e-400,2e-324,0.0000e-99999999999,1e-310]");
+    assert(tiny.has_value());
+    auto &zeros = std::get<eee::Array>(tiny.value().value_);
+    assert(std::get<eee::Float>(zeros[0].value_) == 0.0);
+    assert(std::signbit(std::get<eee::Float>(zeros[1].value_)));
+    assert(std::get<eee::Float>(zeros[2].value_) == 0.0);
+    assert(std::get<eee::Float>(zeros[4].value_) > 0.0);
+    assert(eee::dom::parse("[1e-400]")->root()[0].get_double() == 0.0);
+    assert(eee::compact::parse("[1e-400]")->root()[0].get_double() == 0.0);
+    assert(eee::lazy("[1e-400]").at(0)->get_double() == 0.0);
+    assert(!eee::dom::parse("1e400") and !eee::compact::parse("1e400"));
+}
+
+void test5() {
+    eee::Json json{eee::Object{}};
+    json["list"] = std::vector<eee::Json>{1, "a\"b\\c\n\x01", eee::Object{}};
+    json["empty"] = eee::Array{};
+    assert(
+        eee::generate(json)
+        == "{\"empty\":[],\"list\":[1,\"a\\\"b\\\\c\\n\\u0001\",{}]}");
+
+    std::string pretty = eee::generate(json, {.pretty = true, .indent = 2});
+    std::cout << pretty << "\n";
+    assert(pretty.find("\n  \"list\": [\n    1,") != std::string::npos);
+
+    // appending into a reused buffer and streaming give the same text
+    std::string buf = "prefix:";
+    eee::generate(json, buf);
+    std::ostringstream os;
+    os << json;
+    assert(buf == "prefix:" + os.str());
+}
+
+void test6() {
+    static_assert(sizeof(eee::compact::Value) == 16);
+    auto doc = eee::compact::parse(
+        "{\"b\":1,\"a\":[true,null,-2.5,18446744073709551615],"
+        "\"short\":\"fifteen bytes!!\",\"long\":\"sixteen bytes!!!\","
+        "\"esc\":\"q\\\"\\u00e9\",\"b\":2}");
+    assert(doc.has_value());
+    auto &root = doc->root();
+    // insertion order, and a repeated key keeps the last value
+    assert(root.size() == 5 and root.members()[0].key->view() == "b");
+    assert(root["b"].get_int() == 2);
+    assert(root["a"][0].get_bool() and root["a"][1].is_null());
+    assert(root["a"][2].get_double() == -2.5);
+    assert(root["a"][3].get_uint() == UINT64_MAX);
+    assert(root["short"].get_string() == "fifteen bytes!!");
+    assert(root["long"].get_string() == "sixteen bytes!!!");
+    assert(root["esc"].get_string() == "q\"\u00e9");
+    assert(root.find("missing") == nullptr);
+
+    // past the threshold lookups go through the hash index
+    for (int i = 0; i < 100; ++i)
+        root.insert_or_assign(doc->key("k" + std::to_string(i)), i);
+    eee::compact::Value copy = root;
+    root.insert_or_assign(doc->key("k7"), "changed");
+    for (int i = 0; i < 100; ++i)
+        assert(copy["k" + std::to_string(i)].get_int() == i);
+    assert(root["k7"].get_string() == "changed" and root.size() == 105);
+    for (auto bad : {"[1,]", "{\"a\" 1}", "\"\\x\"", "[] x", "\"a\x01\"",
+                     "\"\xff\"", "\"\xc3\"", "[\"\\ud800\"]", "{\"\xff\":1}",
+                     "\"a\x01\\n\""})
+        assert(!eee::compact::parse(bad).has_value());
+
+    // footprint and lookup time against the std::map based Json
+    const std::string records = make_records(20000);
+    using clock = std::chrono::steady_clock;
+    auto ns = [](auto d) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    };
+
+    size_t before = allocated_bytes;
+    auto json = eee::parse(records).value();
+    const size_t json_bytes = allocated_bytes - before;
+    before = allocated_bytes;
+    auto compact = eee::compact::parse(records).value();
+    const size_t compact_bytes = allocated_bytes - before;
+
+    int64_t sum = 0;
+    auto start = clock::now();
+    for (auto &record : std::get<eee::Array>(json.value_))
+        sum += std::get<eee::Int>(record["id"].value_);
+    const auto json_ns = ns(clock::now() - start);
+    start = clock::now();
+    for (const auto &record : compact.root().items())
+        sum -= record["id"].get_int();
+    const auto compact_ns = ns(clock::now() - start);
+    assert(sum == 0);
+
+    std::cout << "input " << records.size() << " B, Json " << json_bytes
+              << " B, compact " << compact_bytes << " B; lookup Json "
+              << json_ns / 20000 << " ns, compact " << compact_ns / 20000
+              << " ns\n";
+    assert(compact_bytes * 2 < json_bytes);
+}
+
+void test7() {
+    const std::string records = make_records(2000);
+    // a pmr tree reads, edits and prints like eee::Json
+    {
+        auto doc = eee::pmr::parse(records).value();
+        auto &root = doc.root();
+        root[7]["name"] =
+            eee::pmr::String("longer than the small buffer", doc.allocator());
+        root[7]["tags"].push_back(eee::pmr::Json(eee::Int(3)));
+        auto json = eee::parse(records).value();
+        json[7]["name"] = std::string("longer than the small buffer");
+        json[7]["tags"].push_back(eee::Json(eee::Int(3)));
+        assert(root.size() == 2000);
+        assert(eee::generate(root) == eee::generate(json));
+    }
+    std::pmr::monotonic_buffer_resource arena;
+    auto tree = eee::parse(records, &arena).value();
+    assert(std::get<eee::pmr::String>(tree[0]["email"].value_)
+               .get_allocator()
+               .resource()
+           == &arena);
+
+    // parse-then-discard: allocations per round, parse and teardown time
+    using clock = std::chrono::steady_clock;
+    auto run = [&records](auto parse) {
+        static constexpr int rounds = 50;
+        const size_t count = allocation_count;
+        clock::duration parse_time{}, free_time{};
+        for (int i = 0; i < rounds; ++i) {
+            auto start = clock::now();
+            auto ret = parse(records);
+            auto mid = clock::now();
+            assert(ret.has_value());
+            ret.reset();
+            parse_time += mid - start;
+            free_time += clock::now() - mid;
+        }
+        auto us = [](auto d) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                       d / rounds)
+                .count();
+        };
+        std::cout << (allocation_count - count) / rounds << " allocations, "
+                  << us(parse_time) << " us parse, " << us(free_time)
+                  << " us free";
+        return (allocation_count - count) / rounds;
+    };
+    std::cout << "parse+discard " << records.size() << " B: Json ";
+    const size_t json_allocs =
+        run([](std::string_view in) { return eee::parse(in); });
+    std::cout << "; pmr::Document ";
+    const size_t pmr_allocs =
+        run([](std::string_view in) { return eee::pmr::parse(in); });
+    std::cout << "\n";
+    assert(pmr_allocs * 100 < json_allocs);
+}
+
+void test8() {
+    const std::string message =
+        "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\","
+        "\"params\":{\"uri\":\"file:///a.cpp\",\"diagnostics\":[{\"range\":"
+        "{\"start\":{\"line\":0,\"character\":9},\"end\":{\"line\":0,"
+        "\"character\":19}},\"message\":\"'x.h' file not found\","
+        "\"a/b\":\"[{\\\"\",\"tags\":[]}]},\"~\":true} trailing log text";
+    auto doc = eee::lazy(message);
+    auto line = doc.at_pointer("/params/diagnostics/0/range/start/line");
+    assert(line and line->get_int() == 0);
+    assert(doc.at_pointer("/params/diagnostics/0/range/end/character")
+               ->get_uint()
+           == 19);
+    assert(doc.at_pointer("/params/diagnostics/0/a~1b")->get_string()
+           == "[{\"");
+    assert(doc.at_pointer("/~0")->get_bool());
+    assert(doc.at_pointer("")->is_object());
+    for (auto missing : {"/nope", "/params/diagnostics/1", "/method/0",
+                         "/params/diagnostics/00", "params"})
+        assert(!doc.at_pointer(missing));
+    auto range = doc.at_pointer("/params/diagnostics/0/range")->parse();
+    assert(range and range->size() == 2);
+
+    // a scalar must end where the value does
+    auto scalars = eee::lazy("[12abc, truex, 1.5e2x, -3, 7 ,false]");
+    auto throws = [](auto read) {
+        try {
+            read();
+        } catch (const std::runtime_error &) {
+            return true;
+        }
+        return false;
+    };
+    assert(throws([&] { scalars.at(0)->get_int(); }));
+    assert(throws([&] { scalars.at(0)->get_uint(); }));
+    assert(throws([&] { scalars.at(1)->get_bool(); }));
+    assert(throws([&] { scalars.at(2)->get_double(); }));
+    assert(scalars.at(3)->get_int() == -3);
+    assert(scalars.at(4)->get_uint() == 7 and !scalars.at(5)->get_bool());
+
+    eee::Extractor extractor{
+        "/method", "/params/diagnostics/0/message", "/params/uri", "/x"};
+    auto fields = extractor.extract(message);
+    assert(fields[0]->get_string() == "textDocument/publishDiagnostics");
+    assert(fields[1]->get_string() == "'x.h' file not found");
+    assert(fields[2]->get_string() == "file:///a.cpp" and !fields[3]);
+
+    // a field at the end of a large document: full parse, extraction, memchr
+    const std::string records = make_records(20000);
+    const auto pointer = "/19999/email";
+    const int parse_speed = mbps(records, [&] {
+        auto json = eee::parse(records);
+        assert(std::get<eee::String>(json.value()[19999]["email"].value_)
+               == "user19999@example.com");
+    });
+    eee::Extractor last{pointer};
+    const int extract_speed = mbps(records, [&] {
+        auto value = last.extract(records)[0];
+        assert(value->get_string() == "user19999@example.com");
+    });
+    const int memchr_speed = mbps(records, [&] {
+        const void *volatile p =
+            std::memchr(records.data(), '\0', records.size());
+        assert(p == nullptr);
+    });
+    std::cout << "field at the end of " << records.size() << " B: parse "
+              << parse_speed << " MB/s, extract " << extract_speed
+              << " MB/s, memchr " << memchr_speed << " MB/s\n";
+}
+
+void test9() {
+    // one record per line, with a blank line and a malformed one mixed in
+    std::string lines;
+    for (int i = 0; i < 20000; ++i) {
+        if (i == 100) lines += "  \r\n";
+        if (i == 200) lines += "{bad\r\n";
+        lines += "{\"id\":" + std::to_string(i) + ",\"name\":\"user"
+                 + std::to_string(i) + "\",\"tags\":[\"a\",\"b\"]}\n";
+    }
+    ctp::ThreadPool pool(4);
+    std::vector<int64_t> ids;
+    size_t bad = 0;
+    auto collect = [&](size_t offset, std::optional<eee::Json> record) {
+        if (!record) {
+            ++bad;
+            assert(lines.compare(offset, 4, "{bad") == 0);
+            return;
+        }
+        ids.push_back(std::get<eee::Int>((*record)["id"].value_));
+    };
+    eee::parse_ndjson(
+        lines, pool, collect, {.batch_size = 4096, .max_in_flight = 4});
+    assert(bad == 1 and ids.size() == 20000);
+    assert(std::is_sorted(ids.begin(), ids.end()));
+
+    const auto path =
+        (std::filesystem::temp_directory_path() / "eee_ndjson_test.jsonl")
+            .string();
+    std::ofstream(path, std::ios::binary) << lines;
+    ids.clear();
+    bad = 0;
+    assert(eee::parse_ndjson_file(
+        path, pool, collect, {.ordered = false, .batch_size = 4096}));
+    std::filesystem::remove(path);
+    std::sort(ids.begin(), ids.end());
+    assert(bad == 1 and ids.size() == 20000 and ids.back() == 19999);
+
+    // throughput against the number of workers
+    std::string big;
+    while (big.size() < 4 << 20) big += lines;
+    for (size_t threads : {1, 2, 4}) {
+        ctp::ThreadPool workers(threads);
+        size_t count = 0;
+        const auto start = std::chrono::steady_clock::now();
+        eee::parse_ndjson(big, workers, [&count](size_t, auto) { ++count; });
+        const std::chrono::duration<double> d =
+            std::chrono::steady_clock::now() - start;
+        std::cout << "ndjson " << threads << " threads: "
+                  << static_cast<int>(big.size() / d.count() / 1e6)
+                  << " MB/s\n";
+        assert(count == big.size() / lines.size() * 20001);
+    }
+}
+
+void test10() {
+    auto diag = eee::parse<lsp::Diagnostic>(
+        "{\"range\":{\"start\":{\"line\":3,\"character\":9},"
+        "\"end\":{\"line\":3,\"character\":19}},\"source\":[{}],"
+        "\"mess\\u0061ge\":\"'x.h' \\\"not\\\" found\",\"severity\":null,"
+        "\"tags\":[\"a\",\"b\"],\"data\":{\"fix\":[1,{\"x\":null}]}} ");
+    assert(diag and diag->range.start.line == 3);
+    assert(diag->range.end.character == 19 and !diag->severity);
+    assert(diag->message == "'x.h' \"not\" found");
+    assert(diag->tags == std::vector<std::string>({"a", "b"}));
+    assert(diag->data.at("fix")[1]["x"].value_.index() == 0);
+
+    // round trip
+    diag->severity = 1;
+    const std::string text = eee::generate(*diag);
+    assert(text.starts_with("{\"range\":{\"start\":{\"line\":3,"));
+    auto again = eee::parse<lsp::Diagnostic>(text);
+    assert(again and again->severity == 1 and again->message == diag->message);
+    assert(eee::generate(*again) == text);
+
+    // type mismatches, out of range numbers and malformed text
+    for (auto bad : {"{\"line\":\"3\"}", "{\"line\":1.5}",
+                     "{\"line\":99999999999}", "{\"line\":1,}",
+                     "{\"line\":1} x", "[1]", "{\"line\" 1}"})
+        assert(!eee::parse<lsp::Position>(bad));
+    assert(eee::parse<lsp::Position>("{}"));
+    Wide wide{};
+    wide.f0 = 1;
+    wide.f80 = 81;
+    auto wide_back = eee::parse<Wide>(eee::generate(wide));
+    assert(wide_back and wide_back->f0 == 1 and wide_back->f80 == 81);
+    assert(eee::parse<Wide>("{\"f40\":41}")->f40 == 41);
+    assert(eee::parse<std::vector<double>>(" [1, -2.5e3] ")->at(1) == -2500);
+
+    // typed reading against a tree parse followed by lookups
+    const std::string records = make_records(20000);
+    const int typed_speed = mbps(records, [&] {
+        auto parsed = eee::parse<std::vector<Record>>(records);
+        assert(parsed and parsed->size() == 20000);
+        assert((*parsed)[19999].email == "user19999@example.com");
+    });
+    const int tree_speed = mbps(records, [&] {
+        auto json = eee::parse(records);
+        std::vector<Record> parsed;
+        for (auto &item : std::get<eee::Array>(json.value().value_)) {
+            auto &obj = std::get<eee::Object>(item.value_);
+            auto &record = parsed.emplace_back();
+            record.id = std::get<eee::Int>(obj.at("id").value_);
+            record.name = std::get<eee::String>(obj.at("name").value_);
+            record.active = std::get<bool>(obj.at("active").value_);
+            record.score = std::get<eee::Float>(obj.at("score").value_);
+            record.email = std::get<eee::String>(obj.at("email").value_);
+            for (auto &tag : std::get<eee::Array>(obj.at("tags").value_))
+                record.tags.push_back(std::get<eee::String>(tag.value_));
+        }
+        assert(parsed[19999].email == "user19999@example.com");
+    });
+    std::cout << "records into structs: typed " << typed_speed
+              << " MB/s, tree and lookups " << tree_speed << " MB/s\n";
+}
+
+void test11() {
+    using namespace std::string_view_literals;
+    // RFC 8949 appendix A
+    assert(eee::to_cbor(eee::Json(1000000)) == "\x1a\x00\x0f\x42\x40"sv);
+    assert(eee::to_cbor(eee::Json(-1000)) == "\x39\x03\xe7");
+    assert(eee::to_cbor(eee::Json(1.5)) == "\xfa\x3f\xc0\x00\x00"sv);
+    assert(eee::to_cbor(eee::Json(1.1)).size() == 9);
+    assert(eee::to_cbor(eee::Json(eee::Array{})) == "\x80");
+    auto half = eee::from_cbor("\xf9\x3c\x00"sv);
+    assert(std::get<eee::Float>(half->value_) == 1.0);
+    auto below_int64 =
+        eee::from_cbor("\x3b\xff\xff\xff\xff\xff\xff\xff\xff");
+    assert(std::get<eee::Float>(below_int64->value_) == -0x1p64);
+
+    eee::Json json{eee::Object{}};
+    json["ints"] = eee::Array{0, 23, 24, -24, -25, INT64_MIN, INT64_MAX};
+    json["big"] = eee::UInt(UINT64_MAX);
+    json["floats"] = eee::Array{0.1, -2.5, 1e300, 1.0};
+    json["strings"] =
+        eee::Array{"", std::string(23, 'a'), std::string(300, 'b')};
+    json["misc"] = eee::Array{true, false, nullptr, eee::Object{}};
+    const std::string bytes = eee::to_cbor(json);
+    auto decoded = eee::from_cbor(bytes);
+    assert(decoded and eee::generate(*decoded) == eee::generate(json));
+    for (size_t size = 0; size < bytes.size(); ++size)
+        assert(!eee::from_cbor(std::string_view(bytes).substr(0, size)));
+    for (auto bad : {"\x41" "a", "\xc1\x00", "\x9f\xff", "\xf7", "\xa1\x01\x01",
+                     "\x01\x01", "\x9b\xff\xff\xff\xff\xff\xff\xff\xff"})
+        assert(!eee::from_cbor(bad));
+
+    auto view = eee::cbor_view(bytes);
+    assert(view.is_object() and view.size() == 5);
+    assert(view.at_pointer("/ints/5")->get_int() == INT64_MIN);
+    assert(view.at_pointer("/big")->get_uint() == UINT64_MAX);
+    assert(view.at_pointer("/floats/0")->get_double() == 0.1);
+    auto str = view.at_pointer("/strings/2")->get_string();
+    assert(str.size() == 300 and str.data() > bytes.data()
+           and str.data() < bytes.data() + bytes.size());
+    assert(view.at_pointer("/misc/2")->is_null());
+    assert(!view.at_pointer("/misc/4") and !view.at_pointer("/nope"));
+    assert(view.find("misc")->decode()->size() == 4);
+
+    // sizes and speeds against text; error.json holds one document followed
+    // by log output
+    std::ifstream file(EEE_SOURCE_DIR "/error.json", std::ios::binary);
+    const std::string log{std::istreambuf_iterator<char>(file), {}};
+    const std::string error_json(eee::lazy(log).raw());
+    for (const std::string &text : {error_json, make_records(20000)}) {
+        const auto tree = eee::parse(text).value();
+        const std::string compact = eee::generate(tree);
+        const std::string cbor = eee::to_cbor(tree);
+        const int rounds = 2000000 / text.size() + 1;
+        using clock = std::chrono::steady_clock;
+        auto us = [rounds](auto f) {
+            const auto start = clock::now();
+            for (int i = 0; i < rounds; ++i) f();
+            const std::chrono::duration<double, std::micro> d =
+                clock::now() - start;
+            return static_cast<int>(d.count() / rounds);
+        };
+        const int parse_us = us([&] {
+            auto ret = eee::parse(text);
+            assert(ret);
+        });
+        const int decode_us = us([&] {
+            auto ret = eee::from_cbor(cbor);
+            assert(ret);
+        });
+        const int generate_us = us([&] {
+            auto ret = eee::generate(tree);
+            assert(ret.size() == compact.size());
+        });
+        const int encode_us = us([&] {
+            auto ret = eee::to_cbor(tree);
+            assert(ret.size() == cbor.size());
+        });
+        std::cout << "text " << compact.size() << " B, cbor " << cbor.size()
+                  << " B; parse " << parse_us << " us, from_cbor "
+                  << decode_us << " us; generate " << generate_us
+                  << " us, to_cbor " << encode_us << " us\n";
+    }
+
+    // a lookup near the end: text is skipped by bracket matching, CBOR
+    // items by their heads
+    const std::string records = make_records(20000);
+    const std::string cbor = eee::to_cbor(eee::parse(records).value());
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    auto text_email = eee::lazy(records).at_pointer("/19999/email");
+    assert(text_email->get_string() == "user19999@example.com");
+    const std::chrono::duration<double, std::micro> text_us =
+        clock::now() - start;
+    start = clock::now();
+    auto cbor_email = eee::cbor_view(cbor).at_pointer("/19999/email");
+    assert(cbor_email->get_string() == "user19999@example.com");
+    const std::chrono::duration<double, std::micro> cbor_us =
+        clock::now() - start;
+    std::cout << "/19999/email: lazy text " << int(text_us.count())
+              << " us, cbor view " << int(cbor_us.count()) << " us\n";
+}
+
+void test12() {
+    struct Case {
+        std::string_view input;
+        size_t offset, line, column;
+        std::string_view message;
+    };
+    for (const Case &c : std::initializer_list<Case>{
+             {"", 0, 1, 1, "Unexpected end of input"},
+             {"[1,2", 4, 1, 5, "Unexpected end of input"},
+             {"{\"a\":1,}", 7, 1, 8, "Expected a string key"},
+             {"{\"a\" 1}", 5, 1, 6, "Expected ':'"},
+             {"[1 2]", 3, 1, 4, "Expected ',' or ']'"},
+             {"{\"a\":1]", 6, 1, 7, "Expected ',' or '}'"},
+             {"[1,]", 3, 1, 4, "Expected a value"},
+             {"[1.2.3e]", 1, 1, 2, "Invalid number"},
+             {"[01]", 1, 1, 2, "Invalid number"},
+             {"1e400", 0, 1, 1, "Number out of range"},
+             {"[1, 1e400]", 4, 1, 5, "Number out of range"},
+             {"{\n  \"a\": tru\n}", 9, 2, 8, "Invalid literal"},
+             {"[\n\"ok\",\n\"a\\x\"]", 10, 3, 3, "Invalid escape sequence"},
+             {"\"\\ud800\"", 1, 1, 2, "Invalid escape sequence"},
+             {"\"\\u12G4\"", 1, 1, 2, "Invalid escape sequence"},
+             {"\"tab\there\"", 4, 1, 5, "Control character in string"},
+             {"[\"open]", 1, 1, 2, "Unterminated string"},
+             {"{} {}", 3, 1, 4, "Trailing content"},
+             {"1 x", 2, 1, 3, "Trailing content"},
+         }) {
+        eee::ParseError error;
+        assert(!eee::validate(c.input, &error));
+        assert(error.offset == c.offset and error.message == c.message);
+        assert(error.line == c.line and error.column == c.column);
+        eee::ParseError parse_error;
+        assert(!eee::parse(c.input, parse_error));
+        assert(parse_error.offset == c.offset);
+        assert(parse_error.message == c.message);
+    }
+    for (auto valid : {"0", " -1.5e+3 ", "1e-400", "[1e-400]",
+                       "\"\\ud83d\\ude00\\n\\/\"", "[]", "{}",
+                       "[[],{\"a\":[null,true,false]}]"}) {
+        assert(eee::validate(valid));
+        assert(eee::parse(valid));
+    }
+
+    // validation against a full parse
+    const std::string records = make_records(20000);
+    eee::JsonParser parser;
+    const int validate_speed = mbps(records, [&] {
+        const bool ok = parser.validate(records);
+        assert(ok);
+    });
+    const int parse_speed = mbps(records, [&] {
+        auto ret = parser.parse(records);
+        assert(ret);
+    });
+    std::cout << "validate " << validate_speed << " MB/s, parse "
+              << parse_speed << " MB/s\n";
+}
+
+void test13() {
+    // hostile nesting fails at the limit instead of exhausting the stack
+    const std::string deep =
+        std::string(100000, '[') + std::string(100000, ']');
+    eee::ParseError error;
+    assert(!eee::parse(deep, error));
+    assert(error.offset == 1024);
+    assert(error.message == std::string_view("Nesting too deep"));
+    assert(!eee::validate(deep, &error) and error.offset == 1024);
+    assert(!eee::from_cbor(std::string(100000, '\x81') + '\x80'));
+    assert(eee::validate(deep, nullptr, {.max_depth = 100000}));
+    assert(!eee::parse(
+        "[[[1]]]", {.max_depth = 2}, &error) and error.offset == 2);
+    assert(eee::parse("[[[1]]]", {.max_depth = 3}));
+    // the compact tree takes the same limits and does not recurse either
+    const std::string open(200000, '[');
+    assert(!eee::compact::parse(open));
+    assert(!eee::compact::parse(open, {.max_depth = 300000}));
+    assert(!eee::compact::parse(deep));
+    assert(!eee::compact::parse("[[[1]]]", {.max_depth = 2}));
+    auto compact_nested = eee::compact::parse(
+        "[[{\"a\":[1,{\"b\":[]}]}],2]", {.max_depth = 6});
+    assert(compact_nested
+           and compact_nested->root()[0][0]["a"][1]["b"].size() == 0);
+    assert(compact_nested->root()[1].get_int() == 2);
+    assert(!eee::parse("[1, 2]", {.max_size = 5}, &error));
+    assert(error.message == std::string_view("Input is too large"));
+
+    const std::string nested =
+        std::string(1000, '[') + "{\"a\":[1,{}]}" + std::string(1000, ']');
+    auto json = eee::parse(nested);
+    assert(json and eee::generate(*json) == nested);
+    const std::string pretty = eee::generate(
+        *eee::parse("{\"a\":[1,[],{\"b\":null}],\"c\":{}}"),
+        {.pretty = true, .indent = 2});
+    assert(pretty
+           == "{\n  \"a\": [\n    1,\n    [],\n    {\n      \"b\": null\n"
+              "    }\n  ],\n  \"c\": {}\n}");
+
+    // mutated documents: parse and validate agree, and what parses
+    // generates text that parses back to the same text
+    const std::string seed = "{\"a\":[1,-2.5e3,true,null,\"x\\\"y\\u0041\"],"
+                             "\"b\":{\"c\":[[],{}],\"d\":\"\\ud83d\\ude00\"}}";
+    const char alphabet[] = "[]{}:,\"\\0123456789-+.eEtrufalsn \n";
+    std::srand(37);
+    size_t parsed = 0;
+    for (int i = 0; i < 5000; ++i) {
+        std::string input = seed;
+        for (int n = std::rand() % 4 + 1; n > 0; --n) {
+            const size_t at = std::rand() % (input.size() + 1);
+            const char c = alphabet[std::rand() % (sizeof(alphabet) - 1)];
+            switch (std::rand() % 3) {
+                case 0: input.insert(at, 1, c); break;
+                case 1: if (at < input.size()) input.erase(at, 1); break;
+                default: if (at < input.size()) input[at] = c;
+            }
+        }
+        eee::ParseError parse_error, validate_error;
+        auto ret = eee::parse(input, parse_error);
+        assert(ret.has_value() == eee::validate(input, &validate_error));
+        if (!ret) {
+            assert(parse_error.offset == validate_error.offset);
+            assert(parse_error.offset <= input.size());
+            continue;
+        }
+        ++parsed;
+        const std::string text = eee::generate(*ret);
+        assert(eee::generate(eee::parse(text).value()) == text);
+    }
+    assert(parsed > 100);
+
+    // throughput on ordinary documents
+    const std::string records = make_records(2000);
+    const auto tree = eee::parse(records).value();
+    const size_t generated_size = eee::generate(tree).size();
+    const int parse_speed = mbps(records, [&] {
+        auto ret = eee::parse(records);
+        assert(ret);
+    });
+    const int generate_speed = mbps(records, [&] {
+        auto ret = eee::generate(tree);
+        assert(ret.size() == generated_size);
+    });
+    std::cout << "records: parse " << parse_speed << " MB/s, generate "
+              << generate_speed << " MB/s\n";
+}
+
+void test14() {
+    // escapes are decoded, and generated back with the shortest escape
+    auto json = eee::parse(
+        "[\"a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\", \"\\u00e9\\u6821\\ud83d\\ude00\","
+        "\"\\u0001\\u001f\"]");
+    assert(json);
+    assert(std::get<eee::String>((*json)[0].value_) == "a\"b\\c/d\b\f\n\r\t");
+    assert(std::get<eee::String>((*json)[1].value_)
+           == "é校\U0001F600");
+    assert(eee::generate(*json)
+           == "[\"a\\\"b\\\\c/d\\b\\f\\n\\r\\t\",\"é校\U0001F600\","
+              "\"\\u0001\\u001f\"]");
+    auto key = eee::parse("{\"k\\u0065y\":1}");
+    assert(key and (*key)["key"].value_.index() == 2);
+
+    // malformed UTF-8 anywhere is rejected where it starts
+    for (auto [bad, offset] : std::initializer_list<
+             std::pair<std::string_view, size_t>>{
+             {"\"\xc3\"", 1},              // truncated
+             {"[\"ok\",\"\xc0\xaf\"]", 7}, // overlong '/'
+             {"\"\xed\xa0\x80\"", 1},      // surrogate
+             {"\"\xf4\x90\x80\x80\"", 1},  // above U+10FFFF
+             {"\"abc\x80\"", 4},           // stray continuation
+         }) {
+        eee::ParseError error;
+        assert(!eee::parse(bad, error));
+        assert(error.offset == offset);
+        assert(error.message == std::string_view("Invalid UTF-8"));
+        assert(!eee::validate(bad));
+    }
+
+    // the sample of test0 round-trips, and so does a large multilingual
+    // document
+    const std::string sample =
+        "{\"checked\":true,\"host\":\"json-online.com\",\"object\":{\"t\":"
+        "\"json校验器\",\"w\":\"json检查\"}}";
+    assert(eee::generate(eee::parse(sample).value()) == sample);
+    std::string text = "[";
+    for (int i = 0; i < 2000; ++i) {
+        if (i != 0) text += ',';
+        text += "\"";
+        for (int j = 0; j < 20; ++j)
+            text += "json校验器 проверка ✓ ";
+        text += "\"";
+    }
+    text += "]";
+    const auto tree = eee::parse(text).value();
+    assert(eee::generate(tree) == text);
+    const int parse_speed = mbps(text, [&] {
+        auto ret = eee::parse(text);
+        assert(ret);
+    });
+    const int generate_speed = mbps(text, [&] {
+        auto ret = eee::generate(tree);
+        assert(ret.size() == text.size());
+    });
+    const int memcpy_speed = mbps(text, [&] {
+        std::string copy = text;
+        assert(copy.size() == text.size());
+    });
+    std::cout << "multilingual " << text.size() << " B: parse "
+              << parse_speed << " MB/s, generate " << generate_speed
+              << " MB/s, copy " << memcpy_speed << " MB/s\n";
+}
+
+void test15() {
+    const auto json = [](std::string_view text) {
+        return eee::parse(text).value();
+    };
+    // RFC 6902 appendix A; members come out in key order
+    const auto patched = [&json](std::string_view doc, std::string_view ops) {
+        eee::Json tree = json(doc);
+        return eee::apply_patch(tree, json(ops))
+                   ? eee::generate(tree)
+                   : std::string("failed");
+    };
+    assert(patched(R"({"foo":"bar"})",
+                   R"([{"op":"add","path":"/baz","value":"qux"}])")
+           == R"({"baz":"qux","foo":"bar"})");
+    assert(patched(R"({"foo":["bar","baz"]})",
+                   R"([{"op":"add","path":"/foo/1","value":"qux"}])")
+           == R"({"foo":["bar","qux","baz"]})");
+    assert(patched(R"({"baz":"qux","foo":"bar"})",
+                   R"([{"op":"remove","path":"/baz"}])")
+           == R"({"foo":"bar"})");
+    assert(patched(R"({"foo":["bar","qux","baz"]})",
+                   R"([{"op":"remove","path":"/foo/1"}])")
+           == R"({"foo":["bar","baz"]})");
+    assert(patched(R"({"baz":"qux","foo":"bar"})",
+                   R"([{"op":"replace","path":"/baz","value":"boo"}])")
+           == R"({"baz":"boo","foo":"bar"})");
+    assert(patched(R"({"foo":{"bar":"baz","waldo":"fred"},"qux":{"a":1}})",
+                   R"([{"op":"move","from":"/foo/waldo",)"
+                   R"("path":"/qux/thud"}])")
+           == R"({"foo":{"bar":"baz"},"qux":{"a":1,"thud":"fred"}})");
+    assert(patched(R"({"foo":["all","grass","cows","eat"]})",
+                   R"([{"op":"move","from":"/foo/1","path":"/foo/3"}])")
+           == R"({"foo":["all","cows","eat","grass"]})");
+    assert(patched(R"({"baz":"qux","foo":["a",2,"c"]})",
+                   R"([{"op":"test","path":"/baz","value":"qux"},)"
+                   R"({"op":"test","path":"/foo/1","value":2.0}])")
+           == R"({"baz":"qux","foo":["a",2,"c"]})");
+    assert(patched(R"({"baz":"qux"})",
+                   R"([{"op":"test","path":"/baz","value":"bar"}])")
+           == "failed");
+    assert(patched(R"({"foo":"bar"})",
+                   R"([{"op":"add","path":"/child","value":{"a":[1]}}])")
+           == R"({"child":{"a":[1]},"foo":"bar"})");
+    assert(patched(R"({"foo":"bar"})",
+                   R"([{"op":"add","path":"/baz/bat","value":"qux"}])")
+           == "failed");
+    assert(patched(R"({"/":9,"~1":10})",
+                   R"([{"op":"test","path":"/~01","value":10},)"
+                   R"({"op":"copy","from":"/~1","path":"/a~0b"}])")
+           == R"({"/":9,"a~b":9,"~1":10})");
+    assert(patched(R"({"foo":["bar"]})",
+                   R"([{"op":"add","path":"/foo/-","value":["abc"]}])")
+           == R"({"foo":["bar",["abc"]]})");
+    assert(patched(R"({"a":{"b":1}})",
+                   R"([{"op":"move","from":"/a","path":"/a/b"}])")
+           == "failed");
+    assert(patched("[1]", R"([{"op":"replace","path":"","value":{}}])")
+           == "{}");
+
+    // a failing operation undoes the ones before it, in reverse
+    const std::string doc = R"({"a":[1,2,3],"b":{"c":"d"},"e":null})";
+    eee::Json undone = json(doc);
+    auto ret = eee::apply_patch(
+        undone, json(R"([{"op":"add","path":"/a/-","value":4},)"
+                     R"({"op":"move","from":"/b/c","path":"/a/0"},)"
+                     R"({"op":"move","from":"/e","path":"/b"},)"
+                     R"({"op":"remove","path":"/a/1"},)"
+                     R"({"op":"copy","from":"/a","path":"/f"},)"
+                     R"({"op":"replace","path":"","value":[]},)"
+                     R"({"op":"add","path":"/x","value":1}])"));
+    assert(!ret);
+    assert(eee::generate(undone) == doc);
+
+    // RFC 7396 section 3 and some of appendix A
+    const auto merged = [&json](std::string_view doc, std::string_view patch) {
+        eee::Json tree = json(doc);
+        eee::merge_patch(tree, json(patch));
+        return eee::generate(tree);
+    };
+    assert(merged(R"({"title":"Goodbye!","author":{"givenName":"John",)"
+                  R"("familyName":"Doe"},"tags":["example","sample"],)"
+                  R"("content":"This will be unchanged"})",
+                  R"({"title":"Hello!","phoneNumber":"+01-234-567-8910",)"
+                  R"("author":{"familyName":null},"tags":["example"]})")
+           == R"({"author":{"givenName":"John"},)"
+              R"("content":"This will be unchanged",)"
+              R"("phoneNumber":"+01-234-567-8910","tags":["example"],)"
+              R"("title":"Hello!"})");
+    assert(merged(R"({"a":[{"b":"c"}]})", R"({"a":[1]})") == R"({"a":[1]})");
+    assert(merged(R"(["a","b"])", R"({"a":"b"})") == R"({"a":"b"})");
+    assert(merged(R"({"a":"foo"})", "null") == "null");
+    assert(merged("{}", R"({"a":{"bb":{"ccc":null}}})")
+           == R"({"a":{"bb":{}}})");
+
+    // values of an rvalue patch are moved in, not copied
+    eee::Json tree = json(make_records(100));
+    eee::Json ops = json(R"([{"op":"add","path":"/0/big","value":{}}])");
+    ops[0]["value"] = json(make_records(100));
+    const size_t before = allocation_count;
+    ret = eee::apply_patch(tree, std::move(ops));
+    assert(ret);
+    assert(allocation_count - before < 40);
+
+    // TrackedJson regenerates only what edits touched, and always agrees
+    // with generate()
+    std::srand(15);
+    eee::Json members = eee::Object();
+    eee::Json elements = json(make_records(50));
+    for (size_t i = 0; i < elements.size(); ++i)
+        members.insert(
+            std::pair<eee::String, eee::Json>{std::to_string(i), elements[i]});
+    eee::TrackedJson tracked{std::move(members)};
+    int applied = 0;
+    assert(tracked.generate() == eee::generate(tracked.root()));
+    for (int i = 0; i < 2000; ++i) {
+        const std::string at = "/" + std::to_string(std::rand() % 40);
+        const std::string value = std::to_string(std::rand());
+        switch (std::rand() % 7) {
+            case 0:
+                ret = tracked.apply_patch(json(
+                    R"([{"op":"replace","path":")" + at
+                    + R"(/score","value":)" + value + "}]"));
+                applied += ret;
+                break;
+            case 1:
+                ret = tracked.apply_patch(json(
+                    R"([{"op":"add","path":")" + at + R"(","value":)"
+                    + R"({"id":)" + value + "}}]"));
+                applied += ret;
+                break;
+            case 2:
+                ret = tracked.apply_patch(json(
+                    R"([{"op":"move","from":")" + at + R"(/tags",)"
+                    R"("path":"/0/t)" + value + R"("}])"));
+                applied += ret;
+                break;
+            case 3:
+                // fails at the test, so the remove is rolled back
+                ret = tracked.apply_patch(json(
+                    R"([{"op":"remove","path":")" + at + R"("},)"
+                    R"({"op":"test","path":"/0","value":0}])"));
+                assert(!ret);
+                break;
+            case 4:
+                tracked.merge_patch(json(
+                    R"({"x)" + value + R"(":{"y":[1]},"0":null})"));
+                break;
+            case 5:
+                if (eee::Json *name = tracked.edit(at + "/name"))
+                    *name = eee::String("edited " + value);
+                break;
+            default:
+                ret = tracked.apply_patch(json(
+                    R"([{"op":"remove","path":")" + at + R"("}])"));
+                applied += ret;
+        }
+        if (i % 3 == 0)
+            assert(tracked.generate() == eee::generate(tracked.root()));
+    }
+    assert(tracked.generate() == eee::generate(tracked.root()));
+    assert(applied > 200);
+
+    // small edits of a large document
+    eee::TrackedJson records{json(make_records(20000))};
+    const size_t size = records.generate().size();
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    for (int i = 0; i < 20; ++i) {
+        ret = records.apply_patch(json(
+            R"([{"op":"replace","path":"/)" + std::to_string(i * 997)
+            + R"(/name","value":"x"}])"));
+        assert(ret);
+        const size_t regenerated = records.generate().size();
+        assert(regenerated < size);
+    }
+    const std::chrono::duration<double> tracked_time = clock::now() - start;
+    const auto full_start = clock::now();
+    for (int i = 0; i < 2; ++i) {
+        auto text = eee::generate(records.root());
+        assert(text.size() < size);
+    }
+    const std::chrono::duration<double> full_time = clock::now() - full_start;
+    assert(records.generate() == eee::generate(records.root()));
+    std::cout << "records: patch and regenerate "
+              << static_cast<int>(tracked_time.count() / 20 * 1e6)
+              << " us, generate "
+              << static_cast<int>(full_time.count() / 2 * 1e6) << " us\n";
+}
+
 auto main() -> int {
     test1();
     test0();
+    test2();
+    test3();
+    test4();
+    test5();
+    test6();
+    test7();
+    test8();
+    test9();
+    test10();
+    test11();
+    test12();
+    test13();
+    test14();
+    test15();
     std::vector<int> vec(100);
     return 0;
 }
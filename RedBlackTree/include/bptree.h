@@ -0,0 +1,559 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define TEMPLATE_KV template <typename K, typename V>
+#define TEMPLATE_BPT_M_FUNC TEMPLATE_KV auto BPlusTree<K, V>::
+
+namespace rbt {
+namespace details {
+// 有序数组 keys[0, n) 中小于（OrEqual 时小于等于）key 的个数。
+// 节点只有几十个 key，整段比较比二分更快：int32_t 用 SIMD 一次比 4/8 个，
+// 其他算术类型用无分支的线性扫描，其余类型二分
+template <bool OrEqual, typename K>
+auto count_less(const K *keys, int n, const K &key) -> int {
+  if constexpr (std::is_same_v<K, int32_t>) {
+    int i = 0;
+    int res = 0;
+#if defined(__AVX2__)
+    const __m256i target8 = _mm256_set1_epi32(key);
+    for (; i + 8 <= n; i += 8) {
+      auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+      // OrEqual: !(keys > key)，否则 key > keys
+      auto mask = OrEqual ? _mm256_cmpgt_epi32(block, target8)
+                          : _mm256_cmpgt_epi32(target8, block);
+      const int bits = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+      res += OrEqual ? 8 - std::popcount(static_cast<unsigned>(bits))
+                     : std::popcount(static_cast<unsigned>(bits));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i target4 = _mm_set1_epi32(key);
+    for (; i + 4 <= n; i += 4) {
+      auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+      auto mask = OrEqual ? _mm_cmpgt_epi32(block, target4)
+                          : _mm_cmpgt_epi32(target4, block);
+      const int bits = _mm_movemask_ps(_mm_castsi128_ps(mask));
+      res += OrEqual ? 4 - std::popcount(static_cast<unsigned>(bits))
+                     : std::popcount(static_cast<unsigned>(bits));
+    }
+#endif
+    for (; i < n; ++i)
+      res += OrEqual ? !(key < keys[i]) : keys[i] < key;
+    return res;
+  } else if constexpr (std::is_arithmetic_v<K>) {
+    int res = 0;
+    for (int i = 0; i < n; ++i)
+      res += OrEqual ? !(key < keys[i]) : keys[i] < key;
+    return res;
+  } else if constexpr (OrEqual) {
+    return static_cast<int>(std::upper_bound(keys, keys + n, key) - keys);
+  } else {
+    return static_cast<int>(std::lower_bound(keys, keys + n, key) - keys);
+  }
+}
+} // namespace details
+
+// B+ 树有序表，接口与 Rbtree 一致。节点按缓存行对齐、约 256 字节，
+// 一次查找只碰 log_B(n) 个节点；叶子串成链表，区间遍历是顺序访存。
+// key/value 需要能默认构造（节点里是定长数组）。只能移动，不能复制
+template <typename K, typename V> class BPlusTree {
+  static constexpr size_t kNodeBytes = 256;
+
+public:
+  // 叶子能放的键值对数、内部节点能放的分隔 key 数
+  static constexpr int kLeafSlots = static_cast<int>(std::max<size_t>(
+      4, (kNodeBytes - 2 * sizeof(void *)) / (sizeof(K) + sizeof(V))));
+  static constexpr int kInnerSlots = static_cast<int>(std::max<size_t>(
+      4, (kNodeBytes - 2 * sizeof(void *)) / (sizeof(K) + sizeof(void *))));
+
+  BPlusTree() = default;
+  BPlusTree(const BPlusTree &) = delete;
+  auto operator=(const BPlusTree &) -> BPlusTree & = delete;
+  BPlusTree(BPlusTree &&value) noexcept { swap(value); }
+  auto operator=(BPlusTree &&value) noexcept -> BPlusTree & {
+    swap(value);
+    return *this;
+  }
+  ~BPlusTree() { destroy_all(); }
+
+  auto insert(K key, V value) -> void; // key 已存在时覆盖值
+  auto remove(const K &key) -> void;
+  auto contains(const K &key) const -> bool;
+  auto operator[](const K &key) -> V &;
+  auto size() const -> size_t { return size_; }
+  auto swap(BPlusTree &value) noexcept -> void;
+
+  template <bool Const> class Iterator;
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  auto begin() -> iterator { return {first_, 0}; }
+  auto end() -> iterator { return {}; }
+  auto begin() const -> const_iterator { return {first_, 0}; }
+  auto end() const -> const_iterator { return {}; }
+  auto find(const K &key) -> iterator;
+  auto lower_bound(const K &key) -> iterator; // 第一个 >= key
+  // [lo, hi) 内的元素，不复制
+  auto range(const K &lo, const K &hi) -> std::ranges::subrange<iterator>;
+  auto find(const K &key) const -> const_iterator;
+  auto lower_bound(const K &key) const -> const_iterator;
+  auto range(const K &lo, const K &hi) const
+      -> std::ranges::subrange<const_iterator>;
+
+private:
+  struct Node {
+    int count; // 叶子是键值对数，内部节点是分隔 key 数
+    bool leaf;
+  };
+  struct alignas(64) Leaf : Node {
+    Leaf *next = nullptr;
+    K keys[kLeafSlots];
+    V values[kLeafSlots];
+    Leaf() : Node{0, true} {}
+  };
+  // children[i] 里的 key 都在 [keys[i - 1], keys[i]) 内
+  struct alignas(64) Inner : Node {
+    K keys[kInnerSlots];
+    Node *children[kInnerSlots + 1];
+    Inner() : Node{0, false} {}
+  };
+  // 从根到叶子经过的内部节点和走的孩子下标
+  struct Path {
+    // 每层至少 kInnerSlots / 2 + 1 个孩子，32 层足够
+    std::array<Inner *, 32> nodes;
+    std::array<int, 32> slots;
+    int depth = 0;
+  };
+
+  auto find_leaf(const K &key, Path *path) const -> Leaf *;
+  auto split_leaf(Leaf *leaf, int pos, K key, V value) -> std::pair<K, Node *>;
+  auto insert_inner(Path &path, K key, Node *child) -> void;
+  auto rebalance_leaf(Path &path, Leaf *leaf) -> void;
+  auto rebalance_inner(Path &path, Inner *node) -> void;
+  auto destroy_all() -> void;
+
+  Node *root_ = nullptr;
+  Leaf *first_ = nullptr; // begin()
+  size_t size_ = 0;
+};
+
+// 前向迭代器，沿叶子链表走
+TEMPLATE_KV template <bool Const> class BPlusTree<K, V>::Iterator {
+public:
+  using iterator_category = std::forward_iterator_tag;
+  using difference_type = std::ptrdiff_t;
+  using value_type = std::pair<K, V>;
+  using reference =
+      std::pair<const K &, std::conditional_t<Const, const V &, V &>>;
+  using pointer = void;
+
+  Iterator() = default;
+  template <bool Other>
+    requires(Const and !Other)
+  Iterator(const Iterator<Other> &other)
+      : leaf_(other.leaf_), index_(other.index_) {}
+
+  auto key() const -> const K & { return leaf_->keys[index_]; }
+  auto value() const -> std::conditional_t<Const, const V &, V &> {
+    return leaf_->values[index_];
+  }
+  auto operator*() const -> reference { return {key(), value()}; }
+
+  auto operator++() -> Iterator & {
+    if (++index_ == leaf_->count) {
+      leaf_ = leaf_->next;
+      index_ = 0;
+    }
+    return *this;
+  }
+  auto operator++(int) -> Iterator {
+    auto res = *this;
+    ++*this;
+    return res;
+  }
+  auto operator==(const Iterator &other) const -> bool {
+    return leaf_ == other.leaf_ and index_ == other.index_;
+  }
+
+private:
+  friend class BPlusTree;
+  friend class Iterator<!Const>;
+  Iterator(Leaf *leaf, int index) : leaf_(leaf), index_(index) {}
+
+  Leaf *leaf_ = nullptr;
+  int index_ = 0;
+};
+
+TEMPLATE_BPT_M_FUNC find_leaf(const K &key, Path *path) const->Leaf * {
+  auto node = root_;
+  while (!node->leaf) {
+    auto inner = static_cast<Inner *>(node);
+    const int slot =
+        details::count_less<true>(inner->keys, inner->count, key);
+    if (path != nullptr) {
+      path->nodes[path->depth] = inner;
+      path->slots[path->depth++] = slot;
+    }
+    node = inner->children[slot];
+  }
+  return static_cast<Leaf *>(node);
+}
+
+TEMPLATE_BPT_M_FUNC contains(const K &key) const->bool {
+  if (root_ == nullptr)
+    return false;
+  auto leaf = find_leaf(key, nullptr);
+  const int pos = details::count_less<false>(leaf->keys, leaf->count, key);
+  return pos < leaf->count and !(key < leaf->keys[pos]);
+}
+
+TEMPLATE_BPT_M_FUNC operator[](const K &key)->V & {
+  auto res = find(key);
+  if (res != end())
+    return res.value();
+  insert(key, V{});
+  return find(key).value();
+}
+
+TEMPLATE_BPT_M_FUNC insert(K key, V value)->void {
+  if (root_ == nullptr) {
+    auto leaf = new Leaf();
+    leaf->keys[0] = std::move(key);
+    leaf->values[0] = std::move(value);
+    leaf->count = 1;
+    root_ = first_ = leaf;
+    size_ = 1;
+    return;
+  }
+  Path path;
+  auto leaf = find_leaf(key, &path);
+  const int pos = details::count_less<false>(leaf->keys, leaf->count, key);
+  if (pos < leaf->count and !(key < leaf->keys[pos])) {
+    leaf->values[pos] = std::move(value);
+    return;
+  }
+  ++size_;
+  if (leaf->count < kLeafSlots) {
+    std::move_backward(leaf->keys + pos, leaf->keys + leaf->count,
+                       leaf->keys + leaf->count + 1);
+    std::move_backward(leaf->values + pos, leaf->values + leaf->count,
+                       leaf->values + leaf->count + 1);
+    leaf->keys[pos] = std::move(key);
+    leaf->values[pos] = std::move(value);
+    ++leaf->count;
+    return;
+  }
+  auto [separator, right] = split_leaf(leaf, pos, std::move(key),
+                                       std::move(value));
+  insert_inner(path, std::move(separator), right);
+}
+
+// 满的叶子加上新键值对一分为二，返回右半的第一个 key 和右半
+TEMPLATE_BPT_M_FUNC split_leaf(Leaf *leaf, int pos, K key, V value)
+    ->std::pair<K, Node *> {
+  auto right = new Leaf();
+  right->next = leaf->next;
+  leaf->next = right;
+  const int left_count = (kLeafSlots + 1) / 2;
+  // 新键值对落在哪一半，就先把另一半搬走再在这一半里插入
+  if (pos < left_count) {
+    const int moved = kLeafSlots - (left_count - 1);
+    std::move(leaf->keys + left_count - 1, leaf->keys + kLeafSlots,
+              right->keys);
+    std::move(leaf->values + left_count - 1, leaf->values + kLeafSlots,
+              right->values);
+    std::move_backward(leaf->keys + pos, leaf->keys + left_count - 1,
+                       leaf->keys + left_count);
+    std::move_backward(leaf->values + pos, leaf->values + left_count - 1,
+                       leaf->values + left_count);
+    leaf->keys[pos] = std::move(key);
+    leaf->values[pos] = std::move(value);
+    right->count = moved;
+  } else {
+    const int at = pos - left_count;
+    std::move(leaf->keys + left_count, leaf->keys + pos, right->keys);
+    std::move(leaf->values + left_count, leaf->values + pos, right->values);
+    right->keys[at] = std::move(key);
+    right->values[at] = std::move(value);
+    std::move(leaf->keys + pos, leaf->keys + kLeafSlots,
+              right->keys + at + 1);
+    std::move(leaf->values + pos, leaf->values + kLeafSlots,
+              right->values + at + 1);
+    right->count = kLeafSlots + 1 - left_count;
+  }
+  leaf->count = left_count;
+  return {right->keys[0], right};
+}
+
+// 把 (key, child) 插到 path 最底层内部节点里 child 的左兄弟之后，满了就分裂，
+// 中间的 key 上移，一直到根
+TEMPLATE_BPT_M_FUNC insert_inner(Path &path, K key, Node *child)->void {
+  while (path.depth > 0) {
+    auto node = path.nodes[--path.depth];
+    const int slot = path.slots[path.depth];
+    if (node->count < kInnerSlots) {
+      std::move_backward(node->keys + slot, node->keys + node->count,
+                         node->keys + node->count + 1);
+      std::move_backward(node->children + slot + 1,
+                         node->children + node->count + 1,
+                         node->children + node->count + 2);
+      node->keys[slot] = std::move(key);
+      node->children[slot + 1] = child;
+      ++node->count;
+      return;
+    }
+    // 先在临时数组里排好 kInnerSlots + 1 个 key，再分成两半
+    std::array<K, kInnerSlots + 1> keys;
+    std::array<Node *, kInnerSlots + 2> children;
+    std::move(node->keys, node->keys + slot, keys.begin());
+    keys[slot] = std::move(key);
+    std::move(node->keys + slot, node->keys + kInnerSlots,
+              keys.begin() + slot + 1);
+    std::copy(node->children, node->children + slot + 1, children.begin());
+    children[slot + 1] = child;
+    std::copy(node->children + slot + 1, node->children + kInnerSlots + 1,
+              children.begin() + slot + 2);
+
+    const int left_count = (kInnerSlots + 1) / 2;
+    auto right = new Inner();
+    right->count = kInnerSlots - left_count;
+    std::move(keys.begin(), keys.begin() + left_count, node->keys);
+    std::copy(children.begin(), children.begin() + left_count + 1,
+              node->children);
+    node->count = left_count;
+    std::move(keys.begin() + left_count + 1, keys.end(), right->keys);
+    std::copy(children.begin() + left_count + 1, children.end(),
+              right->children);
+    key = std::move(keys[left_count]);
+    child = right;
+  }
+  auto root = new Inner();
+  root->keys[0] = std::move(key);
+  root->children[0] = root_;
+  root->children[1] = child;
+  root->count = 1;
+  root_ = root;
+}
+
+TEMPLATE_BPT_M_FUNC remove(const K &key)->void {
+  if (root_ == nullptr)
+    return;
+  Path path;
+  auto leaf = find_leaf(key, &path);
+  const int pos = details::count_less<false>(leaf->keys, leaf->count, key);
+  if (pos == leaf->count or key < leaf->keys[pos])
+    return;
+  std::move(leaf->keys + pos + 1, leaf->keys + leaf->count, leaf->keys + pos);
+  std::move(leaf->values + pos + 1, leaf->values + leaf->count,
+            leaf->values + pos);
+  --leaf->count;
+  --size_;
+  if (leaf == root_) {
+    if (leaf->count == 0) {
+      delete leaf;
+      root_ = first_ = nullptr;
+    }
+    return;
+  }
+  if (leaf->count < kLeafSlots / 2)
+    rebalance_leaf(path, leaf);
+}
+
+// 叶子不足半满：兄弟多就借一个，否则和兄弟合并，父节点少一个 key
+TEMPLATE_BPT_M_FUNC rebalance_leaf(Path &path, Leaf *leaf)->void {
+  auto father = path.nodes[--path.depth];
+  const int slot = path.slots[path.depth];
+  auto left = slot > 0 ? static_cast<Leaf *>(father->children[slot - 1])
+                       : nullptr;
+  auto right = slot < father->count
+                   ? static_cast<Leaf *>(father->children[slot + 1])
+                   : nullptr;
+  if (left != nullptr and left->count > kLeafSlots / 2) {
+    std::move_backward(leaf->keys, leaf->keys + leaf->count,
+                       leaf->keys + leaf->count + 1);
+    std::move_backward(leaf->values, leaf->values + leaf->count,
+                       leaf->values + leaf->count + 1);
+    --left->count;
+    leaf->keys[0] = std::move(left->keys[left->count]);
+    leaf->values[0] = std::move(left->values[left->count]);
+    ++leaf->count;
+    father->keys[slot - 1] = leaf->keys[0];
+    return;
+  }
+  if (right != nullptr and right->count > kLeafSlots / 2) {
+    leaf->keys[leaf->count] = std::move(right->keys[0]);
+    leaf->values[leaf->count] = std::move(right->values[0]);
+    ++leaf->count;
+    std::move(right->keys + 1, right->keys + right->count, right->keys);
+    std::move(right->values + 1, right->values + right->count, right->values);
+    --right->count;
+    father->keys[slot] = right->keys[0];
+    return;
+  }
+  // 合并到左边那个，去掉父节点里两者之间的 key
+  int gone = slot; // 父节点里被去掉的 key 下标，孩子下标为 gone + 1
+  if (left != nullptr) {
+    right = leaf;
+    leaf = left;
+    gone = slot - 1;
+  }
+  std::move(right->keys, right->keys + right->count, leaf->keys + leaf->count);
+  std::move(right->values, right->values + right->count,
+            leaf->values + leaf->count);
+  leaf->count += right->count;
+  leaf->next = right->next;
+  delete right;
+  std::move(father->keys + gone + 1, father->keys + father->count,
+            father->keys + gone);
+  std::copy(father->children + gone + 2, father->children + father->count + 1,
+            father->children + gone + 1);
+  --father->count;
+  rebalance_inner(path, father);
+}
+
+// 内部节点少了一个 key 之后的修正，借的时候经父节点转一手
+TEMPLATE_BPT_M_FUNC rebalance_inner(Path &path, Inner *node)->void {
+  for (;;) {
+    if (node == root_) {
+      if (node->count == 0) {
+        root_ = node->children[0];
+        delete node;
+      }
+      return;
+    }
+    if (node->count >= kInnerSlots / 2)
+      return;
+    auto father = path.nodes[--path.depth];
+    const int slot = path.slots[path.depth];
+    auto left = slot > 0 ? static_cast<Inner *>(father->children[slot - 1])
+                         : nullptr;
+    auto right = slot < father->count
+                     ? static_cast<Inner *>(father->children[slot + 1])
+                     : nullptr;
+    if (left != nullptr and left->count > kInnerSlots / 2) {
+      std::move_backward(node->keys, node->keys + node->count,
+                         node->keys + node->count + 1);
+      std::copy_backward(node->children, node->children + node->count + 1,
+                         node->children + node->count + 2);
+      node->keys[0] = std::move(father->keys[slot - 1]);
+      node->children[0] = left->children[left->count];
+      father->keys[slot - 1] = std::move(left->keys[left->count - 1]);
+      --left->count;
+      ++node->count;
+      return;
+    }
+    if (right != nullptr and right->count > kInnerSlots / 2) {
+      node->keys[node->count] = std::move(father->keys[slot]);
+      node->children[node->count + 1] = right->children[0];
+      ++node->count;
+      father->keys[slot] = std::move(right->keys[0]);
+      std::move(right->keys + 1, right->keys + right->count, right->keys);
+      std::copy(right->children + 1, right->children + right->count + 1,
+                right->children);
+      --right->count;
+      return;
+    }
+    int gone = slot;
+    if (left != nullptr) {
+      right = node;
+      node = left;
+      gone = slot - 1;
+    }
+    node->keys[node->count] = std::move(father->keys[gone]);
+    std::move(right->keys, right->keys + right->count,
+              node->keys + node->count + 1);
+    std::copy(right->children, right->children + right->count + 1,
+              node->children + node->count + 1);
+    node->count += right->count + 1;
+    delete right;
+    std::move(father->keys + gone + 1, father->keys + father->count,
+              father->keys + gone);
+    std::copy(father->children + gone + 2,
+              father->children + father->count + 1,
+              father->children + gone + 1);
+    --father->count;
+    node = father;
+  }
+}
+
+TEMPLATE_BPT_M_FUNC swap(BPlusTree &value) noexcept -> void {
+  std::swap(root_, value.root_);
+  std::swap(first_, value.first_);
+  std::swap(size_, value.size_);
+}
+
+// 用显式栈逐个释放，不递归
+TEMPLATE_BPT_M_FUNC destroy_all()->void {
+  std::vector<Node *> pending;
+  if (root_ != nullptr)
+    pending.push_back(root_);
+  while (!pending.empty()) {
+    auto node = pending.back();
+    pending.pop_back();
+    if (node->leaf) {
+      delete static_cast<Leaf *>(node);
+      continue;
+    }
+    auto inner = static_cast<Inner *>(node);
+    pending.insert(pending.end(), inner->children,
+                   inner->children + inner->count + 1);
+    delete inner;
+  }
+  root_ = first_ = nullptr;
+  size_ = 0;
+}
+
+TEMPLATE_BPT_M_FUNC lower_bound(const K &key)->iterator {
+  if (root_ == nullptr)
+    return end();
+  auto leaf = find_leaf(key, nullptr);
+  const int pos = details::count_less<false>(leaf->keys, leaf->count, key);
+  // 叶子里都小于 key 时答案是下一个叶子的第一个
+  if (pos == leaf->count)
+    return {leaf->next, 0};
+  return {leaf, pos};
+}
+
+TEMPLATE_BPT_M_FUNC find(const K &key)->iterator {
+  auto res = lower_bound(key);
+  if (res != end() and key < res.key())
+    return end();
+  return res;
+}
+
+TEMPLATE_BPT_M_FUNC range(const K &lo, const K &hi)
+    ->std::ranges::subrange<iterator> {
+  if (!(lo < hi))
+    return {end(), end()};
+  return {lower_bound(lo), lower_bound(hi)};
+}
+
+// const 版本复用上面的实现
+TEMPLATE_BPT_M_FUNC find(const K &key) const->const_iterator {
+  return const_cast<BPlusTree *>(this)->find(key);
+}
+TEMPLATE_BPT_M_FUNC lower_bound(const K &key) const->const_iterator {
+  return const_cast<BPlusTree *>(this)->lower_bound(key);
+}
+TEMPLATE_BPT_M_FUNC range(const K &lo, const K &hi) const
+    ->std::ranges::subrange<const_iterator> {
+  auto res = const_cast<BPlusTree *>(this)->range(lo, hi);
+  return {res.begin(), res.end()};
+}
+
+} // namespace rbt
+
+#undef TEMPLATE_KV
+#undef TEMPLATE_BPT_M_FUNC
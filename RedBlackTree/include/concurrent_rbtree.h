@@ -0,0 +1,163 @@
+#pragma once
+#include "persistent_rbtree.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define TEMPLATE_KV template <typename K, typename V>
+#define TEMPLATE_CRBT_M_FUNC TEMPLATE_KV auto ConcurrentRbtree<K, V>::
+
+namespace rbt {
+namespace details {
+// 每个线程固定用一个读计数条带，按线程创建顺序轮流分配
+inline auto stripe_index() -> size_t {
+  static std::atomic<size_t> next = 0;
+  thread_local const size_t index =
+      next.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+} // namespace details
+
+// 多线程共享的有序表。写操作之间用互斥锁串行，每次写完发布一个新的
+// PersistentRbtree 快照；查找读当前发布的快照，不加锁，互不阻塞，也不等写。
+// 被替换下来的快照攒够一批后等所有可能还在读它们的线程离开再释放（RCU）：
+// 读者进入时在自己条带上当前纪元奇偶对应的计数加一，写者翻转纪元后
+// 等旧奇偶的计数全部归零
+template <typename K, typename V> class ConcurrentRbtree {
+public:
+  using Snapshot = typename PersistentRbtree<K, V>::Snapshot;
+
+  ConcurrentRbtree() : published_(new Snapshot()) {}
+  ConcurrentRbtree(const ConcurrentRbtree &) = delete;
+  auto operator=(const ConcurrentRbtree &) -> ConcurrentRbtree & = delete;
+  ~ConcurrentRbtree();
+
+  // key 已存在时覆盖值
+  auto insert(K key, V value) -> void;
+  auto remove(const K &key) -> void;
+  // 读到的值复制出来，离开读区后节点可能被释放
+  auto find(const K &key) const -> std::optional<V>;
+  auto contains(const K &key) const -> bool;
+  auto size() const -> size_t;
+  // 当前版本，可以在不阻塞写者的情况下任意长时间遍历
+  auto snapshot() const -> Snapshot;
+
+private:
+  static constexpr size_t kStripes = 64;
+  // 攒够这么多个旧版本才等一次宽限期
+  static constexpr size_t kRetireBatch = 64;
+
+  struct alignas(64) Stripe {
+    std::atomic<int64_t> readers[2] = {0, 0};
+  };
+
+  // 读区：构造时登记，析构时离开
+  class ReadGuard {
+  public:
+    explicit ReadGuard(const ConcurrentRbtree &tree);
+    ReadGuard(const ReadGuard &) = delete;
+    auto operator=(const ReadGuard &) -> ReadGuard & = delete;
+    ~ReadGuard() { counter_->fetch_sub(1, std::memory_order_release); }
+
+  private:
+    std::atomic<int64_t> *counter_;
+  };
+
+  // 调用时持有 write_mutex_
+  auto publish() -> void;
+  auto synchronize() -> void;
+
+  std::mutex write_mutex_;
+  PersistentRbtree<K, V> tree_; // 只有持锁的写者访问
+  std::vector<Snapshot *> retired_;
+  std::atomic<Snapshot *> published_;
+  std::atomic<uint64_t> epoch_ = 0;
+  mutable Stripe stripes_[kStripes];
+};
+
+TEMPLATE_KV ConcurrentRbtree<K, V>::ReadGuard::ReadGuard(
+    const ConcurrentRbtree &tree) {
+  auto &stripe = tree.stripes_[details::stripe_index() % kStripes];
+  // 登记后纪元没变才算进入，否则写者可能已经错过这次登记
+  for (;;) {
+    const auto epoch = tree.epoch_.load();
+    counter_ = &stripe.readers[epoch & 1];
+    counter_->fetch_add(1);
+    if (tree.epoch_.load() == epoch)
+      return;
+    counter_->fetch_sub(1, std::memory_order_release);
+  }
+}
+
+TEMPLATE_KV ConcurrentRbtree<K, V>::~ConcurrentRbtree() {
+  for (auto snapshot : retired_)
+    delete snapshot;
+  delete published_.load();
+}
+
+TEMPLATE_CRBT_M_FUNC insert(K key, V value)->void {
+  std::lock_guard lock(write_mutex_);
+  tree_.insert(std::move(key), std::move(value));
+  publish();
+}
+
+TEMPLATE_CRBT_M_FUNC remove(const K &key)->void {
+  std::lock_guard lock(write_mutex_);
+  if (!tree_.contains(key))
+    return;
+  tree_.remove(key);
+  publish();
+}
+
+TEMPLATE_CRBT_M_FUNC find(const K &key) const->std::optional<V> {
+  ReadGuard guard(*this);
+  if (auto value = published_.load()->find(key); value != nullptr)
+    return *value;
+  return std::nullopt;
+}
+
+TEMPLATE_CRBT_M_FUNC contains(const K &key) const->bool {
+  ReadGuard guard(*this);
+  return published_.load()->contains(key);
+}
+
+TEMPLATE_CRBT_M_FUNC size() const->size_t {
+  ReadGuard guard(*this);
+  return published_.load()->size();
+}
+
+TEMPLATE_CRBT_M_FUNC snapshot() const->Snapshot {
+  ReadGuard guard(*this);
+  return *published_.load();
+}
+
+// 发布的快照持有根的引用，之后的写会复制路径而不会原地改它能看到的节点
+TEMPLATE_CRBT_M_FUNC publish()->void {
+  auto old = published_.exchange(new Snapshot(tree_.snapshot()));
+  retired_.push_back(old);
+  if (retired_.size() < kRetireBatch)
+    return;
+  synchronize();
+  for (auto snapshot : retired_)
+    delete snapshot;
+  retired_.clear();
+}
+
+// 翻转纪元后，旧奇偶上登记的读者可能还拿着已替换的快照，等它们离开；
+// 新登记的读者只能读到翻转前发布的快照
+TEMPLATE_CRBT_M_FUNC synchronize()->void {
+  const auto epoch = epoch_.fetch_add(1);
+  for (auto &stripe : stripes_) {
+    while (stripe.readers[epoch & 1].load() != 0)
+      std::this_thread::yield();
+  }
+}
+
+} // namespace rbt
+
+#undef TEMPLATE_KV
+#undef TEMPLATE_CRBT_M_FUNC
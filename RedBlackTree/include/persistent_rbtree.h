@@ -0,0 +1,391 @@
+#pragma once
+#include "rbtree.h"
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#define TEMPLATE_KV template <typename K, typename V>
+#define TEMPLATE_PRBT_M_FUNC TEMPLATE_KV auto PersistentRbtree<K, V>::
+
+namespace rbt {
+namespace details {
+// 持久化树的节点，被多少个父节点（或快照）引用就有多少计数。
+// 计数为 1 且父节点也只属于自己时才能原地修改，否则先复制
+template <typename K, typename V> struct PNode {
+  K key;
+  V value;
+  std::atomic<uint32_t> refs;
+  Color color_;
+  PNode *l_node;
+  PNode *r_node;
+
+  PNode(K key, V value, Color color, PNode *l_node, PNode *r_node)
+      : key(std::move(key)), value(std::move(value)), refs(1), color_(color),
+        l_node(l_node), r_node(r_node) {}
+
+  auto color() const -> Color { return color_; }
+  auto set_color(Color color) -> void { color_ = color; }
+};
+} // namespace details
+
+// 写时复制的红黑树。insert/remove 复制查找路径上被共享的节点，O(log n)；
+// 复制整棵树和 snapshot() 都是 O(1)。
+// 一棵树同一时间只能有一个线程写；快照不可变，可以交给任意线程读、复制和析构，
+// 不需要加锁。最后一个引用消失时节点随之释放
+template <typename K, typename V> class PersistentRbtree {
+  using Node = details::PNode<K, V>;
+  // 2 * log2(n + 1)，n < 2^48
+  static constexpr size_t kMaxHeight = 96;
+
+public:
+  class Iterator;
+  class Snapshot;
+  using const_iterator = Iterator;
+
+  PersistentRbtree() = default;
+  PersistentRbtree(const PersistentRbtree &value) = default;
+  auto operator=(const PersistentRbtree &value)
+      -> PersistentRbtree & = default;
+  PersistentRbtree(PersistentRbtree &&value) noexcept = default;
+  auto operator=(PersistentRbtree &&value) noexcept
+      -> PersistentRbtree & = default;
+  ~PersistentRbtree() = default;
+
+  // key 已存在时覆盖值
+  auto insert(K key, V value) -> void;
+  auto remove(const K &key) -> void;
+  // 不存在时为空
+  auto find(const K &key) const -> const V * { return current_.find(key); }
+  auto contains(const K &key) const -> bool { return current_.contains(key); }
+  auto size() const -> size_t { return current_.size(); }
+  auto begin() const -> const_iterator { return current_.begin(); }
+  auto end() const -> const_iterator { return current_.end(); }
+
+  // 当前版本的只读视图，O(1)。之后的修改不影响它
+  auto snapshot() const -> Snapshot { return current_; }
+
+private:
+  static auto retain(Node *node) -> void;
+  static auto release(Node *node) -> void;
+  // 保证 slot 指向的节点只属于自己，必要时复制，返回该节点
+  static auto unique(Node *&slot) -> Node *;
+  static auto rotate_left(Node *&slot) -> void;
+  static auto rotate_right(Node *&slot) -> void;
+
+  Snapshot current_;
+};
+
+TEMPLATE_KV class PersistentRbtree<K, V>::Snapshot {
+public:
+  Snapshot() = default;
+  Snapshot(const Snapshot &value) : root_(value.root_), size_(value.size_) {
+    retain(root_);
+  }
+  auto operator=(const Snapshot &value) -> Snapshot & {
+    Snapshot copy(value);
+    std::swap(root_, copy.root_);
+    std::swap(size_, copy.size_);
+    return *this;
+  }
+  Snapshot(Snapshot &&value) noexcept
+      : root_(std::exchange(value.root_, nullptr)),
+        size_(std::exchange(value.size_, 0)) {}
+  auto operator=(Snapshot &&value) noexcept -> Snapshot & {
+    std::swap(root_, value.root_);
+    std::swap(size_, value.size_);
+    return *this;
+  }
+  ~Snapshot() { release(root_); }
+
+  auto find(const K &key) const -> const V *;
+  auto contains(const K &key) const -> bool { return find(key) != nullptr; }
+  auto size() const -> size_t { return size_; }
+  auto begin() const -> const_iterator { return const_iterator(root_); }
+  auto end() const -> const_iterator { return {}; }
+
+private:
+  friend class PersistentRbtree;
+  Node *root_ = nullptr;
+  size_t size_ = 0;
+};
+
+// 前向迭代器，用栈记录还没访问的祖先，不依赖父指针
+TEMPLATE_KV class PersistentRbtree<K, V>::Iterator {
+public:
+  using iterator_category = std::forward_iterator_tag;
+  using difference_type = std::ptrdiff_t;
+  using value_type = std::pair<K, V>;
+  using reference = std::pair<const K &, const V &>;
+  using pointer = void;
+
+  Iterator() = default;
+
+  auto key() const -> const K & { return stack_[depth_ - 1]->key; }
+  auto value() const -> const V & { return stack_[depth_ - 1]->value; }
+  auto operator*() const -> reference { return {key(), value()}; }
+
+  auto operator++() -> Iterator & {
+    auto node = stack_[--depth_];
+    push_left(node->r_node);
+    return *this;
+  }
+  auto operator++(int) -> Iterator {
+    auto res = *this;
+    ++*this;
+    return res;
+  }
+  auto operator==(const Iterator &other) const -> bool {
+    return depth_ == other.depth_ and
+           (depth_ == 0 or stack_[depth_ - 1] == other.stack_[depth_ - 1]);
+  }
+
+private:
+  friend class Snapshot;
+  explicit Iterator(const Node *root) { push_left(root); }
+
+  auto push_left(const Node *node) -> void {
+    for (; node != nullptr; node = node->l_node) {
+      assert(depth_ < kMaxHeight);
+      stack_[depth_++] = node;
+    }
+  }
+
+  std::array<const Node *, kMaxHeight> stack_{};
+  size_t depth_ = 0;
+};
+
+TEMPLATE_KV auto PersistentRbtree<K, V>::Snapshot::find(const K &key) const
+    -> const V * {
+  for (const Node *node = root_; node != nullptr;) {
+    if (key < node->key)
+      node = node->l_node;
+    else if (node->key < key)
+      node = node->r_node;
+    else
+      return &node->value;
+  }
+  return nullptr;
+}
+
+TEMPLATE_PRBT_M_FUNC retain(Node *node)->void {
+  if (node != nullptr)
+    node->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 计数归零时释放，孩子的计数随之减一，用显式栈代替递归
+TEMPLATE_PRBT_M_FUNC release(Node *node)->void {
+  std::vector<Node *> pending;
+  while (node != nullptr) {
+    if (node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      if (node->l_node != nullptr)
+        pending.push_back(node->l_node);
+      if (node->r_node != nullptr)
+        pending.push_back(node->r_node);
+      delete node;
+    }
+    if (pending.empty())
+      break;
+    node = pending.back();
+    pending.pop_back();
+  }
+}
+
+TEMPLATE_PRBT_M_FUNC unique(Node *&slot)->Node * {
+  auto node = slot;
+  // 与其他线程 release 时的 acq_rel 配对，它们对节点的读取都已结束
+  if (node->refs.load(std::memory_order_acquire) == 1)
+    return node;
+  auto copy = new Node(node->key, node->value, node->color(), node->l_node,
+                       node->r_node);
+  retain(copy->l_node);
+  retain(copy->r_node);
+  slot = copy;
+  release(node);
+  return copy;
+}
+
+TEMPLATE_PRBT_M_FUNC rotate_left(Node *&slot)->void {
+  auto X = slot;
+  auto Y = X->r_node;
+  X->r_node = Y->l_node;
+  Y->l_node = X;
+  slot = Y;
+}
+
+TEMPLATE_PRBT_M_FUNC rotate_right(Node *&slot)->void {
+  auto X = slot;
+  auto Y = X->l_node;
+  X->l_node = Y->r_node;
+  Y->r_node = X;
+  slot = Y;
+}
+
+// 下降时把路径上的节点都变成自己的，修正沿 path 向上，
+// 需要改颜色的叔节点也先复制
+TEMPLATE_PRBT_M_FUNC insert(K key, V value)->void {
+  using details::Color;
+  auto &root = current_.root_;
+  std::array<Node *, kMaxHeight> path;
+  int depth = 0;
+  auto slot_of = [&](int i) -> Node *& {
+    if (i == 0)
+      return root;
+    auto father = path[i - 1];
+    return father->l_node == path[i] ? father->l_node : father->r_node;
+  };
+
+  Node **slot = &root;
+  while (*slot != nullptr) {
+    auto node = unique(*slot);
+    if (key < node->key) {
+      slot = &node->l_node;
+    } else if (node->key < key) {
+      slot = &node->r_node;
+    } else {
+      node->value = std::move(value);
+      return;
+    }
+    assert(depth < static_cast<int>(kMaxHeight));
+    path[depth++] = node;
+  }
+  auto node = new Node(std::move(key), std::move(value),
+                       depth == 0 ? Color::BLACK : Color::RED, nullptr,
+                       nullptr);
+  *slot = node;
+  ++current_.size_;
+
+  for (int i = depth - 1; i > 0 and details::is_red(path[i]);) {
+    auto father = path[i];
+    auto grandfather = path[i - 1];
+    const bool left = (grandfather->l_node == father);
+    auto &uncle = left ? grandfather->r_node : grandfather->l_node;
+    if (details::is_red(uncle)) {
+      // Case 3
+      father->set_color(Color::BLACK);
+      unique(uncle)->set_color(Color::BLACK);
+      grandfather->set_color(Color::RED);
+      node = grandfather;
+      i -= 2;
+      continue;
+    }
+    if (node == (left ? father->r_node : father->l_node)) {
+      // Case 5
+      left ? rotate_left(grandfather->l_node)
+           : rotate_right(grandfather->r_node);
+      father = left ? grandfather->l_node : grandfather->r_node;
+    }
+    // Case 4
+    father->set_color(Color::BLACK);
+    grandfather->set_color(Color::RED);
+    left ? rotate_right(slot_of(i - 1)) : rotate_left(slot_of(i - 1));
+    break;
+  }
+  root->set_color(Color::BLACK);
+}
+
+TEMPLATE_PRBT_M_FUNC remove(const K &key)->void {
+  using details::Color;
+  // 先只读地确认存在，不存在时不复制任何节点
+  if (!contains(key))
+    return;
+  auto &root = current_.root_;
+  // 修正中 Case 1 的旋转会让路径多一层
+  std::array<Node *, kMaxHeight + 1> path;
+  int depth = 0;
+  auto slot_of = [&](int i) -> Node *& {
+    if (i == 0)
+      return root;
+    auto father = path[i - 1];
+    return father->l_node == path[i] ? father->l_node : father->r_node;
+  };
+
+  Node **slot = &root;
+  auto node = unique(*slot);
+  while (key < node->key or node->key < key) {
+    path[depth++] = node;
+    slot = key < node->key ? &node->l_node : &node->r_node;
+    node = unique(*slot);
+  }
+  if (node->l_node != nullptr and node->r_node != nullptr) {
+    // 和后继交换键值，改为摘掉后继
+    auto target = node;
+    path[depth++] = node;
+    slot = &node->r_node;
+    node = unique(*slot);
+    while (node->l_node != nullptr) {
+      path[depth++] = node;
+      slot = &node->l_node;
+      node = unique(*slot);
+    }
+    std::swap(target->key, node->key);
+    std::swap(target->value, node->value);
+  }
+  // node 至多一个孩子，孩子的引用转给父节点
+  auto child = node->l_node != nullptr ? node->l_node : node->r_node;
+  const bool left = depth > 0 and slot == &path[depth - 1]->l_node;
+  const auto removed_color = node->color();
+  *slot = child;
+  node->l_node = node->r_node = nullptr;
+  release(node);
+  --current_.size_;
+  if (removed_color == Color::RED)
+    return;
+  if (details::is_red(child)) {
+    unique(*slot)->set_color(Color::BLACK);
+    return;
+  }
+
+  // *slot 这条路径少了一个黑色节点，它是 path[i] 的 l 一侧
+  bool l = left;
+  for (int i = depth - 1; i >= 0;) {
+    auto father = path[i];
+    auto sibling = unique(l ? father->r_node : father->l_node);
+    if (details::is_red(sibling)) {
+      // Case 1: 旋转后兄弟成为父节点的父节点
+      sibling->set_color(Color::BLACK);
+      father->set_color(Color::RED);
+      l ? rotate_left(slot_of(i)) : rotate_right(slot_of(i));
+      path[i] = sibling;
+      path[++i] = father;
+      sibling = unique(l ? father->r_node : father->l_node);
+    }
+    auto &close_nephew = l ? sibling->l_node : sibling->r_node;
+    if (!details::is_red(close_nephew) and
+        !details::is_red(l ? sibling->r_node : sibling->l_node)) {
+      // Case 2/3
+      sibling->set_color(Color::RED);
+      if (details::is_red(father)) {
+        father->set_color(Color::BLACK);
+        return;
+      }
+      if (i == 0)
+        return;
+      l = (path[i - 1]->l_node == father);
+      --i;
+      continue;
+    }
+    if (!details::is_red(l ? sibling->r_node : sibling->l_node)) {
+      // Case 4
+      unique(close_nephew)->set_color(Color::BLACK);
+      sibling->set_color(Color::RED);
+      l ? rotate_right(father->r_node) : rotate_left(father->l_node);
+      sibling = l ? father->r_node : father->l_node;
+    }
+    // Case 5
+    auto distant_nephew = unique(l ? sibling->r_node : sibling->l_node);
+    sibling->set_color(father->color());
+    father->set_color(Color::BLACK);
+    distant_nephew->set_color(Color::BLACK);
+    l ? rotate_left(slot_of(i)) : rotate_right(slot_of(i));
+    return;
+  }
+}
+
+} // namespace rbt
+
+#undef TEMPLATE_KV
+#undef TEMPLATE_PRBT_M_FUNC
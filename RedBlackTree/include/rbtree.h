@@ -1,167 +1,697 @@
 #pragma once
 #include <algorithm>
+#include <bit>
+#include <cassert>
+#include <charconv>
+#include <compare>
+#include <concepts>
 #include <cstdint>
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <new>
+#include <ranges>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-#define TEMPLATE_KV template <typename K, typename V>
+#define TEMPLATE_KVAC                                                          \
+  template <typename K, typename V, typename Augment, typename Compare>
 #define TEMPLATE_RBT_M_FUNC                                                    \
-  template <typename K, typename V> auto Rbtree<K, V>::
-#define TEMPLATE_RBT_C_FUNC template <typename K, typename V> Rbtree<K, V>::
+  TEMPLATE_KVAC auto Rbtree<K, V, Augment, Compare>::
+#define TEMPLATE_RBT_C_FUNC TEMPLATE_KVAC Rbtree<K, V, Augment, Compare>::
 
 namespace rbt {
 namespace details {
-enum class Attribute : uint8_t {
-  ROOT,
-  LEFT_CHILD,
-  RIGHT_CHILD,
-};
-
 enum class Color : uint8_t {
   BLACK,
   RED,
 };
 
-template <typename K, typename V> struct Node {
+struct NoAugment {
+  struct value_type {};
+};
+
+// 增强时每个节点多存子树大小和子树聚合值
+template <typename Augment> struct Summary {
+  size_t size;
+  [[no_unique_address]] typename Augment::value_type value;
+
+  template <typename K, typename V>
+  static auto make(const K &key, const V &value) -> Summary {
+    return {1, Augment::from(key, value)};
+  }
+};
+
+template <> struct Summary<NoAugment> {
+  template <typename K, typename V>
+  static auto make(const K &, const V &) -> Summary {
+    return {};
+  }
+};
+
+// 父节点指针至少 8 字节对齐，最低位用来存颜色
+template <typename K, typename V, typename Augment = NoAugment> struct Node {
   K key;
   V value;
-  Attribute attribute;
-  Color color;
-  std::weak_ptr<Node<K, V>> f_node;   // father
-  std::shared_ptr<Node<K, V>> l_node; // left child
-  std::shared_ptr<Node<K, V>> r_node; // right child
-
-  Node() = default;
-  Node(K key, V value, Attribute attribute, Color color,
-       std::shared_ptr<Node<K, V>> f_node, std::shared_ptr<Node<K, V>> l_node,
-       std::shared_ptr<Node<K, V>> r_node)
-      : key(key), value(value), attribute(attribute), color(color),
-        f_node(f_node), l_node(l_node), r_node(r_node){};
+  uintptr_t f_color; // father | color
+  Node *l_node;      // left child
+  Node *r_node;      // right child
+  [[no_unique_address]] Summary<Augment> summary;
+
+  // 键值直接在节点里构造，参数原样转发，不经过中间副本
+  template <typename KK, typename... Args>
+  Node(Color color, Node *f_node, KK &&key, Args &&...args)
+      : key(std::forward<KK>(key)), value(std::forward<Args>(args)...),
+        f_color(reinterpret_cast<uintptr_t>(f_node) |
+                static_cast<uintptr_t>(color)),
+        l_node(nullptr), r_node(nullptr),
+        summary(Summary<Augment>::make(this->key, this->value)){};
+
+  auto father() const -> Node * {
+    return reinterpret_cast<Node *>(f_color & ~uintptr_t{1});
+  }
+  auto set_father(Node *f_node) -> void {
+    f_color = reinterpret_cast<uintptr_t>(f_node) | (f_color & 1);
+  }
+  auto color() const -> Color { return static_cast<Color>(f_color & 1); }
+  auto set_color(Color color) -> void {
+    f_color = (f_color & ~uintptr_t{1}) | static_cast<uintptr_t>(color);
+  }
 };
 
-template <typename K, typename V>
-using RBPtr = std::shared_ptr<details::Node<K, V>>;
+template <typename K, typename V, typename Augment = NoAugment>
+using RBPtr = details::Node<K, V, Augment> *;
 
-TEMPLATE_KV
-auto get_father(const RBPtr<K, V> &node) -> RBPtr<K, V> {
-  return node->f_node.lock();
-}
+// Slab allocator: nodes come from chunks that grow geometrically, freed
+// nodes go on a free list and are reused. Chunks are reference counted so
+// that trees produced by split/join can share them; memory is returned when
+// the last pool holding a chunk is destroyed.
+template <typename T> class NodePool {
+public:
+  NodePool() = default;
+  NodePool(const NodePool &) = delete;
+  auto operator=(const NodePool &) -> NodePool & = delete;
+  NodePool(NodePool &&) noexcept = default;
+  auto operator=(NodePool &&) noexcept -> NodePool & = default;
 
-TEMPLATE_KV
-auto get_uncle(const RBPtr<K, V> &node) -> RBPtr<K, V> {
-  auto father = get_father(node);
-  if (father == nullptr)
-    return nullptr;
-  auto grandfather = get_father(father);
-  if (grandfather == nullptr)
-    return nullptr;
+  template <typename... Args> auto create(Args &&...args) -> T * {
+    Slot *slot = free_;
+    if (slot != nullptr) {
+      free_ = slot->next;
+    } else {
+      if (used_ == capacity_) {
+        capacity_ = std::min<size_t>(std::max<size_t>(capacity_ * 2, 32),
+                                     kMaxChunk);
+        chunks_.emplace_back(new Slot[capacity_]);
+        used_ = 0;
+      }
+      slot = &chunks_.back()[used_++];
+    }
+    return ::new (static_cast<void *>(slot->storage))
+        T(std::forward<Args>(args)...);
+  }
+
+  auto destroy(T *node) -> void {
+    node->~T();
+    push(reinterpret_cast<Slot *>(node));
+  }
+
+  auto swap(NodePool &other) noexcept -> void {
+    std::swap(chunks_, other.chunks_);
+    std::swap(free_, other.free_);
+    std::swap(used_, other.used_);
+    std::swap(capacity_, other.capacity_);
+  }
+
+  // A pool for nodes split off from this one: it keeps the chunks alive but
+  // allocates from chunks of its own.
+  auto share() const -> NodePool {
+    NodePool res;
+    res.chunks_ = chunks_;
+    res.used_ = res.capacity_ = capacity_;
+    return res;
+  }
+
+  // Takes over other's nodes, free slots included; other ends up empty.
+  auto merge(NodePool &other) -> void {
+    if (!other.chunks_.empty()) {
+      auto &last = other.chunks_.back();
+      for (size_t i = other.used_; i < other.capacity_; ++i)
+        push(&last[i]);
+    }
+    while (other.free_ != nullptr) {
+      auto *slot = other.free_;
+      other.free_ = slot->next;
+      push(slot);
+    }
+    // chunks_.back() must stay the one we allocate from
+    std::shared_ptr<Slot[]> current;
+    if (!chunks_.empty()) {
+      current = std::move(chunks_.back());
+      chunks_.pop_back();
+    }
+    chunks_.insert(chunks_.end(),
+                   std::make_move_iterator(other.chunks_.begin()),
+                   std::make_move_iterator(other.chunks_.end()));
+    std::ranges::sort(chunks_, std::ranges::less{},
+                      [](const auto &chunk) { return chunk.get(); });
+    auto [first, last] = std::ranges::unique(chunks_);
+    chunks_.erase(first, last);
+    if (current != nullptr) {
+      std::erase(chunks_, current);
+      chunks_.push_back(std::move(current));
+    } else {
+      used_ = capacity_ = 0;
+    }
+    other.chunks_.clear();
+    other.used_ = other.capacity_ = 0;
+  }
 
-  if (father->attribute == Attribute::LEFT_CHILD) {
-    return grandfather->r_node;
+private:
+  static constexpr size_t kMaxChunk = 4096;
+  union Slot {
+    Slot *next;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+  auto push(Slot *slot) -> void {
+    slot->next = free_;
+    free_ = slot;
   }
-  return grandfather->l_node;
+
+  std::vector<std::shared_ptr<Slot[]>> chunks_;
+  Slot *free_ = nullptr;
+  size_t used_ = 0;     // slots handed out from chunks_.back()
+  size_t capacity_ = 0; // size of chunks_.back()
+};
+
+template <typename N> auto is_red(N *node) -> bool {
+  return node != nullptr and node->color() == Color::RED;
 }
 
-TEMPLATE_KV
-auto get_grandfather(const RBPtr<K, V> &node) -> RBPtr<K, V> {
-  auto father = get_father(node);
-  if (father != nullptr)
-    return get_father(father);
-  return nullptr;
+template <typename N> auto leftmost(N *node) -> N * {
+  while (node->l_node != nullptr)
+    node = node->l_node;
+  return node;
 }
 
-TEMPLATE_KV
-auto get_sibling(const RBPtr<K, V> &node) -> RBPtr<K, V> {
-  auto father = get_father(node);
-  if (father == nullptr)
-    return nullptr;
-  switch (node->attribute) {
-  case Attribute::LEFT_CHILD:
-    return father->r_node;
-  case Attribute::RIGHT_CHILD:
-    return father->l_node;
+template <typename N> auto rightmost(N *node) -> N * {
+  while (node->r_node != nullptr)
+    node = node->r_node;
+  return node;
+}
+
+// 中序的下一个节点，没有时为空。沿父指针上爬，均摊 O(1)
+template <typename N> auto next(N *node) -> N * {
+  if (node->r_node != nullptr)
+    return leftmost(node->r_node);
+  auto father = node->father();
+  while (father != nullptr and father->r_node == node) {
+    node = father;
+    father = node->father();
   }
-  return nullptr;
+  return father;
 }
 
-TEMPLATE_KV
-auto get_close_nephew(const RBPtr<K, V> &node) -> RBPtr<K, V> {
-  auto sibling = get_sibling(node);
-  if (sibling == nullptr)
-    return nullptr;
-  switch (node->attribute) {
-  case Attribute::LEFT_CHILD:
-    return sibling->l_node;
-  case Attribute::RIGHT_CHILD:
-    return sibling->r_node;
+template <typename N> auto prev(N *node) -> N * {
+  if (node->l_node != nullptr)
+    return rightmost(node->l_node);
+  auto father = node->father();
+  while (father != nullptr and father->l_node == node) {
+    node = father;
+    father = node->father();
   }
-  return nullptr;
+  return father;
+}
+
+// 脱离整棵树的一棵子树：根为黑色或为空，bh 是它的黑高（空树为 0）
+template <typename N> struct Subtree {
+  N *root = nullptr;
+  int bh = 0;
 };
 
-TEMPLATE_KV
-auto get_distant_nephew(const RBPtr<K, V> &node) -> RBPtr<K, V> {
-  auto sibling = get_sibling(node);
-  if (sibling == nullptr)
-    return nullptr;
-  switch (node->attribute) {
-  case Attribute::LEFT_CHILD:
-    return sibling->r_node;
-  case Attribute::RIGHT_CHILD:
-    return sibling->l_node;
-  }
-  return nullptr;
+enum class SetOp {
+  UNION,
+  INTERSECTION,
+  DIFFERENCE,
 };
-template <typename... Args>
-auto equal_color(Color color, Args &&...args) -> bool {
-  bool res = true;
-  ((res &= (args->color == color)), ...);
-  return res;
-}
 
-TEMPLATE_KV
-auto swap_color(RBPtr<K, V> &a, RBPtr<K, V> &b) {
-  auto tmp = a->color;
-  a->color = b->color;
-  b->color = tmp;
+// 集合操作不传 executor 时的占位类型，全部在调用线程里完成
+struct Sequential {};
+
+// 比较器可以是 std::less 这样的谓词，也可以是 std::compare_three_way
+// 这样返回 <=> 结果的三路比较
+template <typename C, typename A, typename B>
+concept ThreeWay = requires(const C &comp, const A &a, const B &b) {
+  { comp(a, b) } -> std::convertible_to<std::partial_ordering>;
+};
+
+// 比较器带 is_transparent 时，查找可以直接用能和 K 比较的其他类型
+template <typename C>
+concept Transparent = requires { typename C::is_transparent; };
+
+template <typename C, typename A, typename B>
+auto less(const C &comp, const A &a, const B &b) -> bool {
+  if constexpr (ThreeWay<C, A, B>)
+    return comp(a, b) < 0;
+  else
+    return comp(a, b);
 }
 
 } // namespace details
 
-template <typename K, typename V> class Rbtree {
+// 子树聚合策略。value_type 是聚合值，identity() 是单位元，from(key, value)
+// 是单个元素的值，combine(a, b) 满足结合律（不要求交换律）。
+// 使用任何策略时都会维护子树大小，rank/select 都可用。
+
+// 只要子树大小
+struct Count {
+  struct value_type {};
+  static auto identity() -> value_type { return {}; }
+  template <typename K, typename V>
+  static auto from(const K &, const V &) -> value_type {
+    return {};
+  }
+  static auto combine(value_type, value_type) -> value_type { return {}; }
+};
+
+template <typename T> struct Sum {
+  using value_type = T;
+  static auto identity() -> T { return T{}; }
+  template <typename K> static auto from(const K &, const T &value) -> T {
+    return value;
+  }
+  static auto combine(const T &a, const T &b) -> T { return a + b; }
+};
+
+template <typename T> struct Max {
+  using value_type = T;
+  static auto identity() -> T { return std::numeric_limits<T>::lowest(); }
+  template <typename K> static auto from(const K &, const T &value) -> T {
+    return value;
+  }
+  static auto combine(const T &a, const T &b) -> T { return std::max(a, b); }
+};
+
+template <typename T> struct Min {
+  using value_type = T;
+  static auto identity() -> T { return std::numeric_limits<T>::max(); }
+  template <typename K> static auto from(const K &, const T &value) -> T {
+    return value;
+  }
+  static auto combine(const T &a, const T &b) -> T { return std::min(a, b); }
+};
+
+using NoAugment = details::NoAugment;
+
+// validate() 的结果。error 为空表示各项性质都满足，否则是发现的第一处错误，
+// 这时其余字段只统计到出错为止
+struct TreeStats {
+  size_t size = 0;
+  int height = 0;       // 最长路径上的节点数
+  int black_height = 0; // 任一路径上的黑色节点数
+  size_t memory = 0;    // 节点占用的字节数，不含池里空闲的槽
+  const char *error = nullptr;
+
+  auto ok() const -> bool { return error == nullptr; }
+};
+
+// draw() 的范围：从起点往下最多 max_depth 层，按先序最多 max_nodes 个节点，
+// 超出的子树画成一个省略节点
+struct DrawLimits {
+  int max_depth = std::numeric_limits<int>::max();
+  size_t max_nodes = std::numeric_limits<size_t>::max();
+};
+
+// Augment 为 NoAugment 时节点不多占空间，也不做任何维护。
+// Compare 是谓词时每层比较一次，查找到底后再确认一次是否相等；
+// 是三路比较时每层一次，相等就提前结束
+template <typename K, typename V, typename Augment = NoAugment,
+          typename Compare = std::less<K>>
+class Rbtree {
 public:
   Rbtree() = default;
+  explicit Rbtree(const Compare &comp) : comp_(comp) {}
   Rbtree(const Rbtree &value);
   auto operator=(const Rbtree &value) -> Rbtree &;
   Rbtree(Rbtree &&value) noexcept;
   auto operator=(Rbtree &&value) noexcept -> Rbtree &;
+  ~Rbtree();
+
+  template <bool Const> class Iterator;
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
 
-  auto insert(K key, V value) -> void;
-  auto remove(K key) -> void;
-  auto modify(K key, V value) -> void;
-  auto contains(K key) -> bool;
-  auto operator[](const K &key) -> V &;
+  // key 已存在时覆盖值。右值的 key 直接移进节点，左值只在插入新节点时复制
+  auto insert(const K &key, V value) -> void {
+    insert_or_assign(key, std::move(value));
+  }
+  auto insert(K &&key, V value) -> void {
+    insert_or_assign(std::move(key), std::move(value));
+  }
+  auto remove(const K &key) -> void { remove_key(key); }
+  auto modify(const K &key, V value) -> void;
+  auto contains(const K &key) const -> bool {
+    return details_find(key).second;
+  }
+  auto operator[](const K &key) -> V & {
+    return try_emplace(key).first.value();
+  }
+  auto operator[](K &&key) -> V & {
+    return try_emplace(std::move(key)).first.value();
+  }
   auto swap(Rbtree &value) noexcept -> void;
 
+  // 以下返回 (元素位置, 是否新插入)。
+  // key 已存在时 try_emplace 什么都不做，args 不会被移走
+  template <typename... Args>
+  auto try_emplace(const K &key, Args &&...args) -> std::pair<iterator, bool>;
+  template <typename... Args>
+  auto try_emplace(K &&key, Args &&...args) -> std::pair<iterator, bool>;
+  template <typename M>
+  auto insert_or_assign(const K &key, M &&value) -> std::pair<iterator, bool>;
+  template <typename M>
+  auto insert_or_assign(K &&key, M &&value) -> std::pair<iterator, bool>;
+  // 先用参数构造出节点再查找，key 已存在时丢弃新节点。
+  // 适合 key 要由别的类型构造的情况，否则用 try_emplace
+  template <typename KK, typename... Args>
+  auto emplace(KK &&key, Args &&...args) -> std::pair<iterator, bool>;
+
+  // 比较器带 is_transparent 时，可以不构造 K 直接查找，
+  // 例如 std::less<> 下用 std::string_view 查 std::string
+  template <typename Q>
+    requires details::Transparent<Compare>
+  auto contains(const Q &key) const -> bool {
+    return details_find(key).second;
+  }
+  template <typename Q>
+    requires details::Transparent<Compare>
+  auto remove(const Q &key) -> void {
+    remove_key(key);
+  }
+
+  auto begin() -> iterator { return {leftmost_, this}; }
+  auto end() -> iterator { return {nullptr, this}; }
+  auto begin() const -> const_iterator { return {leftmost_, this}; }
+  auto end() const -> const_iterator { return {nullptr, this}; }
+
+  auto find(const K &key) -> iterator { return find_key(key); }
+  auto lower_bound(const K &key) -> iterator { // 第一个 >= key
+    return {lower_node(key), this};
+  }
+  auto upper_bound(const K &key) -> iterator { // 第一个 > key
+    return {upper_node(key), this};
+  }
+  auto equal_range(const K &key) -> std::pair<iterator, iterator> {
+    return equal_range_key(key);
+  }
+  // [lo, hi) 内的元素，不复制
+  auto range(const K &lo, const K &hi) -> std::ranges::subrange<iterator>;
+  auto find(const K &key) const -> const_iterator { return find_key(key); }
+  auto lower_bound(const K &key) const -> const_iterator {
+    return {lower_node(key), this};
+  }
+  auto upper_bound(const K &key) const -> const_iterator {
+    return {upper_node(key), this};
+  }
+  auto equal_range(const K &key) const
+      -> std::pair<const_iterator, const_iterator> {
+    return equal_range_key(key);
+  }
+  auto range(const K &lo, const K &hi) const
+      -> std::ranges::subrange<const_iterator>;
+
+  // 上面查找的 is_transparent 版本
+  template <typename Q>
+    requires details::Transparent<Compare>
+  auto find(const Q &key) -> iterator {
+    return find_key(key);
+  }
+  template <typename Q>
+    requires details::Transparent<Compare>
+  auto lower_bound(const Q &key) -> iterator {
+    return {lower_node(key), this};
+  }
+  template <typename Q>
+    requires details::Transparent<Compare>
+  auto upper_bound(const Q &key) -> iterator {
+    return {upper_node(key), this};
+  }
+  template <typename Q>
+    requires details::Transparent<Compare>
+  auto equal_range(const Q &key) -> std::pair<iterator, iterator> {
+    return equal_range_key(key);
+  }
+  template <typename Q>
+    requires details::Transparent<Compare>
+  auto find(const Q &key) const -> const_iterator {
+    return find_key(key);
+  }
+  template <typename Q>
+    requires details::Transparent<Compare>
+  auto lower_bound(const Q &key) const -> const_iterator {
+    return {lower_node(key), this};
+  }
+  template <typename Q>
+    requires details::Transparent<Compare>
+  auto upper_bound(const Q &key) const -> const_iterator {
+    return {upper_node(key), this};
+  }
+  template <typename Q>
+    requires details::Transparent<Compare>
+  auto equal_range(const Q &key) const
+      -> std::pair<const_iterator, const_iterator> {
+    return equal_range_key(key);
+  }
+  auto key_comp() const -> const Compare & { return comp_; }
+
+  // 插入到 hint 之前（key 已存在时覆盖值）。hint 正确时均摊 O(1)，
+  // 例如递增的 key 用 end()；hint 不对时退化为普通插入
+  auto insert(const_iterator hint, K key, V value) -> iterator;
+
+  // 以下需要增强策略，都是 O(log n)。值要通过 insert/modify 修改，
+  // 经由 operator[] 或迭代器改的值不会更新聚合值
+  static constexpr bool kAugmented =
+      !std::is_same_v<Augment, details::NoAugment>;
+  auto size() const -> size_t
+    requires kAugmented;
+  auto rank(const K &key) const -> size_t // 小于 key 的个数
+    requires kAugmented;
+  auto select(size_t k) -> iterator // 第 k 小（从 0 开始），越界为 end()
+    requires kAugmented;
+  auto select(size_t k) const -> const_iterator
+    requires kAugmented;
+  // [lo, hi) 内按 key 顺序 combine 的结果
+  auto aggregate(const K &lo, const K &hi) const ->
+      typename Augment::value_type
+    requires kAugmented;
+
+  // 由按 key 严格递增（按 comp）的 (key, value) 序列建树，O(n)
+  template <std::forward_iterator It, std::sentinel_for<It> S>
+  static auto from_sorted(It first, S last, const Compare &comp = Compare())
+      -> Rbtree;
+  template <std::ranges::forward_range R>
+  static auto from_sorted(R &&range, const Compare &comp = Compare())
+      -> Rbtree;
+
+  // 以下都拿走参数里的树的节点，不复制也不重新分配。
+  // this 中的 key < key < right 中的 key，O(log n)
+  auto join(K key, V value, Rbtree right) -> void;
+  // this 中的 key 都小于 right 中的 key
+  auto join(Rbtree right) -> void;
+  // >= key 的部分移到返回的树里，O(log n)
+  auto split(const K &key) -> Rbtree;
+  // 并集、交集、差集，O(m log(n/m + 1))，key 相同时保留 this 的值。
+  // 给了 executor（例如 ctp::ThreadPool）时上面几层的子问题交给它并行做，
+  // 调用线程只负责拆分和等待，不能是 executor 自己的工作线程
+  template <typename Executor = details::Sequential>
+  auto unite(Rbtree other, Executor *executor = nullptr) -> void;
+  template <typename Executor = details::Sequential>
+  auto intersect(Rbtree other, Executor *executor = nullptr) -> void;
+  template <typename Executor = details::Sequential>
+  auto subtract(Rbtree other, Executor *executor = nullptr) -> void;
+
   // debug
-  auto draw(std::filesystem::path pathname) -> void;
+  // 检查根为黑、红节点没有红孩子、各路径黑高相同、中序严格递增、父指针、
+  // 最左最右节点和子树大小（增强时），并统计形状。不递归，O(n) 时间 O(1) 空间
+  auto validate() const -> TreeStats;
+  // 输出 Graphviz 文件，不递归，经缓冲区整块写出
+  auto draw(std::filesystem::path pathname, DrawLimits limits = {}) const
+      -> void;
+  // 只画 key 所在节点为根的子树，key 不存在时输出空图。
+  // limits 没有默认值，免得 draw(path, {3}) 被当成 key
+  auto draw(std::filesystem::path pathname, const K &key,
+            DrawLimits limits) const -> void;
 
 private:
-  // op 1 insert 0 find
-  auto details_find(K key) -> details::RBPtr<K, V>;
-  auto details_insert(K key, V value) -> details::RBPtr<K, V>;
-  auto switch_insert(details::RBPtr<K, V> &node) -> void;
-  auto switch_remove(details::RBPtr<K, V> &node, bool op = true) -> void;
-  auto rotate_left(details::RBPtr<K, V> &node) -> void;
-  auto rotate_right(details::RBPtr<K, V> &node) -> void;
+  using Subtree = details::Subtree<details::Node<K, V, Augment>>;
+  struct SetStep {
+    Subtree a_l, b_l, a_r, b_r;
+    details::RBPtr<K, V, Augment> mid; // 为空时两边直接拼接
+  };
+  struct SetFrame {
+    bool leaf;
+    details::RBPtr<K, V, Augment> mid;
+  };
+
+  // 找到时返回 (等于 key 的节点, true)，否则返回 (新节点该挂的父节点, false)
+  template <typename Q>
+  auto details_find(const Q &key) const
+      -> std::pair<details::RBPtr<K, V, Augment>, bool>;
+  // 把新建的 node 挂到 father 下面（father 为空时作为根）并修正
+  auto details_insert(details::RBPtr<K, V, Augment> father,
+                      details::RBPtr<K, V, Augment> node) -> void;
+  template <typename Q>
+  auto lower_node(const Q &key) const -> details::RBPtr<K, V, Augment>;
+  template <typename Q>
+  auto upper_node(const Q &key) const -> details::RBPtr<K, V, Augment>;
+  template <typename Q> auto find_key(const Q &key) const -> iterator;
+  template <typename Q>
+  auto equal_range_key(const Q &key) const -> std::pair<iterator, iterator>;
+  template <typename Q> auto remove_key(const Q &key) -> void;
+  template <typename KK, typename... Args>
+  auto try_emplace_key(KK &&key, Args &&...args) -> std::pair<iterator, bool>;
+  template <typename KK, typename M>
+  auto assign_key(KK &&key, M &&value) -> std::pair<iterator, bool>;
+  // 以 root 为根修正，root 可以是脱离整棵树的子树。返回根是否由红变黑
+  static auto insert_fixup(details::RBPtr<K, V, Augment> &root,
+                           details::RBPtr<K, V, Augment> node) -> bool;
+  auto remove_node(details::RBPtr<K, V, Augment> node) -> void;
+  auto remove_fixup(details::RBPtr<K, V, Augment> node, details::RBPtr<K, V, Augment> father)
+      -> void;
+  static auto transplant(details::RBPtr<K, V, Augment> &root,
+                         details::RBPtr<K, V, Augment> old_node,
+                         details::RBPtr<K, V, Augment> node) -> void;
+  static auto rotate_left(details::RBPtr<K, V, Augment> &root,
+                          details::RBPtr<K, V, Augment> node) -> void;
+  static auto rotate_right(details::RBPtr<K, V, Augment> &root,
+                           details::RBPtr<K, V, Augment> node) -> void;
+  auto destroy_all() -> void;
+  auto draw_subtree(std::filesystem::path pathname,
+                    details::RBPtr<K, V, Augment> start, DrawLimits limits) const
+      -> void;
+  // 逐个释放以 node 为根的子树
+  auto release(details::RBPtr<K, V, Augment> node) -> void;
+  auto reset_root(details::RBPtr<K, V, Augment> node) -> void;
+  // 由孩子重新计算 node 的子树信息；update_path 一直算到根
+  static auto update(details::RBPtr<K, V, Augment> node) -> void;
+  static auto update_path(details::RBPtr<K, V, Augment> node) -> void;
+
+  // join/split 的实现，都在脱离整棵树的子树上做（Blelloch 等，Just Join）
+  template <typename It>
+  auto build(It &first, size_t n, int depth, int red_depth,
+             details::RBPtr<K, V, Augment> &last)
+      -> details::RBPtr<K, V, Augment>;
+  auto whole() const -> Subtree;
+  static auto expose(Subtree tree)
+      -> std::tuple<Subtree, details::RBPtr<K, V, Augment>, Subtree>;
+  static auto join_subtrees(Subtree l, details::RBPtr<K, V, Augment> mid,
+                            Subtree r) -> Subtree;
+  static auto join_subtrees(Subtree l, Subtree r) -> Subtree;
+  static auto split_subtree(Subtree tree, const K &key, const Compare &comp)
+      -> std::tuple<Subtree, details::RBPtr<K, V, Augment>, Subtree>;
+  static auto split_last(Subtree tree)
+      -> std::pair<Subtree, details::RBPtr<K, V, Augment>>;
+  // 集合操作：拿掉的节点放进 garbage，由调用线程统一释放
+  template <details::SetOp Op>
+  static auto set_base(Subtree a, Subtree b,
+                       std::vector<details::RBPtr<K, V, Augment>> &garbage)
+      -> Subtree;
+  template <details::SetOp Op>
+  static auto set_step(Subtree a, Subtree b, const Compare &comp,
+                       std::vector<details::RBPtr<K, V, Augment>> &garbage)
+      -> SetStep;
+  template <details::SetOp Op>
+  static auto set_operation(Subtree a, Subtree b, const Compare &comp,
+                            std::vector<details::RBPtr<K, V, Augment>> &garbage)
+      -> Subtree;
+  template <details::SetOp Op>
+  static auto set_fork(Subtree a, Subtree b, const Compare &comp, int depth,
+                       std::vector<SetFrame> &frames,
+                       std::vector<std::pair<Subtree, Subtree>> &tasks,
+                       std::vector<details::RBPtr<K, V, Augment>> &garbage)
+      -> void;
+  static auto set_gather(const std::vector<SetFrame> &frames, size_t &frame,
+                         std::vector<Subtree> &results, size_t &result)
+      -> Subtree;
+  template <details::SetOp Op, typename Executor>
+  auto set_apply(Rbtree &other, Executor *executor) -> void;
 
 private:
-  details::RBPtr<K, V> root_node;
+  details::RBPtr<K, V, Augment> root_node = nullptr;
+  details::RBPtr<K, V, Augment> leftmost_ = nullptr; // begin()
+  details::RBPtr<K, V, Augment> rightmost_ = nullptr;
+  details::NodePool<details::Node<K, V, Augment>> pool_;
+  [[no_unique_address]] Compare comp_;
 };
 
-TEMPLATE_RBT_M_FUNC rotate_left(details::RBPtr<K, V> &X)->void {
+// 双向迭代器，解引用得到 (key, value) 的引用对
+TEMPLATE_KVAC template <bool Const>
+class Rbtree<K, V, Augment, Compare>::Iterator {
+public:
+  using iterator_category = std::bidirectional_iterator_tag;
+  using difference_type = std::ptrdiff_t;
+  using value_type = std::pair<K, V>;
+  using reference =
+      std::pair<const K &, std::conditional_t<Const, const V &, V &>>;
+  using pointer = void;
+
+  Iterator() = default;
+  // iterator 可以转成 const_iterator
+  template <bool Other>
+    requires(Const and !Other)
+  Iterator(const Iterator<Other> &other)
+      : node_(other.node_), tree_(other.tree_) {}
+
+  auto key() const -> const K & { return node_->key; }
+  auto value() const -> std::conditional_t<Const, const V &, V &> {
+    return node_->value;
+  }
+  auto operator*() const -> reference { return {node_->key, node_->value}; }
+
+  auto operator++() -> Iterator & {
+    node_ = details::next(node_);
+    return *this;
+  }
+  auto operator++(int) -> Iterator {
+    auto res = *this;
+    ++*this;
+    return res;
+  }
+  // end() 往回走到最大的元素
+  auto operator--() -> Iterator & {
+    node_ = node_ == nullptr ? tree_->rightmost_ : details::prev(node_);
+    return *this;
+  }
+  auto operator--(int) -> Iterator {
+    auto res = *this;
+    --*this;
+    return res;
+  }
+  auto operator==(const Iterator &other) const -> bool {
+    return node_ == other.node_;
+  }
+
+private:
+  friend class Rbtree;
+  friend class Iterator<!Const>;
+  Iterator(details::RBPtr<K, V, Augment> node, const Rbtree *tree)
+      : node_(node), tree_(tree) {}
+
+  details::RBPtr<K, V, Augment> node_ = nullptr;
+  const Rbtree *tree_ = nullptr;
+};
+
+TEMPLATE_RBT_M_FUNC rotate_left(details::RBPtr<K, V, Augment> &root,
+                             details::RBPtr<K, V, Augment> X)
+    ->void {
   // clang-format off
   // X                  Y
   //  \                / \
@@ -173,43 +703,19 @@ TEMPLATE_RBT_M_FUNC rotate_left(details::RBPtr<K, V> &X)->void {
   assert(Y != nullptr);
   if (Y == nullptr)
     return;
-  auto f_X = get_father(X);
-
-  if (f_X != nullptr) {
-    switch (X->attribute) {
-    case details::Attribute::LEFT_CHILD:
-      f_X->l_node = Y;
-      Y->attribute = details::Attribute::LEFT_CHILD;
-      break;
-    case details::Attribute::RIGHT_CHILD:
-      f_X->r_node = Y;
-      Y->attribute = details::Attribute::RIGHT_CHILD;
-      break;
-    default:
-      throw;
-    }
-    Y->f_node = f_X;
-  } else {
-    Y->attribute = details::Attribute::ROOT;
-    Y->color = details::Color::BLACK;
-    root_node = Y;
-    {
-      details::RBPtr<K, V> clear;
-      root_node->f_node = clear;
-    }
-  }
-
+  transplant(root, X, Y);
   X->r_node = Y->l_node;
-  if (X->r_node != nullptr) {
-    X->r_node->attribute = details::Attribute::RIGHT_CHILD;
-    X->r_node->f_node = X;
-  }
-  X->f_node = Y;
+  if (X->r_node != nullptr)
+    X->r_node->set_father(X);
+  X->set_father(Y);
   Y->l_node = X;
-  X->attribute = details::Attribute::LEFT_CHILD;
+  update(X);
+  update(Y);
 }
 
-TEMPLATE_RBT_M_FUNC rotate_right(details::RBPtr<K, V> &X)->void {
+TEMPLATE_RBT_M_FUNC rotate_right(details::RBPtr<K, V, Augment> &root,
+                              details::RBPtr<K, V, Augment> X)
+    ->void {
   // clang-format off
   //     X                 Y
   //    /                 / \
@@ -221,448 +727,1120 @@ TEMPLATE_RBT_M_FUNC rotate_right(details::RBPtr<K, V> &X)->void {
   assert(Y != nullptr);
   if (Y == nullptr)
     return;
-  auto f_X = get_father(X);
-  if (f_X != nullptr) {
-    switch (X->attribute) {
-    case details::Attribute::LEFT_CHILD:
-      f_X->l_node = Y;
-      Y->attribute = details::Attribute::LEFT_CHILD;
-      break;
-    case details::Attribute::RIGHT_CHILD:
-      f_X->r_node = Y;
-      Y->attribute = details::Attribute::RIGHT_CHILD;
-      break;
-    default:
-      throw;
+  transplant(root, X, Y);
+  X->l_node = Y->r_node;
+  if (X->l_node != nullptr)
+    X->l_node->set_father(X);
+  X->set_father(Y);
+  Y->r_node = X;
+  update(X);
+  update(Y);
+}
+
+TEMPLATE_KVAC template <typename Q>
+auto Rbtree<K, V, Augment, Compare>::details_find(const Q &key) const
+    -> std::pair<details::RBPtr<K, V, Augment>, bool> {
+  details::RBPtr<K, V, Augment> father = nullptr;
+  auto node = root_node;
+  if constexpr (details::ThreeWay<Compare, Q, K>) {
+    while (node != nullptr) {
+      const auto order = comp_(key, node->key);
+      if (order == 0)
+        return {node, true};
+      father = node;
+      node = order < 0 ? node->l_node : node->r_node;
     }
-    Y->f_node = f_X;
+    return {father, false};
   } else {
-    Y->attribute = details::Attribute::ROOT;
-    Y->color = details::Color::BLACK;
-    root_node = Y;
-    {
-      details::RBPtr<K, V> clear;
-      root_node->f_node = clear;
+    // candidate 是最后一个 key 不小于的节点，相等的话只可能是它
+    details::RBPtr<K, V, Augment> candidate = nullptr;
+    while (node != nullptr) {
+      father = node;
+      if (comp_(key, node->key)) {
+        node = node->l_node;
+      } else {
+        candidate = node;
+        node = node->r_node;
+      }
     }
+    if (candidate != nullptr and !comp_(candidate->key, key))
+      return {candidate, true};
+    return {father, false};
   }
-  X->l_node = Y->r_node;
-  if (X->l_node != nullptr) {
-    X->l_node->attribute = details::Attribute::LEFT_CHILD;
-    X->l_node->f_node = X;
+}
+
+TEMPLATE_RBT_M_FUNC details_insert(details::RBPtr<K, V, Augment> father,
+                                   details::RBPtr<K, V, Augment> node)
+    ->void {
+  node->set_father(father);
+  if (father == nullptr) {
+    node->set_color(details::Color::BLACK);
+    root_node = leftmost_ = rightmost_ = node;
+    return;
   }
-  X->f_node = Y;
-  Y->r_node = X;
-  X->attribute = details::Attribute::RIGHT_CHILD;
+  node->set_color(details::Color::RED);
+  if (details::less(comp_, node->key, father->key)) {
+    father->l_node = node;
+    if (father == leftmost_)
+      leftmost_ = node;
+  } else {
+    father->r_node = node;
+    if (father == rightmost_)
+      rightmost_ = node;
+  }
+  update_path(father);
+  insert_fixup(root_node, node);
 }
 
-TEMPLATE_RBT_M_FUNC
-details_find(K key)->details::RBPtr<K, V> {
-  if (root_node == nullptr)
-    return nullptr;
-  details::RBPtr<K, V> res = nullptr;
-  for (res = root_node; res != nullptr;) {
-    if (res->key > key) {
-      if (res->l_node == nullptr)
-        return res;
-      res = res->l_node;
-    } else if (res->key < key) {
-      if (res->r_node == nullptr)
-        return res;
-      res = res->r_node;
+// 先序遍历复制，父指针代替栈
+TEMPLATE_RBT_C_FUNC
+Rbtree(const Rbtree &value) : comp_(value.comp_) {
+  if (value.root_node == nullptr)
+    return;
+  auto copy = [this](details::RBPtr<K, V, Augment> src,
+                     details::RBPtr<K, V, Augment> father) {
+    auto node = pool_.create(src->color(), father, src->key, src->value);
+    node->summary = src->summary;
+    return node;
+  };
+  root_node = copy(value.root_node, nullptr);
+  auto src = value.root_node;
+  auto dst = root_node;
+  while (src != nullptr) {
+    if (src->l_node != nullptr and dst->l_node == nullptr) {
+      dst->l_node = copy(src->l_node, dst);
+      src = src->l_node;
+      dst = dst->l_node;
+    } else if (src->r_node != nullptr and dst->r_node == nullptr) {
+      dst->r_node = copy(src->r_node, dst);
+      src = src->r_node;
+      dst = dst->r_node;
     } else {
-      return res;
+      src = src->father();
+      dst = dst->father();
     }
   }
-  return nullptr;
+  leftmost_ = details::leftmost(root_node);
+  rightmost_ = details::rightmost(root_node);
 }
-
 TEMPLATE_RBT_M_FUNC
-details_insert(K key, V value)->details::RBPtr<K, V> {
-  if (root_node == nullptr) {
-    root_node = std::make_shared<details::Node<K, V>>(
-        key, value, details::Attribute::ROOT, details::Color::BLACK, nullptr,
-        nullptr, nullptr);
-    return root_node;
+operator=(const Rbtree &value)->Rbtree & {
+  if (this != &value) {
+    Rbtree copy(value);
+    this->swap(copy);
   }
+  return *this;
+}
+TEMPLATE_RBT_C_FUNC
+Rbtree(Rbtree &&value) noexcept { this->swap(value); }
+TEMPLATE_RBT_M_FUNC
+operator=(Rbtree &&value) noexcept -> Rbtree & {
+  this->swap(value);
+  return *this;
+}
+TEMPLATE_RBT_C_FUNC ~Rbtree() { destroy_all(); }
 
-  details::RBPtr<K, V> res = details_find(key);
-  assert(res != nullptr);
-  if (res->key > key) {
-    res->l_node = std::make_shared<details::Node<K, V>>(
-        key, value, details::Attribute::LEFT_CHILD, details::Color::RED, res,
-        nullptr, nullptr);
-    return res->l_node;
+// 键值都可平凡析构时直接整块释放
+TEMPLATE_RBT_M_FUNC destroy_all()->void {
+  if constexpr (!std::is_trivially_destructible_v<details::Node<K, V, Augment>>)
+    release(root_node);
+  root_node = leftmost_ = rightmost_ = nullptr;
+}
+
+// 后序遍历逐个析构，不递归。node 是整棵树或脱离出来的子树的根
+TEMPLATE_RBT_M_FUNC release(details::RBPtr<K, V, Augment> node)->void {
+  while (node != nullptr) {
+    if (node->l_node != nullptr) {
+      node = node->l_node;
+    } else if (node->r_node != nullptr) {
+      node = node->r_node;
+    } else {
+      auto father = node->father();
+      if (father != nullptr)
+        (father->l_node == node ? father->l_node : father->r_node) = nullptr;
+      pool_.destroy(node);
+      node = father;
+    }
   }
-  res->r_node = std::make_shared<details::Node<K, V>>(
-      key, value, details::Attribute::RIGHT_CHILD, details::Color::RED, res,
-      nullptr, nullptr);
-  return res->r_node;
 }
 
-TEMPLATE_RBT_C_FUNC
-Rbtree(const Rbtree &value) { root_node = value.root_node; }
-TEMPLATE_RBT_M_FUNC
-operator=(const Rbtree &value)->Rbtree & { root_node = value.root_node; }
-TEMPLATE_RBT_C_FUNC
-Rbtree(Rbtree &&value) noexcept { this->swap(value); }
+TEMPLATE_RBT_M_FUNC reset_root(details::RBPtr<K, V, Augment> node)->void {
+  root_node = node;
+  leftmost_ = node == nullptr ? nullptr : details::leftmost(node);
+  rightmost_ = node == nullptr ? nullptr : details::rightmost(node);
+}
+
+// 把 node 接到 old_node 的位置上，old_node 的孩子不变
 TEMPLATE_RBT_M_FUNC
-operator=(Rbtree &&value) noexcept -> Rbtree & { this->swap(value); }
-
-TEMPLATE_RBT_M_FUNC switch_insert(details::RBPtr<K, V> &node)->void {
-  auto uncle = get_uncle(node);
-  auto father = get_father(node);
-  auto grandfather = get_grandfather(node);
-  const bool case1 = (father == nullptr);
-  const bool case2 =
-      (father != nullptr and father->color == details::Color::BLACK);
-
-  const bool case3 =
-      ((father != nullptr and father->color == details::Color::RED) and
-       (uncle != nullptr and uncle->color == details::Color::RED));
-  const bool tmp =
-      ((uncle == nullptr or uncle->color == details::Color::BLACK) and
-       (father != nullptr and father->color == details::Color::RED));
-  const bool case4 = (tmp and node->attribute == father->attribute);
-  const bool case5 = (tmp and node->attribute != father->attribute);
-
-  if (case1) {
-    node->color = details::Color::BLACK;
-    return;
-  } else if (case2) {
-    return;
-  } else if (case3) {
-    father->color = details::Color::BLACK;
-    uncle->color = details::Color::BLACK;
-    grandfather->color = details::Color::RED;
-    switch_insert(grandfather);
-  } else if (case4) {
-    switch (node->attribute) {
-    // clang-format off
-    //        G(B)             N(B)
-    //       /  \   right(G)  /  \
-    //      N(R) U(B)  ===>  P(R) G(R)
-    //     /                        \
-    //    P(R)                       U(B)
-    // clang-format on
-    case details::Attribute::LEFT_CHILD:
-      rotate_right(grandfather);
-      break;
-    // clang-format off
-    //        G(B)             N(B)
-    //       /  \    left(G)  /  \
-    //      U(B) N(R)  ===>  G(R) P(R)
-    //             \        /
-    //              P(R)   U(B)
-    // clang-format on
-    case details::Attribute::RIGHT_CHILD:
-      rotate_left(grandfather);
-      break;
+transplant(details::RBPtr<K, V, Augment> &root,
+           details::RBPtr<K, V, Augment> old_node,
+           details::RBPtr<K, V, Augment> node)
+    ->void {
+  auto father = old_node->father();
+  if (father == nullptr)
+    root = node;
+  else if (father->l_node == old_node)
+    father->l_node = node;
+  else
+    father->r_node = node;
+  if (node != nullptr)
+    node->set_father(father);
+}
+
+// 红色的 node 刚插入，向上循环修正，最多旋转两次
+TEMPLATE_RBT_M_FUNC insert_fixup(details::RBPtr<K, V, Augment> &root,
+                              details::RBPtr<K, V, Augment> node)
+    ->bool {
+  using details::Color;
+  for (auto father = node->father(); details::is_red(father);
+       father = node->father()) {
+    // 父节点是红色，所以不是根，祖父节点一定存在
+    auto grandfather = father->father();
+    const bool left = (grandfather->l_node == father);
+    auto uncle = left ? grandfather->r_node : grandfather->l_node;
+    if (details::is_red(uncle)) {
+      // Case 3: 父、叔变黑，祖父变红，从祖父继续
+      father->set_color(Color::BLACK);
+      uncle->set_color(Color::BLACK);
+      grandfather->set_color(Color::RED);
+      node = grandfather;
+      continue;
     }
-    grandfather->color = details::Color::RED;
-    father->color = details::Color::BLACK;
-  } else if (case5) {
-    switch (node->attribute) {
-    // clang-format off
-    //        G(B)              G(B)
-    //       /  \    right(P)   /  \
-    //      U(B) P(R)  ====>  U(B) N(R)
-    //          /                    \
-    //         N(R)                   P(R)
-    // clang-format on
-    case details::Attribute::LEFT_CHILD:
-      rotate_right(father);
-      break;
-    // clang-format off
-    //        G(B)                G(B)
-    //       /   \    left(P)     /  \
-    //      P(R)  U(B)  ====>   N(R) U(B)
-    //       \                 /
-    //        N(R)            P(R)
-    // clang-format on
-    case details::Attribute::RIGHT_CHILD:
-      rotate_left(father);
-      break;
+    if (node == (left ? father->r_node : father->l_node)) {
+      // Case 5: 转成 Case 4
+      node = father;
+      left ? rotate_left(root, node) : rotate_right(root, node);
+      father = node->father();
     }
-    // 最下面的点
-    switch_insert(father);
+    // Case 4
+    father->set_color(Color::BLACK);
+    grandfather->set_color(Color::RED);
+    left ? rotate_right(root, grandfather) : rotate_left(root, grandfather);
+    break;
   }
+  const bool grown = details::is_red(root);
+  root->set_color(Color::BLACK);
+  return grown;
 }
 
-TEMPLATE_RBT_M_FUNC insert(K key, V value)->void {
-  auto node = details_insert(key, value);
-  switch_insert(node);
+TEMPLATE_KVAC template <typename KK, typename... Args>
+auto Rbtree<K, V, Augment, Compare>::try_emplace_key(KK &&key, Args &&...args)
+    -> std::pair<iterator, bool> {
+  auto [res, found] = details_find(key);
+  if (found)
+    return {{res, this}, false};
+  auto node = pool_.create(details::Color::RED, nullptr,
+                           std::forward<KK>(key), std::forward<Args>(args)...);
+  details_insert(res, node);
+  return {{node, this}, true};
 }
 
-TEMPLATE_RBT_M_FUNC switch_remove(details::RBPtr<K, V> &node, bool op)->void {
-  // Case 3
-  // 中，我们会递归向上来调整，但是这时我们以经不在需要删除点了，但是还要递归
-  // switch_remove 这个函数，使用一个 op 来记录调用这次函数时，是否要执行
-  // remove_node() 函数
-  auto father = get_father(node);
-  if (node->attribute == details::Attribute::ROOT and
-      node->r_node == nullptr and node->r_node) {
-    root_node = nullptr;
-    return;
+TEMPLATE_KVAC template <typename KK, typename M>
+auto Rbtree<K, V, Augment, Compare>::assign_key(KK &&key, M &&value)
+    -> std::pair<iterator, bool> {
+  auto [res, found] = details_find(key);
+  if (found) {
+    res->value = std::forward<M>(value);
+    update_path(res);
+    return {{res, this}, false};
   }
+  auto node = pool_.create(details::Color::RED, nullptr,
+                           std::forward<KK>(key), std::forward<M>(value));
+  details_insert(res, node);
+  return {{node, this}, true};
+}
 
-  //
-  auto change_node = [&](details::RBPtr<K, V> &f, details::RBPtr<K, V> &c,
-                         details::Attribute attr) -> details::RBPtr<K, V> {
-    if (c == nullptr)
-      return nullptr;
-    c->f_node = f;
-    c->attribute = attr;
-    return c;
-  };
+TEMPLATE_KVAC template <typename... Args>
+auto Rbtree<K, V, Augment, Compare>::try_emplace(const K &key, Args &&...args)
+    -> std::pair<iterator, bool> {
+  return try_emplace_key(key, std::forward<Args>(args)...);
+}
+
+TEMPLATE_KVAC template <typename... Args>
+auto Rbtree<K, V, Augment, Compare>::try_emplace(K &&key, Args &&...args)
+    -> std::pair<iterator, bool> {
+  return try_emplace_key(std::move(key), std::forward<Args>(args)...);
+}
 
-  // 红色的叶子节点与只有一个节点的红色节点
-  if (node->color == details::Color::RED and
-      (node->r_node == nullptr or node->l_node == nullptr)) {
-    switch (node->attribute) {
-    case details::Attribute::LEFT_CHILD: {
-      father->l_node = change_node(
-          father, (node->r_node != nullptr ? node->r_node : node->l_node),
-          details::Attribute::LEFT_CHILD);
-      return;
+TEMPLATE_KVAC template <typename M>
+auto Rbtree<K, V, Augment, Compare>::insert_or_assign(const K &key, M &&value)
+    -> std::pair<iterator, bool> {
+  return assign_key(key, std::forward<M>(value));
+}
+
+TEMPLATE_KVAC template <typename M>
+auto Rbtree<K, V, Augment, Compare>::insert_or_assign(K &&key, M &&value)
+    -> std::pair<iterator, bool> {
+  return assign_key(std::move(key), std::forward<M>(value));
+}
+
+TEMPLATE_KVAC template <typename KK, typename... Args>
+auto Rbtree<K, V, Augment, Compare>::emplace(KK &&key, Args &&...args)
+    -> std::pair<iterator, bool> {
+  auto node = pool_.create(details::Color::RED, nullptr,
+                           std::forward<KK>(key), std::forward<Args>(args)...);
+  auto [res, found] = details_find(node->key);
+  if (found) {
+    pool_.destroy(node);
+    return {{res, this}, false};
+  }
+  details_insert(res, node);
+  return {{node, this}, true};
+}
+
+// 两个孩子时用后继节点顶替 node 的位置（改指针，不搬键值），
+// 被摘走的是黑色节点才需要修正
+TEMPLATE_RBT_M_FUNC remove_node(details::RBPtr<K, V, Augment> node)->void {
+  details::RBPtr<K, V, Augment> child;  // 顶到被摘走位置上的节点，可能为空
+  details::RBPtr<K, V, Augment> father; // child 的父节点
+  auto removed_color = node->color();
+  if (node == leftmost_)
+    leftmost_ = details::next(node);
+  if (node == rightmost_)
+    rightmost_ = details::prev(node);
+  if (node->l_node == nullptr or node->r_node == nullptr) {
+    child = node->l_node != nullptr ? node->l_node : node->r_node;
+    father = node->father();
+    transplant(root_node, node, child);
+  } else {
+    auto next = details::leftmost(node->r_node);
+    removed_color = next->color();
+    child = next->r_node;
+    if (next->father() == node) {
+      father = next;
+    } else {
+      father = next->father();
+      transplant(root_node, next, child);
+      next->r_node = node->r_node;
+      next->r_node->set_father(next);
+    }
+    transplant(root_node, node, next);
+    next->l_node = node->l_node;
+    next->l_node->set_father(next);
+    next->set_color(node->color());
+  }
+  pool_.destroy(node);
+  // father 以上的子树都少了一个节点，修正中的旋转只改局部
+  update_path(father);
+  if (removed_color == details::Color::BLACK)
+    remove_fixup(child, father);
+}
+
+// node 这条路径少了一个黑色节点，向上循环修正，最多旋转三次
+TEMPLATE_RBT_M_FUNC
+remove_fixup(details::RBPtr<K, V, Augment> node, details::RBPtr<K, V, Augment> father)->void {
+  using details::Color;
+  while (node != root_node and !details::is_red(node)) {
+    const bool left = (father->l_node == node);
+    auto sibling = left ? father->r_node : father->l_node;
+    if (details::is_red(sibling)) {
+      // Case 1: 兄弟是红色，旋转父节点，转成兄弟为黑色的情况
+      sibling->set_color(Color::BLACK);
+      father->set_color(Color::RED);
+      left ? rotate_left(root_node, father) : rotate_right(root_node, father);
+      sibling = left ? father->r_node : father->l_node;
     }
-    case details::Attribute::RIGHT_CHILD: {
-      father->r_node = change_node(
-          father, (node->r_node != nullptr ? node->r_node : node->l_node),
-          details::Attribute::RIGHT_CHILD);
-      return;
+    auto close_nephew = left ? sibling->l_node : sibling->r_node;
+    auto distant_nephew = left ? sibling->r_node : sibling->l_node;
+    if (!details::is_red(close_nephew) and !details::is_red(distant_nephew)) {
+      // Case 2/3: 兄弟变红，问题交给父节点
+      sibling->set_color(Color::RED);
+      node = father;
+      father = node->father();
+      continue;
     }
+    if (!details::is_red(distant_nephew)) {
+      // Case 4: 近侄子红色，旋转兄弟，转成 Case 5
+      close_nephew->set_color(Color::BLACK);
+      sibling->set_color(Color::RED);
+      left ? rotate_right(root_node, sibling) : rotate_left(root_node, sibling);
+      sibling = left ? father->r_node : father->l_node;
+      distant_nephew = left ? sibling->r_node : sibling->l_node;
     }
+    // Case 5: 远侄子红色，旋转父节点后结束
+    sibling->set_color(father->color());
+    father->set_color(Color::BLACK);
+    distant_nephew->set_color(Color::BLACK);
+    left ? rotate_left(root_node, father) : rotate_right(root_node, father);
+    node = root_node;
+    break;
   }
+  if (node != nullptr)
+    node->set_color(Color::BLACK);
+}
 
-  // 有两个子节点, 会先尝试替换前驱和后继，在判断是否需要调整
-  if (node->r_node != nullptr and node->l_node != nullptr) {
-    auto prev_node = [&]() -> details::RBPtr<K, V> {
-      for (auto i = node->l_node; i != nullptr; i = i->r_node) {
-        if (i->r_node == nullptr)
-          return i;
-      }
-      return nullptr;
-    }();
-    auto suf_node = [&]() -> details::RBPtr<K, V> {
-      for (auto i = node->r_node; i != nullptr; i = i->l_node) {
-        if (i->l_node == nullptr)
-          return i;
-      }
-      return nullptr;
-    }();
-
-    auto swap_node = [&](details::RBPtr<K, V> &left,
-                         details::RBPtr<K, V> &right) {
-      left.swap(right);
-      swap_color(left, right);
-      if (left->r_node != nullptr)
-        left->r_node->f_node = left;
-      if (left->l_node != nullptr)
-        left->l_node->f_node = left;
-      if (right->r_node != nullptr)
-        right->r_node->f_node = right;
-      if (right->l_node != nullptr)
-        right->l_node->f_node = right;
-    };
-    // 被删除的节点是红色
-    if ((prev_node->color == details::Color::RED or
-         suf_node->color == details::Color::RED) and
-        node->color == details::Color::RED) {
-      swap_node(node, (prev_node->color == details::Color::RED ? prev_node
-                                                               : suf_node));
-      switch_remove(node);
-    }
-
-    // 需要调整的情况
-    swap_node(node, prev_node);
-  }
-
-  // 下面是调整的步骤
-  auto sibling = get_sibling(node);
-  auto close_nephew = get_close_nephew(node);
-  auto distant_nephw = get_distant_nephew(node);
-  father = get_father(node);
-
-  bool all_exist = (father != nullptr and sibling != nullptr and
-                    close_nephew != nullptr and distant_nephw != nullptr);
-
-  auto remove_node = [&](details::RBPtr<K, V> &d_node) {
-    assert(d_node->l_node == nullptr or d_node->r_node == nullptr);
-    assert(d_node->f_node.lock() != nullptr);
-    auto father = d_node->f_node.lock();
-    switch (d_node->attribute) {
-    case details::Attribute::LEFT_CHILD: {
-      father->l_node = change_node(
-          father, (d_node->r_node == nullptr ? d_node->l_node : d_node->r_node),
-          details::Attribute::LEFT_CHILD);
-      return;
-    }
-    case details::Attribute::RIGHT_CHILD: {
-      father->r_node = change_node(
-          father, (d_node->r_node == nullptr ? d_node->l_node : d_node->r_node),
-          details::Attribute::RIGHT_CHILD);
-      return;
+TEMPLATE_KVAC template <typename Q>
+auto Rbtree<K, V, Augment, Compare>::remove_key(const Q &key) -> void {
+  auto [node, found] = details_find(key);
+  if (found)
+    remove_node(node);
+}
+
+TEMPLATE_RBT_M_FUNC modify(const K &key, V value)->void {
+  auto [res, found] = details_find(key);
+  if (!found)
+    throw;
+  res->value = std::move(value);
+  update_path(res);
+}
+
+TEMPLATE_RBT_M_FUNC swap(Rbtree &value) noexcept -> void {
+  std::swap(root_node, value.root_node);
+  std::swap(leftmost_, value.leftmost_);
+  std::swap(rightmost_, value.rightmost_);
+  pool_.swap(value.pool_);
+  std::swap(comp_, value.comp_);
+}
+
+TEMPLATE_RBT_M_FUNC insert(const_iterator hint, K key, V value)->iterator {
+  // 找到 key 在中序里的前后两个节点，其中一个必然缺对应的孩子
+  auto pos = hint.node_;
+  details::RBPtr<K, V, Augment> father = nullptr;
+  if (root_node == nullptr) {
+  } else if (pos == nullptr) {
+    if (details::less(comp_, rightmost_->key, key))
+      father = rightmost_;
+  } else if (details::less(comp_, key, pos->key)) {
+    if (pos == leftmost_) {
+      father = pos;
+    } else if (auto before = details::prev(pos);
+               details::less(comp_, before->key, key)) {
+      father = before->r_node == nullptr ? before : pos;
     }
+  } else if (details::less(comp_, pos->key, key)) {
+    auto after = details::next(pos);
+    if (after == nullptr or details::less(comp_, key, after->key))
+      father = pos->r_node == nullptr ? pos : after;
+  } else {
+    pos->value = std::move(value);
+    update_path(pos);
+    return {pos, this};
+  }
+  if (father == nullptr and root_node != nullptr) {
+    auto [res, found] = details_find(key);
+    if (found) {
+      res->value = std::move(value);
+      update_path(res);
+      return {res, this};
     }
-  };
-  // Case 1
-  if (all_exist and
-      equal_color(details::Color::BLACK, father, close_nephew,
-                  distant_nephw) and
-      equal_color(details::Color::RED, sibling)) {
-    swap_color(sibling, father);
-    switch (node->attribute) {
-    case details::Attribute::LEFT_CHILD: {
-      rotate_left(father);
-      break;
+    father = res;
+  }
+  auto node = pool_.create(details::Color::RED, nullptr, std::move(key),
+                           std::move(value));
+  details_insert(father, node);
+  return {node, this};
+}
+
+TEMPLATE_KVAC template <typename Q>
+auto Rbtree<K, V, Augment, Compare>::find_key(const Q &key) const -> iterator {
+  auto [res, found] = details_find(key);
+  return {found ? res : nullptr, this};
+}
+
+TEMPLATE_KVAC template <typename Q>
+auto Rbtree<K, V, Augment, Compare>::lower_node(const Q &key) const
+    -> details::RBPtr<K, V, Augment> {
+  details::RBPtr<K, V, Augment> res = nullptr;
+  for (auto node = root_node; node != nullptr;) {
+    if (details::less(comp_, node->key, key)) {
+      node = node->r_node;
+    } else {
+      res = node;
+      node = node->l_node;
     }
-    case details::Attribute::RIGHT_CHILD: {
-      rotate_right(father);
-      break;
+  }
+  return res;
+}
+
+TEMPLATE_KVAC template <typename Q>
+auto Rbtree<K, V, Augment, Compare>::upper_node(const Q &key) const
+    -> details::RBPtr<K, V, Augment> {
+  details::RBPtr<K, V, Augment> res = nullptr;
+  for (auto node = root_node; node != nullptr;) {
+    if (details::less(comp_, key, node->key)) {
+      res = node;
+      node = node->l_node;
+    } else {
+      node = node->r_node;
+    }
+  }
+  return res;
+}
+
+TEMPLATE_KVAC template <typename Q>
+auto Rbtree<K, V, Augment, Compare>::equal_range_key(const Q &key) const
+    -> std::pair<iterator, iterator> {
+  iterator first{lower_node(key), this};
+  auto last = first;
+  if (last.node_ != nullptr and !details::less(comp_, key, last.node_->key))
+    ++last;
+  return {first, last};
+}
+
+TEMPLATE_RBT_M_FUNC range(const K &lo, const K &hi)
+    ->std::ranges::subrange<iterator> {
+  if (!details::less(comp_, lo, hi))
+    return {end(), end()};
+  return {lower_bound(lo), lower_bound(hi)};
+}
+
+TEMPLATE_RBT_M_FUNC range(const K &lo, const K &hi) const
+    ->std::ranges::subrange<const_iterator> {
+  auto res = const_cast<Rbtree *>(this)->range(lo, hi);
+  return {res.begin(), res.end()};
+}
+
+TEMPLATE_RBT_M_FUNC update(details::RBPtr<K, V, Augment> node)->void {
+  if constexpr (kAugmented) {
+    auto &summary = node->summary;
+    summary.size = 1;
+    summary.value = Augment::from(node->key, node->value);
+    if (auto l = node->l_node; l != nullptr) {
+      summary.size += l->summary.size;
+      summary.value = Augment::combine(l->summary.value, summary.value);
     }
+    if (auto r = node->r_node; r != nullptr) {
+      summary.size += r->summary.size;
+      summary.value = Augment::combine(summary.value, r->summary.value);
     }
-    if (op)
-      remove_node(node);
-    return;
   }
+}
 
-  // Case 2
-  if (all_exist and
-      equal_color(details::Color::BLACK, sibling, close_nephew,
-                  distant_nephw) and
-      equal_color(details::Color::RED, father)) {
-    swap_color(sibling, father);
-    if (op)
-      remove_node(node);
-    return;
+TEMPLATE_RBT_M_FUNC update_path(details::RBPtr<K, V, Augment> node)->void {
+  if constexpr (kAugmented) {
+    for (; node != nullptr; node = node->father())
+      update(node);
   }
+}
 
-  // Case 3 并不需要所有节点都存在，侄子节点如果是黑色的，可以是空节点。
-  const bool case3_node_exist = (father != nullptr and sibling != nullptr);
-  const bool case3_nephew =
-      ((close_nephew == nullptr and
-        distant_nephw == nullptr) or // 两个侄子节点都不存在, 也是为黑色
-       (close_nephew != nullptr and distant_nephw == nullptr and
-        close_nephew->color == details::Color::BLACK) or
-       (close_nephew == nullptr and distant_nephw != nullptr and
-        distant_nephw->color == details::Color::BLACK) or
-       (all_exist and
-        equal_color(details::Color::BLACK, close_nephew, distant_nephw)));
-  ;
-  if (case3_node_exist and
-      equal_color(details::Color::BLACK, father, sibling) and case3_nephew) {
-    sibling->color = details::Color::RED;
-    if (op)
-      remove_node(node);
-    switch_remove(father, false);
-    return;
+TEMPLATE_RBT_M_FUNC size() const->size_t
+  requires kAugmented
+{
+  return root_node == nullptr ? 0 : root_node->summary.size;
+}
+
+TEMPLATE_RBT_M_FUNC rank(const K &key) const->size_t
+  requires kAugmented
+{
+  size_t res = 0;
+  for (auto node = root_node; node != nullptr;) {
+    if (details::less(comp_, node->key, key)) {
+      res += 1 + (node->l_node ? node->l_node->summary.size : 0);
+      node = node->r_node;
+    } else {
+      node = node->l_node;
+    }
   }
+  return res;
+}
 
-  // Case 4
-  if (all_exist and
-      equal_color(details::Color::BLACK, sibling, distant_nephw) and
-      equal_color(details::Color::RED, close_nephew)) {
-    switch (node->attribute) {
-    case details::Attribute::LEFT_CHILD:
-      rotate_right(sibling);
-    case details::Attribute::RIGHT_CHILD:
-      rotate_left(sibling);
-    }
-    swap_color(sibling, close_nephew);
-  }
-
-  // Case 5
-  sibling = get_sibling(node);
-  distant_nephw = get_distant_nephew(node);
-  father = get_father(node);
-  const bool case5_node_exist =
-      (father != nullptr and sibling != nullptr and distant_nephw != nullptr);
-  if (case5_node_exist and equal_color(details::Color::BLACK, sibling) and
-      equal_color(details::Color::RED, distant_nephw)) {
-    switch (node->attribute) {
-    case details::Attribute::LEFT_CHILD: {
-      rotate_left(father);
-      break;
+TEMPLATE_RBT_M_FUNC select(size_t k)->iterator
+  requires kAugmented
+{
+  for (auto node = root_node; node != nullptr;) {
+    const size_t left = node->l_node ? node->l_node->summary.size : 0;
+    if (k == left)
+      return {node, this};
+    if (k < left) {
+      node = node->l_node;
+    } else {
+      k -= left + 1;
+      node = node->r_node;
     }
-    case details::Attribute::RIGHT_CHILD: {
+  }
+  return end();
+}
 
-      rotate_right(father);
-      break;
+TEMPLATE_RBT_M_FUNC select(size_t k) const->const_iterator
+  requires kAugmented
+{
+  return const_cast<Rbtree *>(this)->select(k);
+}
+
+// 找到 lo、hi 两条查找路径分叉的节点，左边收集 >= lo 的部分，
+// 右边收集 < hi 的部分，整棵子树在范围内时直接用它的聚合值
+TEMPLATE_RBT_M_FUNC aggregate(const K &lo, const K &hi) const->
+    typename Augment::value_type
+  requires kAugmented
+{
+  auto total = [](details::RBPtr<K, V, Augment> node) {
+    return node == nullptr ? Augment::identity() : node->summary.value;
+  };
+  auto less = [this](const K &a, const K &b) {
+    return details::less(comp_, a, b);
+  };
+  auto split = root_node;
+  while (split != nullptr and
+         (less(split->key, lo) or !less(split->key, hi)))
+    split = less(split->key, lo) ? split->r_node : split->l_node;
+  if (split == nullptr)
+    return Augment::identity();
+
+  auto left = Augment::identity(); // 按顺序在前面拼接
+  for (auto node = split->l_node; node != nullptr;) {
+    if (less(node->key, lo)) {
+      node = node->r_node;
+    } else {
+      left = Augment::combine(
+          Augment::combine(Augment::from(node->key, node->value),
+                           total(node->r_node)),
+          left);
+      node = node->l_node;
     }
+  }
+  auto right = Augment::identity(); // 按顺序在后面拼接
+  for (auto node = split->r_node; node != nullptr;) {
+    if (less(node->key, hi)) {
+      right = Augment::combine(
+          right, Augment::combine(total(node->l_node),
+                                  Augment::from(node->key, node->value)));
+      node = node->r_node;
+    } else {
+      node = node->l_node;
+    }
+  }
+  return Augment::combine(
+      Augment::combine(left, Augment::from(split->key, split->value)), right);
+}
+
+TEMPLATE_KVAC template <std::forward_iterator It, std::sentinel_for<It> S>
+auto Rbtree<K, V, Augment, Compare>::from_sorted(It first, S last,
+                                                 const Compare &comp)
+    -> Rbtree {
+  Rbtree res(comp);
+  const auto n = static_cast<size_t>(std::ranges::distance(first, last));
+  if (n == 0)
+    return res;
+  // 以中点为根递归建树，只有最深一层可能不满，把这一层染红黑高就都相同
+  const int red_depth = std::bit_width(n) - 1;
+  details::RBPtr<K, V, Augment> prev = nullptr;
+  res.reset_root(res.build(first, n, 0, red_depth, prev));
+  return res;
+}
+
+TEMPLATE_KVAC template <std::ranges::forward_range R>
+auto Rbtree<K, V, Augment, Compare>::from_sorted(R &&range,
+                                                 const Compare &comp)
+    -> Rbtree {
+  return from_sorted(std::ranges::begin(range), std::ranges::end(range), comp);
+}
+
+// 中序消耗 first 开始的 n 个元素，prev 是上一个建好的节点
+TEMPLATE_KVAC template <typename It>
+auto Rbtree<K, V, Augment, Compare>::build(It &first, size_t n, int depth,
+                                  int red_depth,
+                                  details::RBPtr<K, V, Augment> &prev)
+    -> details::RBPtr<K, V, Augment> {
+  if (n == 0)
+    return nullptr;
+  const size_t left = (n - 1) / 2;
+  auto l_node = build(first, left, depth + 1, red_depth, prev);
+  auto &&item = *first;
+  using Item = decltype(item);
+  auto node = pool_.create(depth == red_depth and depth > 0
+                               ? details::Color::RED
+                               : details::Color::BLACK,
+                           nullptr, std::get<0>(std::forward<Item>(item)),
+                           std::get<1>(std::forward<Item>(item)));
+  ++first;
+  assert(prev == nullptr or details::less(comp_, prev->key, node->key));
+  prev = node;
+  node->l_node = l_node;
+  if (l_node != nullptr)
+    l_node->set_father(node);
+  node->r_node = build(first, n - 1 - left, depth + 1, red_depth, prev);
+  if (node->r_node != nullptr)
+    node->r_node->set_father(node);
+  update(node);
+  return node;
+}
+
+TEMPLATE_RBT_M_FUNC whole() const->Subtree {
+  int bh = 0;
+  for (auto node = root_node; node != nullptr; node = node->l_node)
+    bh += !details::is_red(node);
+  return {root_node, bh};
+}
+
+// 拆成左子树、根、右子树。红色的孩子染黑，黑高加一
+TEMPLATE_RBT_M_FUNC expose(Subtree tree)
+    ->std::tuple<Subtree, details::RBPtr<K, V, Augment>, Subtree> {
+  auto detach = [bh = tree.bh - 1](details::RBPtr<K, V, Augment> node) {
+    if (node == nullptr)
+      return Subtree{};
+    node->set_father(nullptr);
+    if (!details::is_red(node))
+      return Subtree{node, bh};
+    node->set_color(details::Color::BLACK);
+    return Subtree{node, bh + 1};
+  };
+  auto root = tree.root;
+  std::tuple res{detach(root->l_node), root, detach(root->r_node)};
+  root->l_node = root->r_node = nullptr;
+  return res;
+}
+
+// l 中的 key < mid < r 中的 key。沿较高一棵的右（左）脊下降到黑高与另一棵
+// 相同的黑色节点，用红色的 mid 把两边接上，再按插入修正
+TEMPLATE_RBT_M_FUNC join_subtrees(Subtree l, details::RBPtr<K, V, Augment> mid,
+                                  Subtree r)
+    ->Subtree {
+  if (l.bh == r.bh) {
+    mid->l_node = l.root;
+    mid->r_node = r.root;
+    if (l.root != nullptr)
+      l.root->set_father(mid);
+    if (r.root != nullptr)
+      r.root->set_father(mid);
+    mid->set_father(nullptr);
+    mid->set_color(details::Color::BLACK);
+    update(mid);
+    return {mid, l.bh + 1};
+  }
+  const bool right = l.bh > r.bh; // mid 挂在 l 的右脊上
+  auto tall = right ? l : r;
+  auto low = right ? r : l;
+  details::RBPtr<K, V, Augment> father = nullptr;
+  auto node = tall.root;
+  for (int bh = tall.bh;
+       node != nullptr and (details::is_red(node) or bh > low.bh);) {
+    bh -= !details::is_red(node);
+    father = node;
+    node = right ? node->r_node : node->l_node;
+  }
+  (right ? father->r_node : father->l_node) = mid;
+  (right ? mid->l_node : mid->r_node) = node;
+  (right ? mid->r_node : mid->l_node) = low.root;
+  mid->set_father(father);
+  mid->set_color(details::Color::RED);
+  if (node != nullptr)
+    node->set_father(mid);
+  if (low.root != nullptr)
+    low.root->set_father(mid);
+  update_path(mid);
+  const bool grown = insert_fixup(tall.root, mid);
+  return {tall.root, tall.bh + grown};
+}
+
+TEMPLATE_RBT_M_FUNC join_subtrees(Subtree l, Subtree r)->Subtree {
+  if (l.root == nullptr)
+    return r;
+  auto [rest, last] = split_last(l);
+  return join_subtrees(rest, last, r);
+}
+
+// 返回 < key 的部分、等于 key 的节点（可能为空）和 > key 的部分
+TEMPLATE_RBT_M_FUNC split_subtree(Subtree tree, const K &key,
+                                  const Compare &comp)
+    ->std::tuple<Subtree, details::RBPtr<K, V, Augment>, Subtree> {
+  if (tree.root == nullptr)
+    return {};
+  auto [l, mid, r] = expose(tree);
+  if (details::less(comp, key, mid->key)) {
+    auto [ll, found, lr] = split_subtree(l, key, comp);
+    return {ll, found, join_subtrees(lr, mid, r)};
+  }
+  if (details::less(comp, mid->key, key)) {
+    auto [rl, found, rr] = split_subtree(r, key, comp);
+    return {join_subtrees(l, mid, rl), found, rr};
+  }
+  return {l, mid, r};
+}
+
+TEMPLATE_RBT_M_FUNC split_last(Subtree tree)
+    ->std::pair<Subtree, details::RBPtr<K, V, Augment>> {
+  auto [l, mid, r] = expose(tree);
+  if (r.root == nullptr)
+    return {l, mid};
+  auto [rest, last] = split_last(r);
+  return {join_subtrees(l, mid, rest), last};
+}
+
+TEMPLATE_RBT_M_FUNC join(K key, V value, Rbtree right)->void {
+  assert(rightmost_ == nullptr or
+         details::less(comp_, rightmost_->key, key));
+  assert(right.leftmost_ == nullptr or
+         details::less(comp_, key, right.leftmost_->key));
+  pool_.merge(right.pool_);
+  auto mid = pool_.create(details::Color::BLACK, nullptr, std::move(key),
+                          std::move(value));
+  auto res = join_subtrees(whole(), mid, right.whole());
+  right.reset_root(nullptr);
+  reset_root(res.root);
+}
+
+TEMPLATE_RBT_M_FUNC join(Rbtree right)->void {
+  assert(rightmost_ == nullptr or right.leftmost_ == nullptr or
+         details::less(comp_, rightmost_->key, right.leftmost_->key));
+  pool_.merge(right.pool_);
+  auto res = join_subtrees(whole(), right.whole());
+  right.reset_root(nullptr);
+  reset_root(res.root);
+}
+
+TEMPLATE_RBT_M_FUNC split(const K &key)->Rbtree {
+  auto [l, found, r] = split_subtree(whole(), key, comp_);
+  if (found != nullptr)
+    r = join_subtrees({}, found, r);
+  Rbtree res(comp_);
+  res.pool_ = pool_.share();
+  res.reset_root(r.root);
+  reset_root(l.root);
+  return res;
+}
+
+TEMPLATE_KVAC template <details::SetOp Op>
+auto Rbtree<K, V, Augment, Compare>::set_base(
+    Subtree a, Subtree b, std::vector<details::RBPtr<K, V, Augment>> &garbage)
+    -> Subtree {
+  if constexpr (Op == details::SetOp::UNION) {
+    return a.root != nullptr ? a : b;
+  } else if constexpr (Op == details::SetOp::INTERSECTION) {
+    garbage.push_back(a.root != nullptr ? a.root : b.root);
+    return {};
+  } else {
+    if (a.root != nullptr)
+      return a;
+    garbage.push_back(b.root);
+    return {};
+  }
+}
+
+// 并集、交集用 a 的根去切 b，差集用 b 的根去切 a，左右两半互不相关
+TEMPLATE_KVAC template <details::SetOp Op>
+auto Rbtree<K, V, Augment, Compare>::set_step(
+    Subtree a, Subtree b, const Compare &comp,
+    std::vector<details::RBPtr<K, V, Augment>> &garbage) -> SetStep {
+  if constexpr (Op == details::SetOp::DIFFERENCE) {
+    auto [b_l, pivot, b_r] = expose(b);
+    auto [a_l, found, a_r] = split_subtree(a, pivot->key, comp);
+    garbage.push_back(pivot);
+    if (found != nullptr)
+      garbage.push_back(found);
+    return {a_l, b_l, a_r, b_r, nullptr};
+  } else {
+    auto [a_l, pivot, a_r] = expose(a);
+    auto [b_l, found, b_r] = split_subtree(b, pivot->key, comp);
+    if (found != nullptr)
+      garbage.push_back(found);
+    if (Op == details::SetOp::INTERSECTION and found == nullptr) {
+      garbage.push_back(pivot);
+      return {a_l, b_l, a_r, b_r, nullptr};
     }
-    swap_color(sibling, father);
-    distant_nephw->color = details::Color::BLACK;
+    return {a_l, b_l, a_r, b_r, pivot};
   }
 }
 
-TEMPLATE_RBT_M_FUNC remove(K key)->void {
-  auto node = details_find(key);
-  if (node == nullptr or node->key != key)
+TEMPLATE_KVAC template <details::SetOp Op>
+auto Rbtree<K, V, Augment, Compare>::set_operation(
+    Subtree a, Subtree b, const Compare &comp,
+    std::vector<details::RBPtr<K, V, Augment>> &garbage) -> Subtree {
+  if (a.root == nullptr or b.root == nullptr)
+    return set_base<Op>(a, b, garbage);
+  auto step = set_step<Op>(a, b, comp, garbage);
+  auto l = set_operation<Op>(step.a_l, step.b_l, comp, garbage);
+  auto r = set_operation<Op>(step.a_r, step.b_r, comp, garbage);
+  return step.mid != nullptr ? join_subtrees(l, step.mid, r)
+                             : join_subtrees(l, r);
+}
+
+// 在调用线程里展开上面 depth 层，先序记下每层的 mid，剩下的子问题作为任务
+TEMPLATE_KVAC template <details::SetOp Op>
+auto Rbtree<K, V, Augment, Compare>::set_fork(
+    Subtree a, Subtree b, const Compare &comp, int depth,
+    std::vector<SetFrame> &frames,
+    std::vector<std::pair<Subtree, Subtree>> &tasks,
+    std::vector<details::RBPtr<K, V, Augment>> &garbage) -> void {
+  constexpr int kMinHeight = 8; // 黑高 8 至少有 255 个节点，再小不值得拆
+  if (depth == 0 or std::min(a.bh, b.bh) < kMinHeight) {
+    frames.push_back({true, nullptr});
+    tasks.emplace_back(a, b);
     return;
-  switch_remove(node);
+  }
+  auto step = set_step<Op>(a, b, comp, garbage);
+  frames.push_back({false, step.mid});
+  set_fork<Op>(step.a_l, step.b_l, comp, depth - 1, frames, tasks, garbage);
+  set_fork<Op>(step.a_r, step.b_r, comp, depth - 1, frames, tasks, garbage);
 }
 
-TEMPLATE_RBT_M_FUNC modify(K key, V value)->void {
-  auto res = details_find(key);
-  if (res->key != key)
-    throw;
-  res->value = value;
+// 按 set_fork 的先序把任务结果自底向上 join 起来
+TEMPLATE_RBT_M_FUNC set_gather(const std::vector<SetFrame> &frames,
+                               size_t &frame, std::vector<Subtree> &results,
+                               size_t &result)
+    ->Subtree {
+  const auto &top = frames[frame++];
+  if (top.leaf)
+    return results[result++];
+  auto l = set_gather(frames, frame, results, result);
+  auto r = set_gather(frames, frame, results, result);
+  return top.mid != nullptr ? join_subtrees(l, top.mid, r)
+                            : join_subtrees(l, r);
 }
-TEMPLATE_RBT_M_FUNC contains(K key)->bool {
-  auto res = details_find(key);
-  if (res == nullptr)
-    return false;
-  return res->key == key;
+
+TEMPLATE_KVAC template <details::SetOp Op, typename Executor>
+auto Rbtree<K, V, Augment, Compare>::set_apply(Rbtree &other, Executor *executor)
+    -> void {
+  pool_.merge(other.pool_);
+  auto a = whole();
+  auto b = other.whole();
+  other.reset_root(nullptr);
+  std::vector<details::RBPtr<K, V, Augment>> garbage;
+  Subtree res;
+  if constexpr (std::is_same_v<Executor, details::Sequential>) {
+    res = set_operation<Op>(a, b, comp_, garbage);
+  } else if (executor == nullptr) {
+    res = set_operation<Op>(a, b, comp_, garbage);
+  } else {
+    // 每个线程大约四个任务
+    const int depth =
+        std::bit_width(std::max(1u, std::thread::hardware_concurrency())) + 2;
+    std::vector<SetFrame> frames;
+    std::vector<std::pair<Subtree, Subtree>> tasks;
+    set_fork<Op>(a, b, comp_, depth, frames, tasks, garbage);
+    auto run = [comp = comp_](Subtree a, Subtree b) {
+      std::vector<details::RBPtr<K, V, Augment>> garbage;
+      auto res = set_operation<Op>(a, b, comp, garbage);
+      return std::pair{res, std::move(garbage)};
+    };
+    std::vector<decltype(executor->submit(run, a, b))> futures;
+    futures.reserve(tasks.size());
+    for (auto [task_a, task_b] : tasks)
+      futures.push_back(executor->submit(run, task_a, task_b));
+    std::vector<Subtree> results;
+    results.reserve(tasks.size());
+    for (auto &future : futures) {
+      auto [part, part_garbage] = future.get();
+      results.push_back(part);
+      garbage.insert(garbage.end(), part_garbage.begin(), part_garbage.end());
+    }
+    size_t frame = 0, result = 0;
+    res = set_gather(frames, frame, results, result);
+  }
+  for (auto node : garbage)
+    release(node);
+  reset_root(res.root);
 }
 
-TEMPLATE_RBT_M_FUNC operator[](const K &key)->V & {
-  auto res = details_find(key);
-  if (res->key == key)
-    return res->value;
-  insert(key, V{});
-  return details_find(key)->value;
+TEMPLATE_KVAC template <typename Executor>
+auto Rbtree<K, V, Augment, Compare>::unite(Rbtree other, Executor *executor) -> void {
+  set_apply<details::SetOp::UNION>(other, executor);
 }
-TEMPLATE_RBT_M_FUNC swap(Rbtree &value) noexcept -> void {
-  std::swap(root_node, value->root_node);
-}
-
-TEMPLATE_RBT_M_FUNC draw(std::filesystem::path pathname)->void {
-  std::ofstream dot(pathname);
-  dot << "graph rbtree {\n";
-  auto dfs = [&dot](auto dfs, details::RBPtr<K, V> &node) -> void {
-    auto l_node = node->l_node;
-    auto r_node = node->r_node;
-    dot << std::format("node_{} [color={}, "
-                       "label=\"K={}, V={}\"];\n",
-                       node->key,
-                       (node->color == details::Color::RED ? "red" : "black"),
-                       node->key, node->value);
-    if (l_node != nullptr) {
-      auto f_node = l_node->f_node.lock();
-      dot << std::format("node_{}--node_{};\n", node->key, l_node->key);
-      dfs(dfs, l_node);
-    } else {
-      dot << std::format(
-          "l_nil_{} [color={}, label=\"Nil\"];\nnode_{}--l_nil_{};\n",
-          node->key, "black", node->key, node->key, node->key);
-    }
-    if (r_node != nullptr) {
-      auto f_node = r_node->f_node.lock();
-      dot << std::format("node_{}--node_{};\n", node->key, r_node->key);
-      dfs(dfs, r_node);
+
+TEMPLATE_KVAC template <typename Executor>
+auto Rbtree<K, V, Augment, Compare>::intersect(Rbtree other, Executor *executor)
+    -> void {
+  set_apply<details::SetOp::INTERSECTION>(other, executor);
+}
+
+TEMPLATE_KVAC template <typename Executor>
+auto Rbtree<K, V, Augment, Compare>::subtract(Rbtree other, Executor *executor)
+    -> void {
+  set_apply<details::SetOp::DIFFERENCE>(other, executor);
+}
+
+// 带父指针的中序遍历，stage 表示 node 的进度：0 刚到达，1 左子树已走完，
+// 2 两棵子树都走完。depth、black 是根到 node 的节点数和黑色节点数
+TEMPLATE_RBT_M_FUNC validate() const->TreeStats {
+  TreeStats res;
+  auto fail = [&res](const char *error) {
+    res.error = error;
+    return res;
+  };
+  if (root_node == nullptr) {
+    if (leftmost_ != nullptr or rightmost_ != nullptr)
+      return fail("leftmost/rightmost of an empty tree");
+    return res;
+  }
+  if (details::is_red(root_node))
+    return fail("red root");
+  if (root_node->father() != nullptr)
+    return fail("root has a father");
+
+  res.black_height = -1;
+  details::RBPtr<K, V, Augment> prev = nullptr; // 中序的上一个
+  auto node = root_node;
+  int depth = 1, black = 1, stage = 0;
+  // 走到空孩子时这条路径结束
+  auto leaf_path = [&] {
+    if (res.black_height < 0)
+      res.black_height = black;
+    return res.black_height == black;
+  };
+  auto descend = [&](details::RBPtr<K, V, Augment> child) {
+    node = child;
+    ++depth;
+    black += !details::is_red(child);
+    stage = 0;
+  };
+  for (;;) {
+    if (stage == 0) {
+      ++res.size;
+      res.height = std::max(res.height, depth);
+      if (details::is_red(node) and details::is_red(node->father()))
+        return fail("red node with a red child");
+      if (auto l = node->l_node; l != nullptr) {
+        if (l->father() != node)
+          return fail("bad father pointer");
+        descend(l);
+        continue;
+      }
+      if (!leaf_path())
+        return fail("black height differs");
+      stage = 1;
+    }
+    if (stage == 1) {
+      if (prev == nullptr and node != leftmost_)
+        return fail("leftmost_ is not the first node");
+      if (prev != nullptr and !details::less(comp_, prev->key, node->key))
+        return fail("keys out of order");
+      prev = node;
+      if (auto r = node->r_node; r != nullptr) {
+        if (r->father() != node)
+          return fail("bad father pointer");
+        descend(r);
+        continue;
+      }
+      if (!leaf_path())
+        return fail("black height differs");
+    }
+    if constexpr (kAugmented) {
+      auto l = node->l_node, r = node->r_node;
+      if (node->summary.size != 1 + (l ? l->summary.size : 0) +
+                                    (r ? r->summary.size : 0))
+        return fail("subtree size out of date");
+      if constexpr (std::equality_comparable<typename Augment::value_type>) {
+        auto value = Augment::from(node->key, node->value);
+        if (l != nullptr)
+          value = Augment::combine(l->summary.value, value);
+        if (r != nullptr)
+          value = Augment::combine(value, r->summary.value);
+        if (!(value == node->summary.value))
+          return fail("aggregate out of date");
+      }
+    }
+    auto father = node->father();
+    if (father == nullptr)
+      break;
+    stage = father->l_node == node ? 1 : 2;
+    --depth;
+    black -= !details::is_red(node);
+    node = father;
+  }
+  if (prev != rightmost_)
+    return fail("rightmost_ is not the last node");
+  res.memory = res.size * sizeof(details::Node<K, V, Augment>);
+  return res;
+}
+
+TEMPLATE_RBT_M_FUNC draw(std::filesystem::path pathname,
+                         DrawLimits limits) const->void {
+  draw_subtree(std::move(pathname), root_node, limits);
+}
+
+TEMPLATE_RBT_M_FUNC draw(std::filesystem::path pathname, const K &key,
+                         DrawLimits limits) const->void {
+  auto [node, found] = details_find(key);
+  draw_subtree(std::move(pathname), found ? node : nullptr, limits);
+}
+
+// 先序遍历，节点按访问顺序编号，ids[d] 是当前路径上第 d 层节点的编号。
+// 输出攒在 buffer 里，满 1 MiB 写一次文件
+TEMPLATE_RBT_M_FUNC draw_subtree(std::filesystem::path pathname,
+                                 details::RBPtr<K, V, Augment> start,
+                                 DrawLimits limits) const->void {
+  constexpr size_t kFlush = 1 << 20;
+  std::ofstream dot(pathname, std::ios::binary);
+  std::string buffer;
+  buffer.reserve(kFlush + 4096);
+  auto out = std::back_inserter(buffer);
+  auto put_id = [&buffer](char prefix, size_t id) {
+    char digits[24];
+    digits[0] = prefix;
+    auto end = std::to_chars(digits + 1, digits + sizeof(digits), id).ptr;
+    buffer.append(digits, end);
+  };
+  auto flush = [&] {
+    dot.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    buffer.clear();
+  };
+
+  buffer += "graph rbtree {\n";
+  if (limits.max_depth <= 0 or limits.max_nodes == 0)
+    start = nullptr;
+  std::vector<size_t> ids;
+  size_t next_id = 0; // Nil 和省略节点也占编号
+  size_t drawn = 0;   // 画出的树中节点数
+  auto node = start;
+  int depth = 0, stage = 0;
+  // node 的一个孩子：空的画成 Nil，超出范围的画成省略节点，返回是否走下去
+  auto child = [&](details::RBPtr<K, V, Augment> next) {
+    if (next != nullptr and depth + 1 < limits.max_depth and
+        drawn < limits.max_nodes)
+      return true;
+    const size_t id = next_id++;
+    put_id('m', id);
+    if (next == nullptr) {
+      buffer += " [color=black, label=\"Nil\"];\n";
+    } else if constexpr (kAugmented) {
+      std::format_to(out, " [shape=box, label=\"... {} nodes\"];\n",
+                     next->summary.size);
     } else {
-      dot << std::format(
-          "r_nil_{} [color={}, label=\"Nil\"];\nnode_{}--r_nil_{};\n",
-          node->key, "black", node->key, node->key, node->key);
+      buffer += " [shape=box, label=\"...\"];\n";
     }
+    put_id('n', ids[depth]);
+    buffer += "--";
+    put_id('m', id);
+    buffer += ";\n";
+    return false;
   };
-  if (root_node != nullptr)
-    dfs(dfs, root_node);
-  dot << "}\n";
+  while (node != nullptr) {
+    if (stage == 0) {
+      ids.resize(depth + 1);
+      ids[depth] = next_id++;
+      ++drawn;
+      put_id('n', ids[depth]);
+      buffer += details::is_red(node) ? " [color=red, label=\"K="
+                                      : " [color=black, label=\"K=";
+      std::format_to(out, "{}", node->key);
+      buffer += ", V=";
+      std::format_to(out, "{}", node->value);
+      buffer += "\"];\n";
+      if (depth > 0) {
+        put_id('n', ids[depth - 1]);
+        buffer += "--";
+        put_id('n', ids[depth]);
+        buffer += ";\n";
+      }
+      if (buffer.size() >= kFlush)
+        flush();
+      if (child(node->l_node)) {
+        node = node->l_node;
+        ++depth;
+        continue;
+      }
+      stage = 1;
+    }
+    if (stage == 1) {
+      if (child(node->r_node)) {
+        node = node->r_node;
+        ++depth;
+        stage = 0;
+        continue;
+      }
+    }
+    if (node == start)
+      break;
+    auto father = node->father();
+    stage = father->l_node == node ? 1 : 2;
+    --depth;
+    node = father;
+  }
+  buffer += "}\n";
+  flush();
 }
 
 } // namespace rbt
 
-#undef TEMPLATE_KV
+#undef TEMPLATE_KVAC
 #undef TEMPLATE_RBT_C_FUNC
 #undef TEMPLATE_RBT_M_FUNC
@@ -1,9 +1,27 @@
+#include <ThreadPool.hpp>
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <bptree.h>
 #include <chrono>
+#include <concurrent_rbtree.h>
+#include <filesystem>
 #include <format>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <persistent_rbtree.h>
+#include <random>
 #include <rbtree.h>
+#include <shared_mutex>
+#include <skiplist.hpp>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 constexpr int N = 1e6;
 #define CLAC_TIME(start)                                                       \
@@ -46,7 +64,931 @@ auto test_rbt() -> void {
   }
   std::cout << std::format("rbt remove : {} ms\n", CLAC_TIME(start));
 }
+// 随机插入、删除、查找，与 std::map 对照
+auto test_random() -> void {
+  std::mt19937 rng(42);
+  for (int range : {16, 1000, 100000}) {
+    std::map<int, int> map;
+    rbt::Rbtree<int, int> rbt;
+    for (int i = 0; i < 200000; ++i) {
+      const int key = static_cast<int>(rng() % range);
+      switch (rng() % 4) {
+      case 0:
+      case 1:
+        map[key] = i;
+        rbt.insert(key, i);
+        break;
+      case 2:
+        map.erase(key);
+        rbt.remove(key);
+        break;
+      default:
+        assert(rbt.contains(key) == map.contains(key));
+        if (map.contains(key))
+          assert(rbt[key] == map[key]);
+      }
+      // 修正之后颜色和黑高仍然合法
+      if (i % 10000 == 0)
+        assert(rbt.validate().ok());
+    }
+    const auto stats = rbt.validate();
+    assert(stats.ok() and stats.size == map.size());
+    for (int key = 0; key < range; ++key)
+      assert(rbt.contains(key) == map.contains(key));
+    // 删空后还能继续用
+    for (int key = 0; key < range; ++key)
+      rbt.remove(key);
+    assert(rbt.validate().ok());
+    for (int key = 0; key < range; ++key)
+      assert(!rbt.contains(key));
+    rbt.insert(1, 1);
+    assert(rbt[1] == 1);
+  }
+}
+
+// 乱序插入后乱序删除
+auto test_random_remove() -> void {
+  std::vector<int> keys(N);
+  for (int i = 0; i < N; ++i)
+    keys[i] = i;
+  std::mt19937 rng(7);
+  std::shuffle(keys.begin(), keys.end(), rng);
+  std::vector<int> order = keys;
+  std::shuffle(order.begin(), order.end(), rng);
+
+  std::map<int, int> map;
+  for (int key : keys)
+    map.insert({key, key});
+  auto start = std::chrono::steady_clock::now();
+  for (int key : order)
+    map.erase(key);
+  std::cout << std::format("map random remove : {} ms\n", CLAC_TIME(start));
+
+  rbt::Rbtree<int, int> rbt;
+  for (int key : keys)
+    rbt.insert(key, key);
+  start = std::chrono::steady_clock::now();
+  for (int key : order)
+    rbt.remove(key);
+  std::cout << std::format("rbt random remove : {} ms\n", CLAC_TIME(start));
+}
+
+// 迭代、上下界、区间与 std::map 对照
+auto test_iterator() -> void {
+  std::mt19937 rng(43);
+  std::map<int, int> map;
+  rbt::Rbtree<int, int> rbt;
+  assert(rbt.begin() == rbt.end());
+  for (int i = 0; i < 20000; ++i) {
+    const int key = static_cast<int>(rng() % 50000);
+    if (rng() % 4 == 0) {
+      map.erase(key);
+      rbt.remove(key);
+    } else {
+      map[key] = i;
+      rbt.insert(key, i);
+    }
+  }
+  auto it = rbt.begin();
+  for (auto [key, value] : map) {
+    assert(it != rbt.end() and it.key() == key and it.value() == value);
+    ++it;
+  }
+  assert(it == rbt.end());
+  for (auto rit = map.rbegin(); rit != map.rend(); ++rit)
+    assert((--it).key() == rit->first);
+  assert(it == rbt.begin());
+
+  for (int i = 0; i < 10000; ++i) {
+    const int key = static_cast<int>(rng() % 50002) - 1;
+    auto lb = rbt.lower_bound(key);
+    auto ub = rbt.upper_bound(key);
+    auto m_lb = map.lower_bound(key);
+    auto m_ub = map.upper_bound(key);
+    assert((lb == rbt.end()) == (m_lb == map.end()));
+    assert(lb == rbt.end() or lb.key() == m_lb->first);
+    assert((ub == rbt.end()) == (m_ub == map.end()));
+    assert(ub == rbt.end() or ub.key() == m_ub->first);
+    assert((rbt.find(key) == rbt.end()) == !map.contains(key));
+    auto [first, last] = rbt.equal_range(key);
+    assert(first == lb and last == ub);
+  }
+
+  const auto &view = rbt;
+  long long sum = 0, expected = 0;
+  for (auto [key, value] : view.range(1000, 2000))
+    sum += value;
+  for (auto i = map.lower_bound(1000); i != map.lower_bound(2000); ++i)
+    expected += i->second;
+  assert(sum == expected);
+  assert(rbt.range(2000, 1000).empty());
+  for (auto [key, value] : rbt.range(0, 100))
+    value = -1;
+  assert(rbt.begin().value() == -1);
+
+  // hint 正确、错误、指向相等的 key
+  rbt::Rbtree<int, int> small;
+  for (int i = 0; i < 100; i += 2)
+    small.insert(small.end(), i, i);
+  auto pos = small.insert(small.find(10), 9, 9);
+  assert(pos.key() == 9 and (++pos).key() == 10);
+  small.insert(small.begin(), 51, 51);
+  small.insert(small.find(20), 20, -20);
+  assert(small[20] == -20 and small.contains(51));
+  int prev = -1, count = 0;
+  for (auto [key, value] : small) {
+    assert(prev < key);
+    prev = key;
+    ++count;
+  }
+  assert(count == 52);
+}
+
+// 按 key 顺序拼接，检查 combine 的顺序
+struct Concat {
+  using value_type = std::string;
+  static auto identity() -> std::string { return {}; }
+  static auto from(const int &, const std::string &value) -> std::string {
+    return value;
+  }
+  static auto combine(const std::string &a, const std::string &b)
+      -> std::string {
+    return a + b;
+  }
+};
+
+// 不用增强策略时节点大小不变
+static_assert(sizeof(rbt::details::Node<int, int>) == 32);
+
+// rank / select / aggregate 与 std::map 对照
+auto test_augment() -> void {
+  std::mt19937 rng(44);
+  std::map<int, int> map;
+  rbt::Rbtree<int, int, rbt::Sum<long long>> sum;
+  rbt::Rbtree<int, int, rbt::Max<int>> max;
+  rbt::Rbtree<int, int, rbt::Count> count;
+  for (int i = 0; i < 20000; ++i) {
+    const int key = static_cast<int>(rng() % 4000);
+    const int value = static_cast<int>(rng() % 1000);
+    if (rng() % 3 == 0) {
+      map.erase(key);
+      sum.remove(key);
+      max.remove(key);
+      count.remove(key);
+    } else {
+      map[key] = value;
+      sum.insert(key, value);
+      max.insert(key, value);
+      count.insert(count.end(), key, value);
+    }
+    if (i % 50 != 0)
+      continue;
+    assert(sum.size() == map.size() and count.size() == map.size());
+    const int lo = static_cast<int>(rng() % 4000);
+    const int hi = lo + static_cast<int>(rng() % 500);
+    long long expected_sum = 0;
+    int expected_max = std::numeric_limits<int>::lowest();
+    for (auto it = map.lower_bound(lo); it != map.lower_bound(hi); ++it) {
+      expected_sum += it->second;
+      expected_max = std::max(expected_max, it->second);
+    }
+    assert(sum.aggregate(lo, hi) == expected_sum);
+    assert(max.aggregate(lo, hi) == expected_max);
+    const size_t rank = std::distance(map.begin(), map.lower_bound(lo));
+    assert(count.rank(lo) == rank and sum.rank(lo) == rank);
+    auto selected = count.select(rank);
+    assert((selected == count.end()) == (rank == map.size()));
+    assert(selected == count.end() or
+           selected.key() == map.lower_bound(lo)->first);
+  }
+  assert(count.select(map.size()) == count.end());
+
+  rbt::Rbtree<int, std::string, Concat> text;
+  const std::string word = "red-black";
+  for (int i : {4, 0, 8, 2, 6, 1, 7, 3, 5})
+    text.insert(i, word.substr(i, 1));
+  assert(text.aggregate(0, 9) == word);
+  assert(text.aggregate(2, 7) == "d-bla");
+  text.modify(3, "_");
+  text.remove(4);
+  assert(text.aggregate(0, 100) == "red_lack");
+  rbt::Rbtree<int, std::string, Concat> copy(text);
+  assert(copy.aggregate(1, 8) == "ed_lac" and copy.select(3).value() == "_");
+}
+
+// 递增的时间戳：带 hint 插入
+auto test_hint_insert() -> void {
+  std::map<int, int> map;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i <= N; ++i)
+    map.emplace_hint(map.end(), i, i);
+  std::cout << std::format("map hint insert : {} ms\n", CLAC_TIME(start));
+
+  rbt::Rbtree<int, int> rbt;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i <= N; ++i)
+    rbt.insert(rbt.end(), i, i);
+  std::cout << std::format("rbt hint insert : {} ms\n", CLAC_TIME(start));
+  long long sum = 0;
+  start = std::chrono::steady_clock::now();
+  for (auto [key, value] : rbt)
+    sum += value;
+  std::cout << std::format("rbt scan : {} ms (sum {})\n", CLAC_TIME(start),
+                           sum);
+  assert(sum == static_cast<long long>(N) * (N + 1) / 2);
+}
+
+// from_sorted / split / join / 集合操作，与 std::map 和 std::set_* 对照
+auto test_bulk() -> void {
+  using Tree = rbt::Rbtree<int, int, rbt::Count>;
+  using Pairs = std::vector<std::pair<int, int>>;
+  auto same = [](const Tree &tree, const Pairs &expected) {
+    assert(tree.validate().ok());
+    assert(tree.size() == expected.size());
+    assert(std::equal(tree.begin(), tree.end(), expected.begin(),
+                      [](auto a, const auto &b) {
+                        return a.first == b.first and a.second == b.second;
+                      }));
+  };
+  auto by_key = [](const auto &a, const auto &b) { return a.first < b.first; };
+  std::mt19937 rng(45);
+  ctp::ThreadPool pool(4);
+  for (int round = 0; round < 200; ++round) {
+    const int range = 1 + static_cast<int>(rng() % 5000);
+    std::map<int, int> a, b;
+    for (int i = static_cast<int>(rng() % 3000); i > 0; --i)
+      a[static_cast<int>(rng() % range)] = static_cast<int>(rng());
+    for (int i = static_cast<int>(rng() % 3000); i > 0; --i)
+      b[static_cast<int>(rng() % range)] = static_cast<int>(rng());
+    const Pairs pa(a.begin(), a.end()), pb(b.begin(), b.end());
+    const auto ta = Tree::from_sorted(pa);
+    const auto tb = Tree::from_sorted(pb);
+    same(ta, pa);
+
+    const int key = static_cast<int>(rng() % range);
+    Tree lo(ta);
+    auto hi = lo.split(key);
+    const auto mid =
+        std::ranges::lower_bound(pa, key, {}, &std::pair<int, int>::first);
+    same(lo, Pairs(pa.begin(), mid));
+    same(hi, Pairs(mid, pa.end()));
+    lo.insert(-1, 0);
+    hi.insert(range, 0);
+    lo.join(std::move(hi));
+    lo.remove(-1);
+    lo.remove(range);
+    same(lo, pa);
+    if (!a.contains(key)) {
+      hi = lo.split(key);
+      lo.join(key, 7, std::move(hi));
+      assert(lo.find(key).value() == 7 and lo.size() == pa.size() + 1);
+      assert(lo.validate().ok());
+    }
+
+    Pairs merged, inter, diff; // key 相同时保留 a 的值，与 std::set_* 一致
+    std::ranges::set_union(pa, pb, std::back_inserter(merged), by_key);
+    std::ranges::set_intersection(pa, pb, std::back_inserter(inter), by_key);
+    std::ranges::set_difference(pa, pb, std::back_inserter(diff), by_key);
+    for (auto *executor : {static_cast<ctp::ThreadPool *>(nullptr), &pool}) {
+      Tree u(ta), i(ta), d(ta);
+      u.unite(tb, executor);
+      i.intersect(tb, executor);
+      d.subtract(tb, executor);
+      same(u, merged);
+      same(i, inter);
+      same(d, diff);
+    }
+  }
+}
+
+// 只能移动的 key
+struct Name {
+  std::unique_ptr<std::string> text;
+  explicit Name(std::string text)
+      : text(std::make_unique<std::string>(std::move(text))) {}
+  auto operator<(const Name &other) const -> bool {
+    return *text < *other.text;
+  }
+};
+
+auto test_compare() -> void {
+  // 降序，增强与 join/split/集合操作也按比较器
+  using Desc = rbt::Rbtree<int, int, rbt::Sum<long long>, std::greater<int>>;
+  std::vector<std::pair<int, int>> items;
+  for (int i = 1000; i > 0; i -= 2)
+    items.emplace_back(i, i);
+  auto desc = Desc::from_sorted(items);
+  std::vector<std::pair<int, int>> odd;
+  for (int i = 999; i > 0; i -= 2)
+    odd.emplace_back(i, i);
+  desc.unite(Desc::from_sorted(odd));
+  assert(desc.validate().ok());
+  assert(desc.size() == 1000 and desc.begin().key() == 1000);
+  assert(desc.lower_bound(500).key() == 500 and
+         desc.upper_bound(500).key() == 499);
+  assert(desc.rank(990) == 10);
+  assert(desc.aggregate(10, 0) == 55); // 10 + 9 + ... + 1
+  auto tail = desc.split(100);
+  assert(desc.size() == 900 and tail.size() == 100 and
+         tail.begin().key() == 100);
+  assert(desc.validate().ok() and tail.validate().ok());
+  desc.join(std::move(tail));
+  assert(desc.size() == 1000 and std::prev(desc.end()).key() == 1);
+  assert(desc.validate().ok());
+
+  // 三路比较，is_transparent 查找不构造 std::string
+  rbt::Rbtree<std::string, int, rbt::NoAugment, std::compare_three_way> words;
+  std::map<std::string, int, std::less<>> expected;
+  std::mt19937 rng(49);
+  for (int i = 0; i < 20000; ++i) {
+    auto word = std::to_string(rng() % 5000);
+    if (rng() % 3 == 0) {
+      words.remove(std::string_view(word));
+      expected.erase(word);
+    } else {
+      words.insert(word, i);
+      expected.insert_or_assign(word, i);
+    }
+    assert(words.contains(std::string_view(word)) == expected.contains(word));
+  }
+  assert(words.validate().ok());
+  assert(std::equal(words.begin(), words.end(), expected.begin(),
+                    expected.end(), [](auto a, const auto &b) {
+                      return a.first == b.first and a.second == b.second;
+                    }));
+  assert((words.find(std::string_view("4999")) != words.end()) ==
+         expected.contains("4999"));
+  assert(words.lower_bound(std::string_view("5")).key() ==
+         expected.lower_bound("5")->first);
+
+  // key、value 都只能移动；try_emplace 在 key 已存在时不动参数
+  rbt::Rbtree<Name, std::unique_ptr<int>> names;
+  for (int i = 0; i < 100; ++i)
+    names.insert(Name(std::to_string(i)), std::make_unique<int>(i));
+  auto value = std::make_unique<int>(-1);
+  auto [pos, inserted] = names.try_emplace(Name("42"), std::move(value));
+  assert(!inserted and value != nullptr and *pos.value() == 42);
+  std::tie(pos, inserted) = names.emplace("100", std::move(value));
+  assert(inserted and value == nullptr and *pos.value() == -1);
+  std::tie(pos, inserted) = names.insert_or_assign(Name("7"),
+                                                   std::make_unique<int>(70));
+  assert(!inserted and *names[Name("7")] == 70);
+  names.remove(Name("7"));
+  assert(!names.contains(Name("7")) and names.contains(Name("100")));
+  assert(names.validate().ok());
+}
+
+auto test_validate() -> void {
+  std::mt19937 rng(50);
+  rbt::Rbtree<int, int, rbt::Sum<long long>> tree;
+  for (int i = 0; i < 100000; ++i) {
+    const int key = static_cast<int>(rng() % 20000);
+    if (rng() % 3 == 0)
+      tree.remove(key);
+    else
+      tree.insert(key, i);
+    if (i % 10000 != 0)
+      continue;
+    auto stats = tree.validate();
+    assert(stats.ok() and stats.size == tree.size());
+    assert(stats.height <= 2 * stats.black_height);
+  }
+  // 经迭代器改值不会更新聚合值
+  tree.begin().value() += 1;
+  assert(std::string_view(tree.validate().error) == "aggregate out of date");
+  tree.insert(tree.begin().key(), tree.begin().value());
+  assert(tree.validate().ok());
+
+  // 比较器的方向中途变了，中序就不再递增
+  struct Flip {
+    const bool *reversed;
+    auto operator()(int a, int b) const -> bool {
+      return *reversed ? b < a : a < b;
+    }
+  };
+  bool reversed = false;
+  rbt::Rbtree<int, int, rbt::NoAugment, Flip> flip(Flip{&reversed});
+  for (int i = 0; i < 100; ++i)
+    flip.insert(i, i);
+  assert(flip.validate().ok() and flip.validate().black_height > 0);
+  reversed = true;
+  assert(std::string_view(flip.validate().error) == "keys out of order");
+
+  // 前 4 层 15 个节点，key 不存在时是空图
+  auto count_nodes = [](const std::filesystem::path &path) {
+    std::ifstream dot(path);
+    int res = 0;
+    for (std::string line; std::getline(dot, line);)
+      res += line.find("label=\"K=") != std::string::npos;
+    return res;
+  };
+  const auto path = std::filesystem::temp_directory_path() / "rbt_validate.dot";
+  tree.draw(path, {4});
+  assert(count_nodes(path) == 15);
+  tree.draw(path, {10, 100});
+  assert(count_nodes(path) == 100);
+  tree.draw(path, -1, {});
+  assert(count_nodes(path) == 0);
+  std::filesystem::remove(path);
+}
+
+// 批量建树和并集，N 个 key 分成奇偶两半
+auto test_bulk_speed() -> void {
+  std::vector<std::pair<int, int>> odd, even;
+  for (int i = 0; i <= N; ++i)
+    (i & 1 ? odd : even).emplace_back(i, i);
+  auto start = std::chrono::steady_clock::now();
+  std::map<int, int> map(odd.begin(), odd.end());
+  map.insert(even.begin(), even.end());
+  std::cout << std::format("map build + merge : {} ms\n", CLAC_TIME(start));
+
+  start = std::chrono::steady_clock::now();
+  auto rbt = rbt::Rbtree<int, int>::from_sorted(odd);
+  std::cout << std::format("rbt from_sorted : {} ms\n", CLAC_TIME(start));
+  start = std::chrono::steady_clock::now();
+  rbt.unite(rbt::Rbtree<int, int>::from_sorted(even));
+  std::cout << std::format("rbt from_sorted + unite : {} ms\n",
+                           CLAC_TIME(start));
+
+  ctp::ThreadPool pool(4);
+  auto parallel = rbt::Rbtree<int, int>::from_sorted(odd);
+  start = std::chrono::steady_clock::now();
+  parallel.unite(rbt::Rbtree<int, int>::from_sorted(even), &pool);
+  std::cout << std::format("rbt from_sorted + unite (4 threads) : {} ms\n",
+                           CLAC_TIME(start));
+  long long sum = 0;
+  for (auto [key, value] : parallel)
+    sum += value;
+  std::cout << std::format("rbt unite sum : {}\n", sum);
+  assert(sum == static_cast<long long>(N) * (N + 1) / 2);
+}
+
+// 快照在之后的修改中保持不变，并且可以在别的线程里读
+auto test_persistent() -> void {
+  using Tree = rbt::PersistentRbtree<int, int>;
+  auto same = [](const Tree::Snapshot &snapshot,
+                 const std::map<int, int> &expected) {
+    assert(snapshot.size() == expected.size());
+    auto it = expected.begin();
+    for (auto [key, value] : snapshot) {
+      assert(it->first == key and it->second == value);
+      ++it;
+    }
+  };
+  std::mt19937 rng(46);
+  Tree tree;
+  std::map<int, int> map;
+  std::vector<std::pair<Tree::Snapshot, std::map<int, int>>> versions;
+  for (int i = 0; i < 100000; ++i) {
+    const int key = static_cast<int>(rng() % 3000);
+    if (rng() % 3 == 0) {
+      tree.remove(key);
+      map.erase(key);
+    } else {
+      tree.insert(key, i);
+      map[key] = i;
+    }
+    if (i % 5000 == 0)
+      versions.emplace_back(tree.snapshot(), map);
+  }
+  Tree copy(tree);
+  copy.insert(-1, -1);
+  copy.remove(map.begin()->first);
+  assert(!tree.contains(-1) and tree.contains(map.begin()->first));
+  same(tree.snapshot(), map);
+
+  std::vector<std::thread> readers;
+  for (auto &[snapshot, expected] : versions)
+    readers.emplace_back(same, snapshot, std::cref(expected));
+  for (int i = 0; i < 100000; ++i) {
+    const int key = static_cast<int>(rng() % 3000);
+    tree.remove(key);
+    tree.insert(key + 1, i);
+  }
+  for (auto &reader : readers)
+    reader.join();
+}
+
+// 一个写线程不断修改并定期发布快照，三个读线程同时各扫描整棵树若干遍。
+// 对照组是 std::map 加读写锁，扫描期间写线程要等
+auto test_persistent_speed() -> void {
+  constexpr int kKeys = 100000;
+  constexpr int kWrites = 200000;
+  constexpr int kReaders = 3;
+  constexpr int kScans = 20;
+  // 返回写线程和读线程各自完成的时间
+  auto run = [&](auto &&write, auto &&scan) {
+    std::vector<std::thread> readers;
+    std::vector<long long> finished(kReaders);
+    std::atomic<long long> checksum = 0; // 让扫描不被优化掉
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < kReaders; ++r) {
+      readers.emplace_back([&, r] {
+        for (int i = 0; i < kScans; ++i)
+          checksum.fetch_add(scan(), std::memory_order_relaxed);
+        finished[r] = CLAC_TIME(start);
+      });
+    }
+    std::mt19937 rng(47);
+    for (int i = 0; i < kWrites; ++i)
+      write(i, static_cast<int>(rng() % kKeys));
+    const auto writes = CLAC_TIME(start);
+    for (auto &reader : readers)
+      reader.join();
+    return std::pair<long long, long long>{writes,
+                                           std::ranges::max(finished)};
+  };
+  auto report = [&](const char *name, std::pair<long long, long long> time) {
+    std::cout << std::format("{} : {} writes {} ms, {}x{} scans {} ms\n", name,
+                             kWrites, time.first, kReaders, kScans,
+                             time.second);
+  };
+
+  rbt::PersistentRbtree<int, int> tree;
+  for (int i = 0; i < kKeys; ++i)
+    tree.insert(i, i);
+  std::mutex latest_mutex; // 只保护快照的交接，扫描不加锁
+  auto latest = tree.snapshot();
+  report("persistent rbt", run(
+      [&](int i, int key) {
+        i & 1 ? tree.remove(key) : tree.insert(key, i);
+        if (i % 1000 == 0) {
+          auto snapshot = tree.snapshot();
+          std::lock_guard lock(latest_mutex);
+          latest = std::move(snapshot);
+        }
+      },
+      [&] {
+        decltype(latest) snapshot;
+        {
+          std::lock_guard lock(latest_mutex);
+          snapshot = latest;
+        }
+        long long sum = 0;
+        for (auto [key, value] : snapshot)
+          sum += value;
+        return sum;
+      }));
+
+  std::map<int, int> map;
+  for (int i = 0; i < kKeys; ++i)
+    map.emplace(i, i);
+  std::shared_mutex map_mutex;
+  report("map + shared_mutex", run(
+      [&](int i, int key) {
+        std::unique_lock lock(map_mutex);
+        if (i & 1)
+          map.erase(key);
+        else
+          map.insert_or_assign(key, i);
+      },
+      [&] {
+        std::shared_lock lock(map_mutex);
+        long long sum = 0;
+        for (auto [key, value] : map)
+          sum += value;
+        return sum;
+      }));
+}
+
+// 每个线程改自己那一段 key，同时查别人那一段：读到的值只能是写过的
+auto test_concurrent() -> void {
+  constexpr int kThreads = 8;
+  constexpr int kRange = 1000;
+  rbt::ConcurrentRbtree<int, int> tree;
+  std::vector<std::map<int, int>> expected(kThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      std::mt19937 rng(48 + t);
+      for (int i = 0; i < 20000; ++i) {
+        const int key = t * kRange + static_cast<int>(rng() % kRange);
+        if (rng() % 4 == 0) {
+          tree.remove(key);
+          expected[t].erase(key);
+        } else if (rng() % 2 == 0) {
+          tree.insert(key, key * 2);
+          expected[t][key] = key * 2;
+        }
+        const int other = static_cast<int>(rng() % (kThreads * kRange));
+        if (auto value = tree.find(other))
+          assert(*value == other * 2);
+        if (i % 2000 == 0) {
+          auto snapshot = tree.snapshot();
+          size_t count = 0;
+          for (auto [key, value] : snapshot) {
+            assert(value == key * 2);
+            ++count;
+          }
+          assert(count == snapshot.size());
+        }
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  std::map<int, int> all;
+  for (auto &part : expected)
+    all.insert(part.begin(), part.end());
+  auto snapshot = tree.snapshot();
+  assert(snapshot.size() == all.size() and tree.size() == all.size());
+  assert(std::equal(snapshot.begin(), snapshot.end(), all.begin(),
+                    [](auto a, const auto &b) {
+                      return a.first == b.first and a.second == b.second;
+                    }));
+}
+
+// 1 到 64 个线程，读多写少（95/5）和读写各半（50/50），
+// 对照组是一把互斥锁保护的 Rbtree
+auto test_concurrent_speed() -> void {
+  constexpr int kKeys = 100000;
+  constexpr int kOps = 400000; // 所有线程合计
+  auto run = [](int threads, int write_percent, auto &&find, auto &&write) {
+    std::vector<std::thread> workers;
+    std::atomic<long long> found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t] {
+        std::mt19937 rng(49 + t);
+        long long hits = 0;
+        for (int i = 0; i < kOps / threads; ++i) {
+          const int key = static_cast<int>(rng() % kKeys);
+          if (static_cast<int>(rng() % 100) < write_percent)
+            write(key, i);
+          else
+            hits += find(key);
+        }
+        found.fetch_add(hits, std::memory_order_relaxed);
+      });
+    }
+    for (auto &worker : workers)
+      worker.join();
+    return CLAC_TIME(start);
+  };
+
+  for (int write_percent : {5, 50}) {
+    for (int threads : {1, 2, 4, 8, 16, 32, 64}) {
+      rbt::ConcurrentRbtree<int, int> concurrent;
+      rbt::Rbtree<int, int> locked;
+      std::mutex mutex;
+      for (int i = 0; i < kKeys; i += 2) {
+        concurrent.insert(i, i);
+        locked.insert(i, i);
+      }
+      const auto rcu = run(
+          threads, write_percent,
+          [&](int key) { return concurrent.contains(key); },
+          [&](int key, int i) {
+            i & 1 ? concurrent.remove(key) : concurrent.insert(key, i);
+          });
+      const auto mutexed = run(
+          threads, write_percent,
+          [&](int key) {
+            std::lock_guard lock(mutex);
+            return locked.contains(key);
+          },
+          [&](int key, int i) {
+            std::lock_guard lock(mutex);
+            i & 1 ? locked.remove(key) : locked.insert(key, i);
+          });
+      std::cout << std::format(
+          "{}/{} {} threads : concurrent rbt {} ms, mutex rbt {} ms\n",
+          100 - write_percent, write_percent, threads, rcu, mutexed);
+    }
+  }
+}
+
+auto test_bptree() -> void {
+  std::mt19937 rng(48);
+  rbt::BPlusTree<int, int> tree;
+  std::map<int, int> map;
+  for (int i = 0; i < 300000; ++i) {
+    const int key = static_cast<int>(rng() % 20000) - 10000;
+    switch (rng() % 4) {
+    case 0:
+      tree.remove(key);
+      map.erase(key);
+      break;
+    case 1:
+      tree[key] += i;
+      map[key] += i;
+      break;
+    default:
+      tree.insert(key, i);
+      map[key] = i;
+    }
+    assert(tree.contains(key) == map.contains(key));
+    if (i % 10000 == 0) {
+      assert(tree.size() == map.size());
+      assert(std::equal(tree.begin(), tree.end(), map.begin(), map.end(),
+                        [](auto a, const auto &b) {
+                          return a.first == b.first and a.second == b.second;
+                        }));
+      auto range = tree.range(key, key + 500);
+      assert(std::equal(range.begin(), range.end(), map.lower_bound(key),
+                        map.lower_bound(key + 500),
+                        [](auto a, const auto &b) { return a.first == b.first; }));
+    }
+  }
+  for (auto [key, value] : std::map<int, int>(map))
+    tree.remove(key);
+  assert(tree.size() == 0 and tree.begin() == tree.end());
+
+  // 非算术 key 走二分
+  rbt::BPlusTree<std::string, int> strings;
+  for (int i = 0; i < 10000; ++i)
+    strings.insert(std::to_string(i), i);
+  for (int i = 0; i < 10000; i += 2)
+    strings.remove(std::to_string(i));
+  assert(strings.size() == 5000 and strings.contains("9999") and
+         !strings.contains("9998"));
+}
+
+// 随机 int key 的点查、区间扫描和删除。SkipList 没有 lower_bound，区间一项跳过
+auto test_ordered_map_speed() -> void {
+  constexpr int kRanges = 10000;
+  constexpr int kWidth = 400; // key 在 [0, 4N) 内，每个区间约 100 个元素
+  std::mt19937 rng(48);
+  std::vector<int> keys(N), probes(N);
+  for (auto &key : keys)
+    key = static_cast<int>(rng() % (4 * N));
+  for (auto &probe : probes)
+    probe = static_cast<int>(rng() % (4 * N));
+
+  auto bench = [&](const char *name, auto &&insert, auto &&contains,
+                   auto &&scan, auto &&remove) {
+    auto start = std::chrono::steady_clock::now();
+    for (int key : keys)
+      insert(key);
+    const auto insert_ms = CLAC_TIME(start);
+    start = std::chrono::steady_clock::now();
+    long long hits = 0;
+    for (int probe : probes)
+      hits += contains(probe);
+    const auto find_ms = CLAC_TIME(start);
+    start = std::chrono::steady_clock::now();
+    long long sum = 0;
+    for (int i = 0; i < kRanges; ++i)
+      sum += scan(probes[i], probes[i] + kWidth);
+    const auto scan_ms = CLAC_TIME(start);
+    start = std::chrono::steady_clock::now();
+    for (int key : keys)
+      remove(key);
+    const auto remove_ms = CLAC_TIME(start);
+    std::cout << std::format("{} : insert {} ms, find {} ms ({} hits), "
+                             "range {} ms (sum {}), remove {} ms\n",
+                             name, insert_ms, find_ms, hits, scan_ms, sum,
+                             remove_ms);
+  };
+  auto sum_range = [](auto &&range) {
+    long long sum = 0;
+    for (auto [key, value] : range)
+      sum += value;
+    return sum;
+  };
+
+  {
+    std::map<int, int> map;
+    bench(
+        "map", [&](int key) { map[key] = key; },
+        [&](int key) { return map.contains(key); },
+        [&](int lo, int hi) {
+          return sum_range(std::ranges::subrange(map.lower_bound(lo),
+                                                 map.lower_bound(hi)));
+        },
+        [&](int key) { map.erase(key); });
+  }
+  {
+    rbt::Rbtree<int, int> tree;
+    bench(
+        "rbt", [&](int key) { tree.insert(key, key); },
+        [&](int key) { return tree.contains(key); },
+        [&](int lo, int hi) { return sum_range(tree.range(lo, hi)); },
+        [&](int key) { tree.remove(key); });
+  }
+  {
+    rbt::BPlusTree<int, int> tree;
+    bench(
+        "bptree", [&](int key) { tree.insert(key, key); },
+        [&](int key) { return tree.contains(key); },
+        [&](int lo, int hi) { return sum_range(tree.range(lo, hi)); },
+        [&](int key) { tree.remove(key); });
+  }
+  {
+    mzi::SkipList<int, int> list;
+    bench(
+        "skiplist", [&](int key) { list[key] = key; },
+        [&](int key) { return list.contains(key); },
+        [](int, int) { return 0LL; }, [&](int key) { list.erase(key); });
+  }
+}
+
+// 字符串 key：两次比较换成一次，查找用 string_view 时不再构造 std::string
+auto test_string_speed() -> void {
+  std::mt19937 rng(49);
+  std::vector<std::string> keys(N / 2);
+  for (auto &key : keys)
+    key = std::format("session/{}/{}", rng() % 1000, rng());
+  std::vector<std::string_view> probes(keys.begin(), keys.end());
+  std::shuffle(probes.begin(), probes.end(), rng);
+
+  auto bench = [&](const char *name, auto &tree, auto &&lookup) {
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &key : keys)
+      tree.insert_or_assign(key, 1);
+    const auto insert_ms = CLAC_TIME(start);
+    start = std::chrono::steady_clock::now();
+    long long hits = 0;
+    for (auto probe : probes)
+      hits += lookup(tree, probe);
+    std::cout << std::format("{} : insert {} ms, find {} ms ({} hits)\n", name,
+                             insert_ms, CLAC_TIME(start), hits);
+  };
+  {
+    std::map<std::string, int> map;
+    bench("string map", map, [](auto &map, std::string_view key) {
+      return map.contains(std::string(key));
+    });
+  }
+  {
+    rbt::Rbtree<std::string, int> tree;
+    bench("string rbt std::less<std::string>", tree,
+          [](auto &tree, std::string_view key) {
+            return tree.contains(std::string(key));
+          });
+  }
+  {
+    rbt::Rbtree<std::string, int, rbt::NoAugment, std::less<>> tree;
+    bench("string rbt std::less<>", tree, [](auto &tree, std::string_view key) {
+      return tree.contains(key);
+    });
+  }
+  {
+    rbt::Rbtree<std::string, int, rbt::NoAugment, std::compare_three_way> tree;
+    bench("string rbt std::compare_three_way", tree,
+          [](auto &tree, std::string_view key) { return tree.contains(key); });
+  }
+  // 每次命中查找的比较次数，原来先 > 再 < 的写法约为层数的 1.5 倍
+  struct CountingLess {
+    long long *count;
+    auto operator()(const std::string &a, const std::string &b) const -> bool {
+      ++*count;
+      return a < b;
+    }
+  };
+  long long compares = 0;
+  rbt::Rbtree<std::string, int, rbt::NoAugment, CountingLess> counted(
+      CountingLess{&compares});
+  for (const auto &key : keys)
+    counted.insert(key, 1);
+  compares = 0;
+  for (const auto &key : keys)
+    assert(counted.contains(key));
+  std::cout << std::format("string rbt compares per find : {}\n",
+                           compares / static_cast<long long>(keys.size()));
+}
+
+auto test_debug_speed() -> void {
+  rbt::Rbtree<int, int> tree;
+  for (int i = 0; i < N; ++i)
+    tree.insert(tree.end(), i, i);
+  auto start = std::chrono::steady_clock::now();
+  auto stats = tree.validate();
+  std::cout << std::format(
+      "rbt validate : {} ms (size {}, height {}, black height {}, {} bytes)\n",
+      CLAC_TIME(start), stats.size, stats.height, stats.black_height,
+      stats.memory);
+  assert(stats.ok());
+
+  const auto path = std::filesystem::temp_directory_path() / "rbt_debug.dot";
+  start = std::chrono::steady_clock::now();
+  tree.draw(path);
+  std::cout << std::format("rbt draw : {} ms ({} bytes)\n", CLAC_TIME(start),
+                           std::filesystem::file_size(path));
+  start = std::chrono::steady_clock::now();
+  tree.draw(path, {8});
+  std::cout << std::format("rbt draw 8 levels : {} ms\n", CLAC_TIME(start));
+  std::filesystem::remove(path);
+}
+
 auto main() -> int {
+  test_random();
+  test_iterator();
+  test_augment();
+  test_bulk();
+  test_compare();
+  test_validate();
+  test_persistent();
+  test_concurrent();
+  test_bptree();
   test_map();
   test_rbt();
+  test_random_remove();
+  test_hint_insert();
+  test_bulk_speed();
+  test_persistent_speed();
+  test_concurrent_speed();
+  test_ordered_map_speed();
+  test_string_speed();
+  test_debug_speed();
 }
@@ -20,7 +20,7 @@ struct SkipList {
     V value;
     std::vector<std::shared_ptr<SkipListNode>> forward;
     SkipListNode(K key, V value, int level) : key(key), value(value) {
-      forward.reserve(level + 1);
+      forward.resize(level + 1);
     }
   };
 
@@ -48,6 +48,9 @@ private:
 
 public:
   SkipList();
+  SkipList(const SkipList &) = delete;
+  auto operator=(const SkipList &) -> SkipList & = delete;
+  ~SkipList();
   auto random_level() -> int;
   auto find(const K& key) -> std::pair<Nptr, bool>;
   auto insert(const K& key, const V& value) -> bool;
@@ -67,6 +70,16 @@ SkipList<K, V, Comp>::SkipList()
   }
 }
 
+// 逐个断开第 0 层，避免 shared_ptr 链式析构递归爆栈
+template <typename K, typename V, typename Comp>
+SkipList<K, V, Comp>::~SkipList() {
+  for (Nptr node = head; node != nullptr;) {
+    Nptr next = node->forward[0];
+    node->forward.clear();
+    node = std::move(next);
+  }
+}
+
 template <typename K, typename V, typename Comp>
 auto SkipList<K, V, Comp>::random_level() -> int {
   int level = 0;
@@ -102,10 +115,11 @@ auto SkipList<K, V, Comp>::erase(const K& key) -> bool {
   if (!status) {
     return false;
   }
+  Nptr node = tmp->forward[0];
   for (int i = 0; i <= cur_level; ++i) {
-    if (update[i]->forward[i] != tmp->forward[i])
+    if (update[i]->forward[i] != node)
       break;
-    update[i]->forward[i] = tmp->forward[i]->forward[i];
+    update[i]->forward[i] = node->forward[i];
   }
   return true;
 }
@@ -73,7 +73,10 @@ void ThreadPool::shutdown() {
   if (shutdown_) {
     return;
   }
-  shutdown_ = true;
+  {
+    std::unique_lock lock(mutex_);
+    shutdown_ = true;
+  }
   condition_.notify_all();
   for (size_t i = 0; i < threads_; ++i) {
     if (works_[i].joinable()) {
@@ -95,8 +98,11 @@ auto ThreadPool::submit(F &&f, Arg &&...args)
 
   std::function<void()> wrap_task = [task_ptr] { (*task_ptr)(); };
 
-  tasks_.push(wrap_task);
-
+  {
+    // a worker between its predicate check and its wait must see the task
+    std::unique_lock lock(mutex_);
+    tasks_.push(wrap_task);
+  }
   condition_.notify_one();
 
   return task_ptr->get_future();